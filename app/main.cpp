@@ -1,10 +1,15 @@
 #include <iostream>
+#include <array>
 #include <string>
-#include <fstream>
 #include <algorithm>
 
 #include "NeuralNet.h"
 #include "statpack.h"
+#include "Metrics.h"
+#include "Checkpoint.h"
+#include "GAN.h"
+#include "QuantizedNet.h"
+#include "Profiler.h"
 
 int main(int argc, char *argv[]) {
     std::cout << "Running...\n";
@@ -14,23 +19,23 @@ int main(int argc, char *argv[]) {
     }
     std::vector<std::vector<float>> real { { 1,0,1,0 } };
 
+    GAN gan;
+    NeuralNet &generator = gan.generator;
+    NeuralNet &discriminator = gan.discriminator;
+
     // Set up generator
-    NeuralNet generator;
     generator.learnRate = .5;
     generator.addLayer(1);
     // generator.addLayer(4);
     generator.addLayer(4);
     generator.setCostFunction("log-gdz");
     generator.setActivationFunction("relu");
-    generator.build();
-    generator.randomizeWeightsAndBiases();
     generator.inputMin = -1;
     generator.inputMax = 1;
     generator.targetMin = 0;
     generator.targetMax = 1;
 
     // Set up discriminator
-    NeuralNet discriminator;
     discriminator.learnRate = .5;
     discriminator.addLayer(4);
     // discriminator.addLayer(3);
@@ -38,88 +43,108 @@ int main(int argc, char *argv[]) {
     discriminator.addLayer(1);
     discriminator.setCostFunction("log-dz");
     discriminator.setActivationFunction("relu");
-    discriminator.build();
-    discriminator.randomizeWeightsAndBiases();
     discriminator.inputMin = generator.targetMin;
     discriminator.inputMax = generator.targetMax;
     discriminator.targetMin = 0;
     discriminator.targetMax = 1;
 
-    generator.GANLink = &discriminator;
+    gan.build();
+    generator.randomizeWeightsAndBiases();
+    discriminator.randomizeWeightsAndBiases();
 
     statpack::Random::seed();
     int iterations = 0;
-    std::ofstream genLossStream("./g_loss.txt");
-    std::ofstream discLossStream("./d_loss.txt");
-    std::ofstream genWeightStream("./g_w1.txt");
-    std::ofstream genBiasStream("./g_b1.txt");
-    std::ofstream discWeightStream("./d_w1.txt");
-    std::ofstream discBiasStream("./d_b1.txt");
+    // Plot with tools/lineplot.py and tools/pcolor.py
+    MetricsSink metrics;
+    const size_t genLoss = metrics.addSeries("./g_loss.bin", { "loss" });
+    const size_t discLoss = metrics.addSeries("./d_loss.bin", { "loss" });
+    const size_t genWeights = metrics.addSeries("./g_w1.bin", { "w0", "w1", "w2", "w3" });
+    const size_t genBiases = metrics.addSeries("./g_b1.bin", { "b0", "b1", "b2", "b3" });
+    const size_t discWeights = metrics.addSeries("./d_w1.bin", { "w0", "w1", "w2", "w3" });
+    const size_t discBiases = metrics.addSeries("./d_b1.bin", { "b0" });
+    checkpoint::Snapshotter genSnapshots("./generator.ckpt");
+    checkpoint::Snapshotter discSnapshots("./discriminator.ckpt");
+    constexpr const int SNAPSHOT_INTERVAL = 500;
     constexpr const int BATCH_SIZE_1 = 5;
     constexpr const int BATCH_SIZE_2 = 5;
     while (true) {
+        MNIST_PROFILE_SCOPE("gan iteration");
         // Run N number of epochs and check loss
         // Update both with fake data
-        for (int k = 0; k < BATCH_SIZE_1; ++k) {
-            std::vector<float> in = { statpack::Random::Float(-1.0, 1.0) };
-            std::vector<float> out = generator.generate(in);
-            std::vector<float> prob = discriminator.generate(out);
-            discriminator.backPropagate(prob, BATCH_SIZE_1, false);
-            generator.backPropagate(prob, BATCH_SIZE_1, false);
+        {
+            MNIST_PROFILE_SCOPE("gan fake steps");
+            MNIST_PROFILE_WORK("gan fake steps", 0, 0, 0, BATCH_SIZE_1);
+            // One latent input per fake sample, drawn as a batch
+            std::array<float, BATCH_SIZE_1> latent;
+            statpack::Random::generator().fillUniform(statpack::Span<float>(latent.data(), latent.size()), -1.0f, 1.0f);
+            for (const float &noise : latent) {
+                gan.fakeStep(&noise, BATCH_SIZE_1);
+            }
         }
-        discriminator.applyDeltas();
-        generator.applyDeltas();
+        // Losses of the last fake sample, before this update
+        const uint64_t step = static_cast<uint64_t>(iterations);
+        metrics.record(genLoss, step, { gan.generatorLoss() });
+        metrics.record(discLoss, step, { gan.discriminatorLoss() });
+        gan.applyDeltas();
 
         // Update discriminator with real data
-        for (int k = 0; k < BATCH_SIZE_2; ++k) {
-            const int max = static_cast<int>(std::max(real.size(), static_cast<size_t>(std::numeric_limits<int>::max())));
-            const int ind = statpack::Random::Int(0, max - 1);
-            std::vector<float> prob = discriminator.generate(real[ind]);
-            discriminator.backPropagate(prob, BATCH_SIZE_2, true);
+        {
+            MNIST_PROFILE_SCOPE("gan real steps");
+            MNIST_PROFILE_WORK("gan real steps", 0, 0, 0, BATCH_SIZE_2);
+            for (int k = 0; k < BATCH_SIZE_2; ++k) {
+                const int max = static_cast<int>(std::min(real.size(), static_cast<size_t>(std::numeric_limits<int>::max())));
+                const int ind = statpack::Random::Int(0, max - 1);
+                gan.realStep(real[static_cast<size_t>(ind)].data(), BATCH_SIZE_2);
+            }
         }
         discriminator.applyDeltas();
 
-        // Calculate losses
-        std::vector<float> in = { statpack::Random::Float(-1.0, 1.0) };
-        std::vector<float> out = generator.generate(in);
-        std::vector<float> prob = discriminator.generate(out);
-
-        float loss = generator.costFunctionPointer(prob, {}, false);
-        genLossStream << loss << "\n";
-        loss = discriminator.costFunctionPointer(prob, {}, false);
-        discLossStream << loss << "\n";
+        MNIST_PROFILE_SCOPE("gan metrics");
+        metrics.record(genWeights, step, { generator.layers[0].weights[0][0],
+                                           generator.layers[0].weights[1][0],
+                                           generator.layers[0].weights[2][0],
+                                           generator.layers[0].weights[3][0] });
+        metrics.record(genBiases, step, generator.layers[0].biases.data());
+        metrics.record(discWeights, step, discriminator.layers[0].weights.row(0));
+        metrics.record(discBiases, step, discriminator.layers[0].biases.data());
 
-        genWeightStream << generator.layers[0].weights[0][0] << "\t" <<
-                           generator.layers[0].weights[1][0] << "\t" <<
-                           generator.layers[0].weights[2][0] << "\t" <<
-                           generator.layers[0].weights[3][0] << "\n";
-        genBiasStream << generator.layers[0].biases[0] << "\t" <<
-                         generator.layers[0].biases[1] << "\t" <<
-                         generator.layers[0].biases[2] << "\t" <<
-                         generator.layers[0].biases[3] << "\n";
-        discWeightStream << discriminator.layers[0].weights[0][1] << "\t" <<
-                           discriminator.layers[0].weights[0][2] << "\t" <<
-                           discriminator.layers[0].weights[0][3] << "\t" <<
-                           discriminator.layers[0].weights[0][4] << "\n";
-        discBiasStream << discriminator.layers[0].biases[0] << "\n";
+        if (iterations % SNAPSHOT_INTERVAL == 0) {
+            genSnapshots.snapshot(generator);
+            discSnapshots.snapshot(discriminator);
+        }
 
         ++iterations;
         if (iterations > 3000) {
             break;
         }
     }
-    genLossStream.close();
-    discLossStream.close();
-    genWeightStream.close();
-    genBiasStream.close();
-    discWeightStream.close();
-    discBiasStream.close();
+    metrics.flush();
+
+    // Both are no-ops unless built with -DMNIST_PROFILE=ON
+    profiler::writeSummary(std::cout);
+    profiler::writeChromeTrace("./profile.json");
 
     std::vector<float> tmp = generator.generate({ -.7 });
     std::cout << tmp[0] << " " << tmp[1] << " " << tmp[2] << " " << tmp[3] << "\n";
     std::vector<float> tmp2 = generator.generate({ .5 });
     std::cout << tmp2[0] << " " << tmp2[1] << " " << tmp2[2] << " " << tmp2[3] << "\n";
 
+    // Accuracy drift of reduced precision copies of the generator
+    statpack::AlignedVector<float> noise(256);
+    for (size_t i = 0; i < noise.size(); ++i) {
+        noise[i] = -1.0f + 2.0f * static_cast<float>(i) / static_cast<float>(noise.size() - 1);
+    }
+    const statpack::MatrixView<const float> noiseRows(noise.data(), noise.size(), 1, 1);
+    for (QuantizedNet::Precision precision : { QuantizedNet::Precision::Int8, QuantizedNet::Precision::BFloat16 }) {
+        QuantizedNet quantized;
+        if (quantized.quantize(generator, precision)) {
+            const QuantizedNet::Drift drift = quantized.drift(generator, noiseRows);
+            std::cout << (precision == QuantizedNet::Precision::Int8 ? "int8" : "bf16")
+                      << " drift: max " << drift.maxAbs << ", mean " << drift.meanAbs << ", rms " << drift.rms
+                      << ", " << quantized.parameterBytes() << "/" << quantized.floatParameterBytes() << " bytes\n";
+        }
+    }
+
     std::cout << "Ending...\n";
     return 0;
 }
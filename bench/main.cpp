@@ -0,0 +1,508 @@
+/**
+ *  MnistNNBench
+ *
+ *  Machine-readable results for comparing versions:
+ *      MnistNNBench --benchmark_out=bench.json --benchmark_out_format=json
+ *  and compare two runs with Google Benchmark's tools/compare.py.
+ *  The IDX benchmarks write a synthetic dataset to the temp directory
+ *  first, so no MNIST download is needed. The dataset cache benchmarks
+ *  keep their files in mnistnn-bench-cache there.
+ */
+#include <benchmark/benchmark.h>
+
+#include <array>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <string>
+#include <fstream>
+#include <filesystem>
+#include <cstdint>
+
+#include "NeuralNet.h"
+#include "StaticNeuralNet.h"
+#include "statpack.h"
+#include "mnistParser.h"
+#include "DataLoader.h"
+#include "ImagePipeline.h"
+#include "DataParallel.h"
+#include "DatasetCache.h"
+#include "SampleStream.h"
+#include "Rng.h"
+#include "InferenceServer.h"
+
+namespace {
+    constexpr const int SIDE = 28;
+    constexpr const int PIXELS = SIDE * SIDE;
+    constexpr const int32_t SYNTHETIC_IMAGES = 10000;
+
+    // A bright blob away from the borders, like a centred digit
+    std::array<float, PIXELS> syntheticDigit() {
+        std::array<float, PIXELS> image{};
+        for (int row = 6; row < 22; ++row) {
+            for (int col = 9; col < 19; ++col) {
+                image[static_cast<size_t>(col + row * SIDE)] = static_cast<float>((row * 7 + col * 13) % 256);
+            }
+        }
+        return image;
+    }
+
+    void writeBigEndian(std::ofstream &out, uint32_t value) {
+        const char bytes[4] = { static_cast<char>(value >> 24), static_cast<char>(value >> 16),
+                                static_cast<char>(value >> 8), static_cast<char>(value) };
+        out.write(bytes, 4);
+    }
+
+    struct SyntheticIdx {
+        std::string images;
+        std::string labels;
+
+        SyntheticIdx() {
+            const std::filesystem::path dir = std::filesystem::temp_directory_path();
+            images = (dir / "mnistnn-bench-images.idx3-ubyte").string();
+            labels = (dir / "mnistnn-bench-labels.idx1-ubyte").string();
+
+            std::ofstream imageFile(images, std::ios::binary);
+            writeBigEndian(imageFile, mnistParser::IMAGE_MAGIC);
+            writeBigEndian(imageFile, SYNTHETIC_IMAGES);
+            writeBigEndian(imageFile, SIDE);
+            writeBigEndian(imageFile, SIDE);
+            std::vector<char> pixels(PIXELS);
+            for (int32_t n = 0; n < SYNTHETIC_IMAGES; ++n) {
+                for (size_t i = 0; i < pixels.size(); ++i) {
+                    pixels[i] = static_cast<char>((static_cast<size_t>(n) * 31 + i * 17) % 256);
+                }
+                imageFile.write(pixels.data(), static_cast<std::streamsize>(pixels.size()));
+            }
+
+            std::ofstream labelFile(labels, std::ios::binary);
+            writeBigEndian(labelFile, mnistParser::LABEL_MAGIC);
+            writeBigEndian(labelFile, SYNTHETIC_IMAGES);
+            for (int32_t n = 0; n < SYNTHETIC_IMAGES; ++n) {
+                labelFile.put(static_cast<char>(n % 10));
+            }
+        }
+
+        ~SyntheticIdx() {
+            std::error_code ignored;
+            std::filesystem::remove(images, ignored);
+            std::filesystem::remove(labels, ignored);
+        }
+    };
+
+    const SyntheticIdx& syntheticIdx() {
+        static const SyntheticIdx files;
+        return files;
+    }
+
+    // 100 -> hidden -> 784, the shape of an MNIST generator
+    NeuralNet makeNet(size_t hidden) {
+        NeuralNet net;
+        net.addLayer(100);
+        net.addLayer(hidden);
+        net.addLayer(PIXELS);
+        net.build();
+        net.randomizeWeightsAndBiases(1);
+        for (auto &layer : net.layers) {
+            for (float &param : layer.params) {
+                param *= 0.01f;
+            }
+        }
+        return net;
+    }
+
+    int64_t netFlops(const NeuralNet &net) {
+        int64_t flops = 0;
+        for (size_t i = 0; i + 1 < net.layers.size(); ++i) {
+            flops += 2 * static_cast<int64_t>(net.layers[i].sizeIn * net.layers[i].sizeOut);
+        }
+        return flops;
+    }
+
+    void setFlops(benchmark::State &state, int64_t flopsPerIteration) {
+        state.counters["FLOPS"] = benchmark::Counter(static_cast<double>(flopsPerIteration),
+                                                     benchmark::Counter::kIsIterationInvariantRate);
+    }
+}
+
+static void BM_WeightedSum(benchmark::State &state) {
+    const size_t size = static_cast<size_t>(state.range(0));
+    std::vector<float> inputs(size, 0.5f);
+    std::vector<float> weights(size, 0.25f);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(statpack::weightedSum(inputs, weights));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.SetBytesProcessed(state.iterations() * state.range(0) * 2 * static_cast<int64_t>(sizeof(float)));
+    setFlops(state, 2 * state.range(0));
+}
+BENCHMARK(BM_WeightedSum)->RangeMultiplier(4)->Range(16, 16384);
+
+static void BM_RescaleImage(benchmark::State &state) {
+    const std::array<float, PIXELS> image = syntheticDigit();
+    for (auto _ : state) {
+        auto out = statpack::rescaleImage<float, SIDE, SIDE, 20, 20>(image);
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_RescaleImage);
+
+static void BM_RescaleCroppedImage(benchmark::State &state) {
+    const std::array<float, PIXELS> image = syntheticDigit();
+    const statpack::ImageVector<float> cropped = statpack::cropBlackBackground<float, SIDE, SIDE>(image);
+    for (auto _ : state) {
+        auto out = statpack::rescaleImage<float, 20, 20>(cropped.data, cropped.width, cropped.height);
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_RescaleCroppedImage);
+
+static void BM_RescaleMnistToHalf(benchmark::State &state) {
+    const std::array<float, PIXELS> image = syntheticDigit();
+    for (auto _ : state) {
+        auto out = statpack::rescaleMnistToHalf<float, PIXELS, PIXELS / 4>(image);
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_RescaleMnistToHalf);
+
+static void BM_CropBlackBackground(benchmark::State &state) {
+    const std::array<float, PIXELS> image = syntheticDigit();
+    for (auto _ : state) {
+        auto out = statpack::cropBlackBackground<float, SIDE, SIDE>(image);
+        benchmark::DoNotOptimize(out.data.data());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CropBlackBackground);
+
+// Arg: images per batch, all cropped, rescaled to 28x28, halved and standardized
+static void BM_ImagePipeline(benchmark::State &state) {
+    const std::array<float, PIXELS> image = syntheticDigit();
+    const size_t count = static_cast<size_t>(state.range(0));
+    statpack::AlignedVector<float> images(count * PIXELS);
+    for (size_t i = 0; i < count; ++i) {
+        std::copy(image.begin(), image.end(), images.begin() + static_cast<std::ptrdiff_t>(i * PIXELS));
+    }
+    statpack::ImagePipeline::Config config;
+    config.crop = true;
+    config.downsample = true;
+    config.standardize = true;
+    const statpack::ImagePipeline pipeline(config);
+    statpack::AlignedVector<float> out(count * pipeline.outputSize());
+    const statpack::MatrixView<const float> in(images.data(), count, PIXELS, PIXELS);
+    const statpack::MatrixView<float> outView(out.data(), count, pipeline.outputSize(), pipeline.outputSize());
+    for (auto _ : state) {
+        pipeline.run(in, outView);
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ImagePipeline)->Arg(1)->Arg(1024);
+
+// Arg: values per fill, e.g. one latent batch or one weight matrix
+static void BM_FillUniform(benchmark::State &state) {
+    statpack::Rng rng(1);
+    statpack::AlignedVector<float> values(static_cast<size_t>(state.range(0)));
+    for (auto _ : state) {
+        rng.fillUniform(statpack::Span<float>(values.data(), values.size()), -1.0f, 1.0f);
+        benchmark::DoNotOptimize(values.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_FillUniform)->Arg(100)->Arg(65536);
+
+static void BM_FillNormal(benchmark::State &state) {
+    statpack::Rng rng(1);
+    statpack::AlignedVector<float> values(static_cast<size_t>(state.range(0)));
+    for (auto _ : state) {
+        rng.fillNormal(statpack::Span<float>(values.data(), values.size()), 0.0f, 1.0f);
+        benchmark::DoNotOptimize(values.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_FillNormal)->Arg(100)->Arg(65536);
+
+// The weight initialization of a 784 -> 1024 -> 784 net
+static void BM_RandomizeWeights(benchmark::State &state) {
+    NeuralNet net;
+    net.addLayer(PIXELS);
+    net.addLayer(1024);
+    net.addLayer(PIXELS);
+    net.build();
+    for (auto _ : state) {
+        net.randomizeWeightsAndBiases(1);
+        benchmark::DoNotOptimize(net.layers[0].params.data());
+    }
+}
+BENCHMARK(BM_RandomizeWeights);
+
+static void BM_ForwardPropagate(benchmark::State &state) {
+    NeuralNet net = makeNet(static_cast<size_t>(state.range(0)));
+    std::vector<float> inputs(100, 0.5f);
+    for (auto _ : state) {
+        net.forwardPropagate(inputs);
+        benchmark::DoNotOptimize(net.layers.back().nodes.data());
+    }
+    state.SetItemsProcessed(state.iterations());
+    setFlops(state, netFlops(net));
+}
+BENCHMARK(BM_ForwardPropagate)->Arg(64)->Arg(256)->Arg(1024);
+
+// The same net as BM_ForwardPropagate/256 with its sizes fixed at compile time
+static void BM_StaticForwardPropagate(benchmark::State &state) {
+    using StaticNet = StaticNeuralNet<Network::Activation::Sigmoid, 100, 256, static_cast<size_t>(PIXELS)>;
+    const NeuralNet net = makeNet(256);
+    auto fixed = std::make_unique<StaticNet>();
+    for (size_t k = 0; k < 256; ++k) {
+        std::copy(net.layers[0].weights.row(k), net.layers[0].weights.row(k) + 100, fixed->layer<0>().weightRow(k));
+        fixed->layer<0>().biases[k] = net.layers[0].biases[k];
+    }
+    for (size_t k = 0; k < StaticNet::OUTPUT_SIZE; ++k) {
+        std::copy(net.layers[1].weights.row(k), net.layers[1].weights.row(k) + 256, fixed->layer<1>().weightRow(k));
+        fixed->layer<1>().biases[k] = net.layers[1].biases[k];
+    }
+    std::vector<float> inputs(100, 0.5f);
+    for (auto _ : state) {
+        fixed->forwardPropagate(inputs.data());
+        benchmark::DoNotOptimize(fixed->layer<1>().nodes.data());
+    }
+    state.SetItemsProcessed(state.iterations());
+    setFlops(state, netFlops(net));
+}
+BENCHMARK(BM_StaticForwardPropagate);
+
+static void BM_BackPropagate(benchmark::State &state) {
+    NeuralNet net = makeNet(static_cast<size_t>(state.range(0)));
+    std::vector<float> inputs(100, 0.5f);
+    std::vector<float> target(PIXELS, 0.25f);
+    net.forwardPropagate(inputs);
+    for (auto _ : state) {
+        net.backPropagate(target, 64.0f);
+        benchmark::DoNotOptimize(net.layers[0].params.data());
+    }
+    state.SetItemsProcessed(state.iterations());
+    // delta_weights and delta_nodes each take a multiply-add per weight
+    setFlops(state, 2 * netFlops(net));
+}
+BENCHMARK(BM_BackPropagate)->Arg(64)->Arg(256)->Arg(1024);
+
+static void BM_ApplyDeltas(benchmark::State &state) {
+    NeuralNet net = makeNet(static_cast<size_t>(state.range(0)));
+    int64_t params = 0;
+    for (size_t i = 0; i + 1 < net.layers.size(); ++i) {
+        params += static_cast<int64_t>(net.layers[i].paramCount());
+    }
+    for (auto _ : state) {
+        net.applyDeltas();
+        benchmark::DoNotOptimize(net.layers[0].params.data());
+    }
+    // Parameters and deltas are each read and written
+    state.SetBytesProcessed(state.iterations() * params * 4 * static_cast<int64_t>(sizeof(float)));
+}
+BENCHMARK(BM_ApplyDeltas)->Arg(64)->Arg(256)->Arg(1024);
+
+// Arg: batch size, through the const forward pass
+static void BM_ForwardContext(benchmark::State &state) {
+    const NeuralNet net = makeNet(256);
+    const size_t rows = static_cast<size_t>(state.range(0));
+    statpack::AlignedVector<float> inputs(rows * 100, 0.5f);
+    const statpack::MatrixView<const float> inputView(inputs.data(), rows, 100, 100);
+    NeuralNet::Context context;
+    for (auto _ : state) {
+        net.forward(context, inputView);
+        benchmark::DoNotOptimize(context.outputs().data);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    setFlops(state, netFlops(net) * state.range(0));
+}
+BENCHMARK(BM_ForwardContext)->Arg(1)->Arg(16)->Arg(64);
+
+// Args: hidden layer size, batch size
+static void BM_TrainBatch(benchmark::State &state) {
+    NeuralNet net = makeNet(static_cast<size_t>(state.range(0)));
+    const size_t rows = static_cast<size_t>(state.range(1));
+    statpack::AlignedVector<float> inputs(rows * 100, 0.5f);
+    statpack::AlignedVector<float> targets(rows * PIXELS, 0.25f);
+    const statpack::MatrixView<const float> inputView(inputs.data(), rows, 100, 100);
+    const statpack::MatrixView<const float> targetView(targets.data(), rows, PIXELS, PIXELS);
+    for (auto _ : state) {
+        net.forwardBatch(inputView);
+        net.backwardBatch(targetView);
+        net.applyDeltas();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(1));
+    setFlops(state, 3 * netFlops(net) * state.range(1));
+}
+BENCHMARK(BM_TrainBatch)->ArgsProduct({ { 64, 256, 1024 }, { 1, 16, 64 } });
+
+// Arg: max batch. Every benchmark thread is one blocking caller of the server.
+static void BM_InferenceServer(benchmark::State &state) {
+    static NeuralNet net = makeNet(256);
+    static InferenceServer server;
+    if (state.thread_index() == 0) {
+        InferenceServer::Config config;
+        config.maxBatch = static_cast<size_t>(state.range(0));
+        server.start(net, config);
+    }
+    std::vector<float> inputs(100, 0.5f);
+    std::vector<float> outputs(PIXELS);
+    for (auto _ : state) {
+        server.generate(statpack::Span<const float>(inputs.data(), inputs.size()), statpack::Span<float>(outputs.data(), outputs.size()));
+    }
+    state.SetItemsProcessed(state.iterations());
+    if (state.thread_index() == 0) {
+        const InferenceServer::Stats stats = server.stats();
+        state.counters["batch"] = stats.meanBatch;
+        state.counters["p50_us"] = stats.p50Us;
+        state.counters["p99_us"] = stats.p99Us;
+        server.stop();
+    }
+}
+BENCHMARK(BM_InferenceServer)->Arg(1)->Arg(16)->Threads(1)->Threads(16)->UseRealTime();
+
+// Args: replicas, batch size. A small GAN-sized net, too narrow to split by neuron.
+static void BM_DataParallelTrainBatch(benchmark::State &state) {
+    NeuralNet net;
+    net.addLayer(16);
+    net.addLayer(32);
+    net.addLayer(16);
+    net.build();
+    net.randomizeWeightsAndBiases(1);
+    const size_t rows = static_cast<size_t>(state.range(1));
+    statpack::AlignedVector<float> inputs(rows * 16, 0.5f);
+    statpack::AlignedVector<float> targets(rows * 16, 0.25f);
+    const statpack::MatrixView<const float> inputView(inputs.data(), rows, 16, 16);
+    const statpack::MatrixView<const float> targetView(targets.data(), rows, 16, 16);
+    DataParallel trainer(net, static_cast<size_t>(state.range(0)));
+    for (auto _ : state) {
+        trainer.trainBatch(inputView, targetView);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(1));
+}
+// Workers do the shards, so measure wall time
+BENCHMARK(BM_DataParallelTrainBatch)->ArgsProduct({ { 1, 2, 4 }, { 256 } })->UseRealTime();
+
+static void BM_IdxOpen(benchmark::State &state) {
+    const SyntheticIdx &files = syntheticIdx();
+    for (auto _ : state) {
+        mnistParser::Dataset dataset;
+        if (!dataset.open(files.images, files.labels)) {
+            state.SkipWithError("Could not open the synthetic dataset");
+            break;
+        }
+        benchmark::DoNotOptimize(dataset.size());
+    }
+}
+BENCHMARK(BM_IdxOpen);
+
+// Arg: images decoded per call
+static void BM_IdxDecode(benchmark::State &state) {
+    const SyntheticIdx &files = syntheticIdx();
+    mnistParser::Dataset dataset;
+    if (!dataset.open(files.images, files.labels)) {
+        state.SkipWithError("Could not open the synthetic dataset");
+        return;
+    }
+    const int32_t count = static_cast<int32_t>(state.range(0));
+    statpack::AlignedVector<float> buffer(static_cast<size_t>(count) * PIXELS);
+    const statpack::MatrixView<float> out(buffer.data(), static_cast<size_t>(count), PIXELS, PIXELS);
+    int32_t first = 0;
+    for (auto _ : state) {
+        dataset.decodeImages(first, count, out, -1.0f, 1.0f);
+        benchmark::DoNotOptimize(buffer.data());
+        first = (first + count + count > SYNTHETIC_IMAGES ? 0 : first + count);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.SetBytesProcessed(state.iterations() * state.range(0) * PIXELS);
+}
+BENCHMARK(BM_IdxDecode)->Arg(1)->Arg(64)->Arg(1024);
+
+static void BM_DataLoader(benchmark::State &state) {
+    const SyntheticIdx &files = syntheticIdx();
+    mnistParser::Dataset dataset;
+    if (!dataset.open(files.images, files.labels)) {
+        state.SkipWithError("Could not open the synthetic dataset");
+        return;
+    }
+    mnistParser::DataLoader::Config config;
+    config.batchSize = static_cast<size_t>(state.range(0));
+    config.workers = 1;
+    mnistParser::DataLoader loader(dataset, config);
+    mnistParser::DataLoader::Batch batch;
+    for (auto _ : state) {
+        if (!loader.next(batch)) {
+            state.SkipWithError("DataLoader stopped");
+            break;
+        }
+        benchmark::DoNotOptimize(batch.images.data);
+    }
+    loader.stop();
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+// The work happens on the loader thread, so measure wall time
+BENCHMARK(BM_DataLoader)->Arg(64)->Arg(256)->UseRealTime();
+
+// Arg 0: cache format, arg 1: images read per call, after the cache is built once
+static void BM_DatasetCacheRead(benchmark::State &state) {
+    const SyntheticIdx &files = syntheticIdx();
+    mnistParser::Dataset dataset;
+    if (!dataset.open(files.images, files.labels)) {
+        state.SkipWithError("Could not open the synthetic dataset");
+        return;
+    }
+    mnistParser::DatasetCache::Config config;
+    config.normMin = -1.0f;
+    config.pipeline.crop = true;
+    config.pipeline.downsample = true;
+    config.format = static_cast<mnistParser::DatasetCache::Format>(state.range(0));
+    const std::string directory = (std::filesystem::temp_directory_path() / "mnistnn-bench-cache").string();
+    mnistParser::DatasetCache cache;
+    if (!cache.open(dataset, config, directory)) {
+        state.SkipWithError("Could not open the dataset cache");
+        return;
+    }
+    const size_t count = static_cast<size_t>(state.range(1));
+    const size_t stride = statpack::alignedStride<float>(cache.imagePixels());
+    statpack::AlignedVector<float> buffer(count * stride);
+    const statpack::MatrixView<float> out(buffer.data(), count, cache.imagePixels(), stride);
+    size_t first = 0;
+    for (auto _ : state) {
+        cache.getImages(first, count, out);
+        benchmark::DoNotOptimize(buffer.data());
+        first = (first + count + count > cache.size() ? 0 : first + count);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(1));
+}
+BENCHMARK(BM_DatasetCacheRead)->ArgsProduct({ { 0, 1 }, { 64, 1024 } });
+
+// Arg: samples per read. The stream is reopened whenever it runs out.
+static void BM_IdxStream(benchmark::State &state) {
+    const SyntheticIdx &files = syntheticIdx();
+    const size_t count = static_cast<size_t>(state.range(0));
+    mnistParser::IdxStream stream;
+    statpack::AlignedVector<float> inputs(count * statpack::alignedStride<float>(PIXELS));
+    statpack::AlignedVector<float> targets(count * statpack::alignedStride<float>(10));
+    const statpack::MatrixView<float> inputView(inputs.data(), count, PIXELS, statpack::alignedStride<float>(PIXELS));
+    const statpack::MatrixView<float> targetView(targets.data(), count, 10, statpack::alignedStride<float>(10));
+    for (auto _ : state) {
+        if (stream.read(inputView, targetView) < count) {
+            state.PauseTiming();
+            const bool opened = stream.open(files.images, files.labels);
+            state.ResumeTiming();
+            if (!opened) {
+                state.SkipWithError("Could not open the synthetic dataset");
+                break;
+            }
+        }
+        benchmark::DoNotOptimize(inputs.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.SetBytesProcessed(state.iterations() * state.range(0) * PIXELS);
+}
+BENCHMARK(BM_IdxStream)->Arg(64)->Arg(1024);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+
+#include "NeuralNet.h"
+
+/**
+ *  Binary NeuralNet checkpoints
+ *
+ *  File layout, native byte order, every block starting on a multiple of
+ *  statpack::BUFFER_ALIGNMENT bytes:
+ *      Header
+ *      uint64_t layer sizes[layerCount]
+ *      for every layer but the last
+ *          Layer::paramCount() floats: exactly the weights | biases part
+ *          of Layer::params, row padding included
+ *          stateSlots * Layer::paramCount() floats: the optimizer's moment
+ *          buffers, Layer::state(0) onwards, if stateSlots > 0
+ *
+ *  Because the blocks match the in-memory layout, loading maps the file and
+ *  copies each of them with a single memcpy. Together with the optimizer
+ *  settings and step count in the header, a momentum, RMSProp or Adam run
+ *  resumes where it stopped. Accumulated deltas are not saved.
+ *
+ *  Version 1 files have no optimizer fields or state blocks and their
+ *  header ends at optimizer. They still load, keeping net's optimizer
+ *  with zeroed state.
+ */
+namespace checkpoint {
+    inline constexpr const uint32_t MAGIC = 0x4B434E4D; // "MNCK"
+    inline constexpr const uint32_t VERSION = 2;
+
+    struct Header {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t layerCount;
+        // Floats per padded weight row unit, statpack::alignedStride<float>(1)
+        uint32_t rowAlignment;
+        uint64_t fileSize;
+        char activation[16];
+        char cost[16];
+        float learnRate;
+        float inputMin;
+        float inputMax;
+        float targetMin;
+        float targetMax;
+        float activationMin;
+        float activationMax;
+        // Version 2 on
+        char optimizer[16];
+        // Moment buffers per parameter, NeuralNet::optimizerSlots()
+        uint32_t stateSlots;
+        uint32_t reserved;
+        uint64_t optimizerStep;
+        float momentum;
+        float rmsDecay;
+        float beta1;
+        float beta2;
+        float epsilon;
+    };
+
+    bool save(const NeuralNet &net, const std::string &path);
+    /**
+     *  Replaces the layers, functions, scaling and optimizer of net with the
+     *  ones in path. net is left untouched if the file is missing or invalid.
+     */
+    bool load(NeuralNet &net, const std::string &path);
+
+    /**
+     *  Writes checkpoints from a background thread. snapshot() only copies the
+     *  parameters into a reused buffer, so the training loop does not wait
+     *  for the disk. Each file is written next to path and renamed over it,
+     *  so a crash never leaves a half-written checkpoint behind.
+     */
+    class Snapshotter {
+    public:
+        explicit Snapshotter(std::string path);
+        ~Snapshotter();
+        Snapshotter(const Snapshotter&) = delete;
+        Snapshotter& operator=(const Snapshotter&) = delete;
+
+        // Returns false and skips this snapshot if the previous one is still being written
+        bool snapshot(const NeuralNet &net);
+        // Blocks until the pending snapshot, if any, is on disk
+        void wait();
+
+    private:
+        std::string path;
+        std::vector<unsigned char> buffer;
+        std::thread writer;
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::condition_variable finished;
+        bool pending = false;
+        bool stopping = false;
+
+        void writerLoop();
+    };
+}
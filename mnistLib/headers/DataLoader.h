@@ -0,0 +1,107 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+#include "matrix.h"
+#include "mnistParser.h"
+
+namespace mnistParser {
+    /**
+     *  Assembles shuffled mini-batches from a Dataset on background threads.
+     *
+     *  Batches are numbered in the order they are consumed. Batch s is built
+     *  into ring slot s % prefetch, so while the caller trains on one batch
+     *  the workers are already decoding the following ones. Slots are handed
+     *  between workers and the consumer through one atomic turn counter each
+     *  and are reused without reallocating. The sample order depends only on
+     *  the seed, never on the number of workers.
+     */
+    class DataLoader {
+    public:
+        struct Config {
+            size_t batchSize = 64;
+            size_t workers = 1;
+            // Number of ring slots, clamped to [1, batchesPerEpoch]
+            size_t prefetch = 4;
+            uint32_t seed = 0;
+            // 0 keeps producing epochs until the loader is destroyed
+            size_t epochs = 0;
+            bool shuffle = true;
+            // Drops the last partial batch of each epoch
+            bool dropLast = true;
+            // Maps pixels 0..255 to [normMin, normMax], otherwise keeps them as is
+            bool normalizeImages = true;
+            float normMin = -1.0f;
+            float normMax = 1.0f;
+        };
+
+        struct Batch {
+            // One image per row, rows == number of samples in this batch
+            statpack::MatrixView<const float> images;
+            // Empty if the dataset has no labels
+            statpack::Span<const int32_t> labels;
+            size_t epoch = 0;
+            size_t index = 0;
+        };
+
+        // dataset must stay open for the lifetime of the loader
+        DataLoader(const Dataset &dataset, const Config &config);
+        ~DataLoader();
+        DataLoader(const DataLoader&) = delete;
+        DataLoader& operator=(const DataLoader&) = delete;
+
+        /**
+         *  Blocks until the next batch is ready and hands it out. The batch
+         *  stays valid until the following call, which recycles its slot.
+         *  Returns false once every requested epoch has been consumed.
+         */
+        bool next(Batch &batch);
+        // Stops and joins the workers; next() returns false afterwards
+        void stop();
+
+        size_t batchesPerEpoch() const { return perEpoch; }
+        size_t batchSize() const { return config.batchSize; }
+
+    private:
+        struct Slot {
+            // 2 * lap while free, 2 * lap + 1 once batch lap * slots + i is ready
+            std::atomic<uint64_t> turn{0};
+            statpack::AlignedVector<float> images;
+            std::vector<int32_t> labels;
+            size_t rows = 0;
+            size_t epoch = 0;
+        };
+
+        const Dataset &dataset;
+        Config config;
+        size_t pixels = 0;
+        size_t stride = 0;
+        size_t perEpoch = 0;
+        uint64_t totalBatches = 0;
+
+        std::unique_ptr<Slot[]> slots;
+        size_t slotCount = 0;
+
+        // Two epochs can be in flight at once, so keep a pair of orders.
+        // orderEpoch[e % 2] becomes e + 1 once the order of epoch e is written.
+        std::vector<int32_t> order[2];
+        std::atomic<uint64_t> orderEpoch[2];
+
+        std::atomic<uint64_t> nextToFill{0};
+        uint64_t nextToConsume = 0;
+        bool holding = false;
+        std::atomic<bool> stopping{false};
+        std::vector<std::thread> workers;
+
+        void workerLoop();
+        void fill(Slot &slot, uint64_t sequence);
+        void writeOrder(size_t epoch);
+        // Spins, then yields, then sleeps until value == expected or stopping
+        bool waitFor(const std::atomic<uint64_t> &value, uint64_t expected) const;
+    };
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <cstddef>
+
+#include "NeuralNet.h"
+#include "ThreadPool.h"
+#include "matrix.h"
+
+/**
+ *  Data-parallel training of one NeuralNet over worker threads.
+ *
+ *  The net is replica 0 and replicas() - 1 copies of it hold their own
+ *  parameters and deltas. Every replica processes a contiguous shard of
+ *  the mini-batch on its own thread and accumulates into its own
+ *  delta_weights/delta_biases. reduceDeltas then sums the deltas into the
+ *  net pairwise in a binary tree, split by parameter range across the
+ *  threads, and applyDeltas updates the net once and copies the new
+ *  parameters back out.
+ *
+ *  Unlike NeuralNet::setThreadCount this splits samples rather than
+ *  neurons, so it keeps every thread busy for nets whose layers are too
+ *  small to split. Sums are added in a different order than on one
+ *  thread, so results agree with it only to float rounding.
+ *
+ *  Construct after net.build() and give the net no thread pool of its own.
+ *  Call broadcast() after changing the net's parameters outside
+ *  applyDeltas. The activation, cost, scaling and GANLink settings are
+ *  copied once by the constructor.
+ */
+class DataParallel {
+public:
+    DataParallel(NeuralNet &net, size_t replicas = std::thread::hardware_concurrency());
+
+    size_t replicas() const {
+        return copies.size() + 1;
+    }
+
+    NeuralNet& replica(size_t i) {
+        return (i == 0 ? net : *copies[i - 1]);
+    }
+
+    /**
+     *  Calls fn(replica, begin, end) for contiguous shards of [0, count),
+     *  one replica per thread, and returns when all of them are done.
+     *  Shards are empty when count < replicas().
+     */
+    template <typename F>
+    void forEachShard(size_t count, F &&fn) {
+        const size_t n = replicas();
+        pool.parallelFor(n, [&](size_t first, size_t last) {
+            for (size_t r = first; r < last; ++r) {
+                const size_t begin = count * r / n;
+                const size_t end = count * (r + 1) / n;
+                if (begin < end) {
+                    fn(replica(r), begin, end);
+                }
+            }
+        });
+    }
+
+    /**
+     *  One mini-batch step: forwardBatch/backwardBatch of every shard, each
+     *  scaled by the whole batch size, then applyDeltas.
+     */
+    void trainBatch(const statpack::MatrixView<const float> &inputs, const statpack::MatrixView<const float> &targets, const bool realData = true);
+
+    // Adds the deltas of every replica into the net's and zeroes theirs
+    void reduceDeltas();
+    // reduceDeltas, one net.applyDeltas() and broadcast
+    void applyDeltas();
+    // Copies the net's weights and biases into every replica
+    void broadcast();
+
+private:
+    NeuralNet &net;
+    std::vector<std::unique_ptr<NeuralNet>> copies;
+    ThreadPool pool;
+};
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+#include "matrix.h"
+#include "mnistParser.h"
+#include "ImagePipeline.h"
+#include "ThreadPool.h"
+
+namespace mnistParser {
+    /**
+     *  Fully preprocessed images of a Dataset, stored in a file so later
+     *  runs map them instead of decoding and preprocessing again.
+     *
+     *  The file name is a 64-bit key hashed from the preprocessing
+     *  configuration and the dataset's dimensions, pixels and labels, so
+     *  every configuration gets its own file and a changed dataset never
+     *  hits a stale one. File layout, native byte order, every block
+     *  starting on a multiple of statpack::BUFFER_ALIGNMENT bytes:
+     *      Header
+     *      int32_t labels[count], if the dataset has labels
+     *      count image rows of stride floats or fp16 values each
+     *
+     *  Float32 rows are padded like every other matrix in the library, so
+     *  images() hands out the mapped file itself. Float16 halves the file
+     *  and getImages widens it back to float.
+     */
+    class DatasetCache {
+    public:
+        inline static constexpr const uint32_t MAGIC = 0x43504E4D; // "MNPC"
+        inline static constexpr const uint32_t VERSION = 2;
+
+        enum class Format : uint32_t {
+            Float32,
+            Float16
+        };
+
+        struct Config {
+            // Pixels are first mapped from 0..255 onto [normMin, normMax]
+            float normMin = 0.0f;
+            float normMax = 1.0f;
+            // widthIn, heightIn and background are taken from the dataset
+            // and normMin
+            statpack::ImagePipeline::Config pipeline;
+            Format format = Format::Float32;
+        };
+
+        struct Header {
+            uint32_t magic;
+            uint32_t version;
+            uint64_t key;
+            uint32_t format;
+            uint32_t hasLabels;
+            uint64_t count;
+            uint32_t width;
+            uint32_t height;
+            // Elements per image row in the file
+            uint64_t stride;
+            uint64_t imageOffset;
+            uint64_t fileSize;
+        };
+
+        DatasetCache() = default;
+        ~DatasetCache();
+        DatasetCache(const DatasetCache&) = delete;
+        DatasetCache& operator=(const DatasetCache&) = delete;
+
+        /**
+         *  Maps the cache of dataset and config in directory, preprocessing
+         *  the whole dataset into it first if it is missing or invalid. The
+         *  file is written under a unique name next to its final one and
+         *  renamed over it, so an interrupted build is never picked up and
+         *  runs building the same cache at once do not mix their writes.
+         *  pool splits the build.
+         */
+        bool open(const Dataset &dataset, const Config &config, const std::string &directory, ThreadPool *pool = nullptr);
+        void close();
+        bool isOpen() const { return mapping != nullptr; }
+        // Whether the last open had to preprocess the dataset
+        bool rebuilt() const { return wasBuilt; }
+        const std::string& path() const { return filePath; }
+
+        static uint64_t key(const Dataset &dataset, const Config &config);
+        static std::string fileName(uint64_t key);
+
+        size_t size() const { return static_cast<size_t>(header.count); }
+        int width() const { return static_cast<int>(header.width); }
+        int height() const { return static_cast<int>(header.height); }
+        size_t imagePixels() const { return static_cast<size_t>(header.width) * header.height; }
+        Format format() const { return static_cast<Format>(header.format); }
+        bool hasLabels() const { return header.hasLabels != 0; }
+
+        // Every image straight from the map; empty unless the format is Float32
+        statpack::MatrixView<const float> images() const;
+        // count images starting from first as floats, one per row of out
+        bool getImages(size_t first, size_t count, statpack::MatrixView<float> out) const;
+        // Empty if the dataset has no labels
+        statpack::Span<const int32_t> labels() const;
+
+    private:
+        void *mapping = nullptr;
+        size_t mappedSize = 0;
+        Header header = {};
+        std::string filePath;
+        bool wasBuilt = false;
+
+        bool map(const std::string &path, uint64_t expectedKey);
+        static bool build(const Dataset &dataset, const Config &config, uint64_t key, const std::string &path, ThreadPool *pool);
+    };
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+
+#include "NeuralNet.h"
+
+/**
+ *  Generator and discriminator trained together.
+ *
+ *  fakeStep runs the generator and feeds its output straight into the
+ *  discriminator's input layer, then trains both nets from those same
+ *  activations. The generator's gradient is carried back through every
+ *  layer of the discriminator with NeuralNet::inputGradient instead of
+ *  through its first weight row only. The losses of the latest fake step are
+ *  kept, so reporting them needs no extra forward passes.
+ */
+class GAN {
+public:
+    NeuralNet generator;
+    NeuralNet discriminator;
+
+    // Add layers and choose functions for both nets first
+    void build();
+
+    // One generator sample from noise, its deltas scaled by 1 / batchSize
+    void fakeStep(const float *noise, const float batchSize);
+    // One real sample for the discriminator
+    void realStep(const float *sample, const float batchSize);
+    void applyDeltas();
+
+    /**
+     *  Discriminator outputs, scaled to its target range, for the generator
+     *  sample of every row of noise. Uses the const forward pass, so both
+     *  nets stay untouched and many threads may score at once with contexts
+     *  of their own. generatorContext is left holding the samples as the
+     *  discriminator saw them.
+     */
+    void score(const statpack::MatrixView<const float> &noise, const statpack::MatrixView<float> &scores, NeuralNet::Context &generatorContext, NeuralNet::Context &discriminatorContext) const;
+
+    // Losses of the latest fakeStep
+    float generatorLoss() const;
+    float discriminatorLoss() const;
+
+private:
+    // Discriminator output of the latest fakeStep, scaled to its target range
+    std::vector<float> fakeProbability;
+    std::vector<float> realProbability;
+    // d generator cost / d discriminator output weighted sums
+    std::vector<float> outputTerms;
+    // d generator cost / d generator outputs
+    std::vector<float> generatorGradient;
+};
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+
+#include "matrix.h"
+#include "ThreadPool.h"
+
+namespace statpack {
+    /**
+     *  Batch version of the statpack image templates. Every image of a
+     *  batch goes through, in order and each step optional:
+     *
+     *      crop          cropBlackBackground's bounding box
+     *      rescale       rescaleImage to widthOut x heightOut
+     *      downsample    rescaleMnistToHalf's 2x2 mean
+     *      standardize   zero mean, unit variance per image
+     *
+     *  Up to the downsample, pixels match calling the per-image templates
+     *  in that order bit for bit. standardize is a true z-score: it divides
+     *  by the standard deviation, where statpack::standardize divides by
+     *  the variance, and it leaves a flat image all zeros.
+     *
+     *  The resampling index tables are built once, for every crop size, by
+     *  the constructor, and rescale and downsample are one fused gather per
+     *  output pixel. run allocates nothing.
+     */
+    class ImagePipeline {
+    public:
+        struct Config {
+            int widthIn = 28;
+            int heightIn = 28;
+            bool crop = false;
+            // Same as the input size to skip the rescale
+            int widthOut = 28;
+            int heightOut = 28;
+            // Needs an even rescaled size
+            bool downsample = false;
+            bool standardize = false;
+            // Value of an empty pixel, which the crop trims and the rescale
+            // fills in. The per-image templates assume 0.
+            float background = 0.0f;
+        };
+
+        explicit ImagePipeline(const Config &config);
+
+        // Pixels of one output image
+        size_t outputSize() const;
+        int outputWidth() const;
+        int outputHeight() const;
+        const Config& config() const { return settings; }
+
+        /**
+         *  Row i of in is one widthIn x heightIn image and row i of out
+         *  receives it processed; out needs in.rows rows of outputSize().
+         *  Images are split across pool when one is given.
+         */
+        void run(const MatrixView<const float> &in, const MatrixView<float> &out, ThreadPool *pool = nullptr) const;
+
+    private:
+        Config settings;
+        // [w - 1] = resampleIndices(w, widthOut) for every width a crop
+        // can leave, likewise for the rows
+        std::vector<std::vector<int>> columnTables;
+        std::vector<std::vector<int>> rowTables;
+        // Ones to sum pixels with kernels::dot
+        AlignedVector<float> ones;
+
+        void process(const float *image, float *out) const;
+    };
+}
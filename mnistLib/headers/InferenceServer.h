@@ -0,0 +1,189 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+#include "NeuralNet.h"
+#include "matrix.h"
+
+/**
+ *  Serves NeuralNet::generate to many concurrent callers.
+ *
+ *  start() copies the net's weights into a read-only snapshot that every
+ *  worker shares, so the net itself may go on training. Each worker owns
+ *  the activation scratch of one micro-batch. Requests wait in one queue
+ *  until a worker takes up to maxBatch of them at once. The worker waits
+ *  at most maxDelayUs after the oldest queued request for the batch to
+ *  fill. The batch then goes through every layer as one matrix product,
+ *  exactly like NeuralNet::forwardBatch.
+ *
+ *  Requests come from generate() in process, or from clients of a local
+ *  Unix socket opened by listen(), see InferenceClient for its protocol.
+ */
+class InferenceServer {
+public:
+    struct Config {
+        size_t maxBatch = 64;
+        // How long the oldest request may wait for its batch to fill
+        uint32_t maxDelayUs = 200;
+        size_t workers = 1;
+        // Latencies of this many most recent requests make up the percentiles
+        size_t latencyWindow = 1 << 16;
+    };
+
+    struct Stats {
+        uint64_t requests = 0;
+        uint64_t batches = 0;
+        float meanBatch = 0;
+        // Enqueue to completion, over the latency window
+        float p50Us = 0;
+        float p99Us = 0;
+        float maxUs = 0;
+        // Requests per second since start() or resetStats()
+        float throughput = 0;
+    };
+
+    InferenceServer() = default;
+    ~InferenceServer();
+    InferenceServer(const InferenceServer&) = delete;
+    InferenceServer& operator=(const InferenceServer&) = delete;
+
+    /**
+     *  Snapshots net and starts the workers. Returns false if net has not
+     *  been built or the server is already running.
+     */
+    bool start(const NeuralNet &net, const Config &config);
+    // Default Config
+    bool start(const NeuralNet &net);
+    // Closes the socket, fails queued requests and joins every thread
+    void stop();
+    bool isRunning() const { return running; }
+
+    /**
+     *  Same contract as NeuralNet::generate, blocking until the request's
+     *  batch is done. Safe to call from any number of threads. Returns
+     *  false if the server is not running or the sizes do not match.
+     */
+    bool generate(statpack::Span<const float> inputs, statpack::Span<float> outputs);
+
+    /**
+     *  Accepts clients on a Unix stream socket at path, replacing any stale
+     *  socket file there, each client on its own thread. stop() removes it.
+     */
+    bool listen(const std::string &path);
+
+    size_t inputSize() const;
+    size_t outputSize() const;
+
+    Stats stats() const;
+    void resetStats();
+
+private:
+    // Weights transposed for gemmAccumulate, one row per input
+    struct Layer {
+        size_t sizeIn = 0;
+        size_t sizeOut = 0;
+        statpack::AlignedVector<float> weightsT;
+        std::vector<float> biases;
+
+        statpack::MatrixView<const float> weights() const;
+    };
+
+    // Lives on the caller's stack until done
+    struct Request {
+        const float *inputs;
+        float *outputs;
+        uint64_t enqueued;
+        bool done = false;
+        bool failed = false;
+    };
+
+    // Two ping-pong activation matrices of maxBatch rows
+    struct Scratch {
+        size_t stride = 0;
+        statpack::AlignedVector<float> buffers[2];
+    };
+
+    Config settings;
+    NeuralNet::Activation activation = NeuralNet::Activation::Sigmoid;
+    float activationMin = 0;
+    float activationMax = 1;
+    float targetMin = 0;
+    float targetMax = 1;
+    std::vector<Layer> layers;
+
+    std::atomic<bool> running{false};
+    std::vector<std::thread> workers;
+
+    // Guards queue and stopping. Workers notify done requests on finished.
+    std::mutex mutex;
+    std::condition_variable queued;
+    std::condition_variable finished;
+    std::deque<Request*> queue;
+    bool stopping = false;
+
+    // Guards the latency ring and counters
+    mutable std::mutex statsMutex;
+    std::vector<uint32_t> latencies;
+    size_t latencyNext = 0;
+    uint64_t requestCount = 0;
+    uint64_t batchCount = 0;
+    uint64_t statsEpoch = 0;
+
+    // One connection of the socket front end
+    struct Client {
+        int fd = -1;
+        bool finished = false;
+        std::thread thread;
+    };
+
+    int listenFd = -1;
+    std::string socketPath;
+    std::thread acceptor;
+    // Guards clients and their fd and finished. A client closes its own fd.
+    std::mutex clientsMutex;
+    std::vector<std::unique_ptr<Client>> clients;
+
+    void workerLoop();
+    // Runs rows samples from buffers[0] through every layer; returns the outputs
+    statpack::MatrixView<const float> forward(Scratch &scratch, size_t rows) const;
+    void record(const Request *const *batch, size_t rows, uint64_t now);
+    void acceptLoop();
+    void serveClient(Client *client);
+};
+
+/**
+ *  Blocking client of InferenceServer::listen. On connect the server
+ *  sends two uint32_t, its input and output size. After that every
+ *  request is inputSize floats and every reply outputSize floats, all
+ *  in native byte order, one request at a time per connection.
+ */
+class InferenceClient {
+public:
+    InferenceClient() = default;
+    ~InferenceClient();
+    InferenceClient(const InferenceClient&) = delete;
+    InferenceClient& operator=(const InferenceClient&) = delete;
+
+    bool connect(const std::string &path);
+    void close();
+    bool isConnected() const { return fd >= 0; }
+    size_t inputSize() const { return sizeIn; }
+    size_t outputSize() const { return sizeOut; }
+
+    // Sends one request and waits for its reply
+    bool generate(statpack::Span<const float> inputs, statpack::Span<float> outputs);
+
+private:
+    int fd = -1;
+    size_t sizeIn = 0;
+    size_t sizeOut = 0;
+};
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <initializer_list>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ *  Buffered binary metrics
+ *
+ *  Every series goes to its own file, which starts with
+ *      uint32_t magic, uint32_t version, uint32_t columnCount
+ *      columnCount x (uint32_t nameLength, name bytes)
+ *  and continues with blocks of up to blockRows records stored column by
+ *  column, in native byte order:
+ *      uint32_t rows, uint64_t steps[rows], float column0[rows], ...
+ *  Readers tell the byte order from how magic reads back.
+ *
+ *  record() only copies values into the current block of a small ring.
+ *  Full blocks are written by a background thread, so the training loop
+ *  does no formatting and no file I/O. tools/metrics.py reads the files.
+ */
+class MetricsSink {
+public:
+    static constexpr const uint32_t MAGIC = 0x544D4E4D; // "MNMT"
+    static constexpr const uint32_t VERSION = 1;
+
+    explicit MetricsSink(size_t blockRows = 1024, size_t ringBlocks = 4);
+    ~MetricsSink();
+    MetricsSink(const MetricsSink&) = delete;
+    MetricsSink& operator=(const MetricsSink&) = delete;
+
+    /**
+     *  Opens path for a series with the given columns. Only steps that are a
+     *  multiple of interval are kept. Returns the id to pass to record, or
+     *  SIZE_MAX if the file could not be created. record() ignores that id,
+     *  so a run without writable metrics files still goes on.
+     */
+    size_t addSeries(const std::string &path, const std::vector<std::string> &columns, size_t interval = 1);
+
+    // Returns true if the step was sampled. values must hold one value per column.
+    // Unknown ids, like the SIZE_MAX of a failed addSeries, record nothing.
+    bool record(size_t series, uint64_t step, const float *values);
+    bool record(size_t series, uint64_t step, std::initializer_list<float> values) {
+        return record(series, step, values.begin());
+    }
+    // Hands every partial block to the writer and waits until all are on disk
+    void flush();
+
+private:
+    struct Block {
+        size_t rows = 0;
+        std::vector<uint64_t> steps;
+        // Column major, columnCount x blockRows
+        std::vector<float> values;
+        // Set while the writer owns the block
+        bool queued = false;
+    };
+
+    struct Series {
+        std::ofstream stream;
+        size_t columnCount = 0;
+        size_t interval = 1;
+        std::vector<Block> ring;
+        size_t current = 0;
+    };
+
+    size_t blockRows;
+    size_t ringBlocks;
+    std::vector<std::unique_ptr<Series>> series;
+
+    std::thread writer;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable written;
+    // Blocks waiting for the writer, oldest at queueHead. Every block can be
+    // queued at most once, so addSeries sizes this for all of them up front.
+    std::vector<std::pair<Series*, Block*>> queue;
+    size_t queueHead = 0;
+    size_t queueCount = 0;
+    bool stopping = false;
+
+    // Queues the current block of s and moves on to the next free one
+    void submit(Series &s);
+    void writerLoop();
+};
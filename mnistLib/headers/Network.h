@@ -0,0 +1,131 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cmath>
+#include <limits>
+#include <cassert>
+#include <cstddef>
+
+#include "matrix.h"
+#include "templates.h"
+
+/**
+ *  Interface shared by the runtime sized NeuralNet and the compile-time
+ *  sized StaticNeuralNet, together with the scaling settings and cost
+ *  functions both of them use. Code that only trains or samples a network
+ *  can take a Network& and work with either.
+ */
+class Network {
+public:
+    float learnRate = 0.01f;
+    float inputMin = 0.0f;
+    float inputMax = 1.0f;
+    float targetMin = 0.0f;
+    float targetMax = 1.0f;
+    float activationMin = 0.0f;
+    float activationMax = 1.0f;
+
+    // Chosen once by setActivationFunction/setCostFunction. Layers dispatch
+    // on these outside their loops and run whole-array kernels.
+    enum class Activation {
+        Sigmoid,
+        Relu
+    };
+    enum class Cost {
+        Mse,
+        LogDz,
+        LogGdz
+    };
+    Cost cost = Cost::Mse;
+
+    virtual ~Network() = default;
+
+    virtual size_t inputSize() const = 0;
+    virtual size_t outputSize() const = 0;
+    // One sample forward and backward, deltas scaled by 1 / epoch. Returns the cost.
+    virtual float train(statpack::Span<const float> inputs, statpack::Span<const float> target, const float epoch = 1.f, const bool realData = true) = 0;
+    // Outputs scaled from the activation range to [targetMin, targetMax]
+    virtual void generate(statpack::Span<const float> inputs, statpack::Span<float> outputs) = 0;
+    virtual void applyDeltas() = 0;
+
+    void setCostFunction(std::string name);
+    // Name accepted by setCostFunction for the current choice
+    const char* costFunctionName() const;
+    float costFunction(const std::vector<float> &predicted, const std::vector<float> &observed = {}, const bool realData = true) const;
+    float costFunction(statpack::Span<const float> predicted, statpack::Span<const float> observed, const bool realData = true) const;
+
+protected:
+    struct CostFunctions {
+        /**
+         *  The derivatives here are for a _single index_
+         *  and _not_ over a whole set of points (since that is what we need)
+         *  
+         *  Usage of [[maybe_unused]] is to be able to use single function
+         *  pointer for every cost function easily.
+         */
+        static float mse(statpack::Span<const float> predicted, statpack::Span<const float> observed = {}, [[maybe_unused]] const bool realData = true) {
+            #ifdef CUSTOM_DEBUG
+                assert(!(observed.size() != predicted.size()) && "Vector sizes are not equal.");
+            #endif
+            float out = 0;
+            for (size_t i = 0; i < observed.size(); ++i) {
+                out += std::pow(observed[i] - predicted[i], 2.f);
+            }
+            // TODO: Will precision here ever be an issue?
+            return out / static_cast<float>(predicted.size());
+        }
+
+        static float dMse(float predicted, float observed, [[maybe_unused]] const bool realData = true) {
+            return 2 * (observed - predicted);
+        }
+
+        static float logDz(statpack::Span<const float> predicted, [[maybe_unused]] statpack::Span<const float> observed = {},  const bool realData = true) {
+            float out = 0;
+            if (realData) {
+                for (size_t i = 0; i < predicted.size(); ++i) {
+                    out += (predicted[i] <= 0 ? -templates::logn(std::numeric_limits<float>::min()) : -std::log(predicted[i]));
+                }
+            } else {
+                for (size_t i = 0; i < predicted.size(); ++i) {
+                    out += (predicted[i] >= 1 ? -templates::logn(1 - std::numeric_limits<float>::min()) : -std::log(1 - predicted[i]));
+                }
+            }
+            // TODO: Will precision here ever be an issue?
+            return out / static_cast<float>(predicted.size());
+        }
+
+        static float dLogDz(float predicted, [[maybe_unused]] float observed = 0, const bool realData = true) {
+            if (realData) {
+                if (predicted <= .0001) {
+                    return -9999;
+                }
+                return -1 / predicted;
+            } else {
+                if (predicted >= .9999) {
+                    return 9999;
+                }
+                return 1 / (1 - predicted);
+            }
+        }
+
+        static float logGdz(statpack::Span<const float> predicted, [[maybe_unused]] statpack::Span<const float> observed = {}, [[maybe_unused]] const bool realData = true) {
+            float out = 0;
+            for (size_t i = 0; i < predicted.size(); ++i) {
+                out += (predicted[i] <= 0 ? -std::log(std::numeric_limits<float>::min()) : -std::log(predicted[i]));
+            }
+            // TODO: Will precision here ever be an issue?
+            return out / static_cast<float>(predicted.size());
+        }
+
+        static float dLogGdz(float predicted, [[maybe_unused]] float observed = 0, [[maybe_unused]] const bool realData = true) {
+            return predicted - 1;
+        }
+    };
+
+    /**
+     *  terms[k] *= dCost(predicted[k * predictedStride], observed[k]).
+     *  A predictedStride of 0 uses predicted[0] for every k.
+     */
+    void applyDCost(const float *predicted, size_t predictedStride, const float *observed, float *terms, size_t size, const bool realData) const;
+};
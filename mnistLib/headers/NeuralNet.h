@@ -2,24 +2,24 @@
 
 #include <vector>
 #include <cstddef>
-#include <functional>
 #include <cassert>
 #include <iostream>
+#include <fstream>
+#include <memory>
+#include <cstdint>
 
 #include "statpack.h"
 #include "mnistParser.h"
 #include "templates.h"
+#include "ThreadPool.h"
+#include "Network.h"
 
-class NeuralNet {
+namespace mnistParser {
+    class SampleSource;
+}
+
+class NeuralNet : public Network {
 public:
-    float learnRate;
-    float inputMin;
-    float inputMax;
-    float targetMin;
-    float targetMax;
-    float activationMin;
-    float activationMax;
-    
     // Generator part of GAN needs knowledge of the first layer of the
     // GAN's discriminator. Set this to point to the discriminator of
     // the GAN in the generator.
@@ -27,11 +27,21 @@ public:
 
     std::ofstream outLossStream;
 
-    std::function<float(const std::vector<float>&, const std::vector<float>&, bool)> costFunctionPointer;
-    std::function<float(float, float, bool)> dCostFunctionPointer;
+    Activation activation;
 
-    std::function<float(float)> activationFunction;
-    std::function<float(float)> dActivationFunction;
+    // Update rule of applyDeltas, see setOptimizer
+    enum class Optimizer {
+        Sgd,
+        Momentum,
+        RmsProp,
+        Adam
+    };
+    Optimizer optimizer = Optimizer::Sgd;
+    float momentum = 0.9f;
+    float rmsDecay = 0.9f;
+    float beta1 = 0.9f;
+    float beta2 = 0.999f;
+    float epsilon = 1e-8f;
 
     std::vector<float> targetVector;
 
@@ -40,119 +50,216 @@ public:
         size_t sizeOut;
         std::vector<float> nodes;
         std::vector<float> delta_nodes;
-        std::vector<std::vector<float>> weights;
-        std::vector<std::vector<float>> delta_weights;
-        std::vector<float> biases;
-        std::vector<float> delta_biases;
+        /**
+         *  Weights, biases and their deltas live in one aligned allocation:
+         *  [ weights | biases | delta_weights | delta_biases | state... ]
+         *  Weight rows are padded to statpack::alignedStride so every row
+         *  starts on a cache line. The members below are views into it.
+         *  The optimizer's moment buffers follow as stateSlots more blocks
+         *  of paramCount floats each.
+         */
+        statpack::AlignedVector<float> params;
+        statpack::MatrixView<float> weights;
+        statpack::MatrixView<float> delta_weights;
+        statpack::Span<float> biases;
+        statpack::Span<float> delta_biases;
         std::vector<float> wSum;
+        // dActivation(wSum) * incoming delta of the last backPropagate
+        std::vector<float> bpTerms;
+        /**
+         *  Per-sample state of forwardBatch/backwardBatch, one row per sample.
+         *  All three matrices share batchBuffer and are sized by reserveBatch.
+         */
+        size_t batchRows = 0;
+        statpack::AlignedVector<float> batchBuffer;
+        statpack::MatrixView<float> batchNodes;
+        statpack::MatrixView<float> batchWSum;
+        statpack::MatrixView<float> batchDeltaNodes;
 
-        Layer(size_t size) : sizeIn(size) { 
+        Layer(size_t size) : sizeIn(size), sizeOut(0) { 
             nodes.resize(size);
         };
+        Layer(const Layer &other);
+        Layer(Layer &&other) = default;
+        Layer& operator=(const Layer &other);
+        Layer& operator=(Layer &&other) = default;
+
+        void allocate(size_t outputs, size_t stateSlots = 0);
+        // Resizes and zeroes the optimizer state, keeping parameters and deltas
+        void reserveState(size_t stateSlots);
+        void reserveBatch(size_t rows);
+        // Number of floats in the weight+bias block of params
+        size_t paramCount() const;
+        size_t stateSlots() const;
+        // Start of optimizer state block slot
+        float* state(size_t slot);
+
+    private:
+        void bindViews();
     };
     
     std::vector<Layer> layers;
 
+    /**
+     *  Activations of one evaluation, kept apart from the parameters in
+     *  layers so that one const net can be evaluated by many threads at
+     *  once, each with a Context of its own. forward() sizes it on first
+     *  use and whenever the row count changes. A Context only fits nets of
+     *  the layer sizes it was last used with.
+     */
+    struct Context {
+        size_t batchRows = 0;
+        statpack::AlignedVector<float> buffer;
+        // Per layer, one row per sample. Layer 0's entries stay empty.
+        std::vector<statpack::MatrixView<float>> nodes;
+        std::vector<statpack::MatrixView<float>> wSum;
+
+        void reserve(const NeuralNet &net, size_t rows);
+        // Last layer activations of the last forward, in [activationMin, activationMax]
+        statpack::MatrixView<const float> outputs() const;
+    };
+
     NeuralNet();
     void addLayer(size_t size);
     void build();
     void randomizeWeightsAndBiases(unsigned int seed = 0);
+    /**
+     *  "xavier", "xavier-normal", "he" or "he-normal" weights, see
+     *  statpack::xavierUniform, and zero biases. Xavier suits sigmoid, He
+     *  relu. Unknown names are ignored.
+     */
+    void initializeWeights(std::string scheme, unsigned int seed = 0);
     float train(const std::vector<float> &inputs, const std::vector<float> &target, const float epoch = 1.f, const bool realData = true);
     // TODO: add batch standardization
     std::vector<float> generate(const std::vector<float> &inputs);
+    /**
+     *  Same as above without touching the heap: inputs, targets and outputs
+     *  live in caller-owned memory and all scratch comes from the workspace
+     *  sized by build(), so a steady training loop allocates nothing.
+     */
+    float train(statpack::Span<const float> inputs, statpack::Span<const float> target, const float epoch = 1.f, const bool realData = true) override;
+    void generate(statpack::Span<const float> inputs, statpack::Span<float> outputs) override;
+    /**
+     *  Evaluation that leaves the net untouched: every row of inputs goes
+     *  through the layers into context, and the last layer's activations
+     *  are read from context.outputs(). Matches generate() bit for bit.
+     *  Any number of threads may call these on one net at the same time,
+     *  as long as each passes its own context and nothing trains the net
+     *  meanwhile. They run on the calling thread, not the net's pool.
+     */
+    void forward(Context &context, const statpack::MatrixView<const float> &inputs) const;
+    void generate(Context &context, statpack::Span<const float> inputs, statpack::Span<float> outputs) const;
     void forwardPropagate(const std::vector<float> &inputs);
     void backPropagate(const std::vector<float>& target, const float batchSize = 1.f, const bool realData = true);
-    void applyDeltas();
-    void setCostFunction(std::string name);
+    /**
+     *  Chaining two networks, e.g. a generator into a discriminator.
+     *  inputGradient carries outputTerms (d cost / d weighted sums of the
+     *  last layer) back to the inputs of the last forwardPropagate without
+     *  accumulating any deltas. backPropagateGradient then treats such a
+     *  gradient as the delta_nodes of this net's last layer and accumulates
+     *  deltas like backPropagate. Both scale by the layer width the same
+     *  way backPropagate fills delta_nodes.
+     */
+    void inputGradient(const float *outputTerms, float *gradient);
+    void backPropagateGradient(const float *outputGradient, const float batchSize = 1.f);
+    void applyDeltas() override;
+    size_t inputSize() const override;
+    size_t outputSize() const override;
+    /**
+     *  Mini-batch versions of forwardPropagate and backPropagate. Each row
+     *  of inputs/targets is one sample and every layer is evaluated as one
+     *  blocked matrix product. Outputs are left in layers.back().batchNodes.
+     *  backwardBatch accumulates the same deltas, up to rounding, as calling
+     *  backPropagate once per row with batchSize, which defaults to the
+     *  number of rows. The batch matrix products sum in a different order
+     *  than the per-sample dot products, so do not expect equal bits.
+     */
+    void forwardBatch(const statpack::MatrixView<const float> &inputs);
+    void backwardBatch(const statpack::MatrixView<const float> &targets, const bool realData = true, const float batchSize = 0);
+    /**
+     *  Trains on mini-batches of batchSize samples from source until it
+     *  ends or maxSamples samples were used (0 = no limit), one applyDeltas
+     *  per batch. The next batch is read on a background thread while the
+     *  current one trains, so memory stays at two batches however long the
+     *  stream is. Targets are mapped from [targetMin, targetMax] onto the
+     *  activation range, as train() does. A short last batch is trained
+     *  too. Returns the number of samples trained on; source.failed() tells
+     *  a malformed stream apart from one that ended.
+     */
+    uint64_t trainStream(mnistParser::SampleSource &source, size_t batchSize, uint64_t maxSamples = 0, const bool realData = true);
     void setActivationFunction(std::string name);
+    // Name accepted by setActivationFunction for the current choice
+    const char* activationFunctionName() const;
+    /**
+     *  nodes = f(wSum) over size values. Every path that evaluates a
+     *  layer, InferenceServer's included, goes through this one switch.
+     */
+    static void activate(Activation function, const float *wSum, float *nodes, size_t size);
+    /**
+     *  "sgd", "momentum", "rmsprop" or "adam". Allocates the moment buffers
+     *  next to each layer's parameters if the net is built, otherwise
+     *  build() does, and restarts the optimizer from zeroed state.
+     *  Unknown names are ignored.
+     */
+    void setOptimizer(std::string name);
+    const char* optimizerName() const;
+    // Moment buffers the optimizer keeps per parameter, see Layer::state
+    size_t optimizerSlots() const;
+    // applyDeltas calls since the optimizer was last reset; a checkpoint restores it
+    size_t optimizerStep() const { return optimizerSteps; }
+    void setOptimizerStep(size_t steps) { optimizerSteps = steps; }
+    /**
+     *  Splits the neuron loops of forwardPropagate/backPropagate and the
+     *  batch matrix products across threads. setThreadCount creates a pool
+     *  owned by this net (1 = run inline), setThreadPool shares an external
+     *  one that must outlive the net. Results do not depend on the thread
+     *  count: every element is still accumulated in the same order.
+     */
+    void setThreadCount(size_t threads);
+    void setThreadPool(ThreadPool *threadPool);
 
 private:
-    struct CostFunctions {
-        /**
-         *  The derivatives here are for a _single index_
-         *  and _not_ over a whole set of points (since that is what we need)
-         *  
-         *  Usage of [[maybe_unused]] is to be able to use single function
-         *  pointer for every cost function easily.
-         */
-        static float mse(const std::vector<float> &predicted, const std::vector<float> &observed = {}, [[maybe_unused]] const bool realData = true) {
-            #ifdef CUSTOM_DEBUG
-                assert(!(observed.size() != predicted.size()) && "Vector sizes are not equal.");
-            #endif
-            float out = 0;
-            for (size_t i = 0; i < observed.size(); ++i) {
-                out += std::pow(observed[i] - predicted[i], 2.f);
-            }
-            // TODO: Will precision here ever be an issue?
-            return out / static_cast<float>(predicted.size());
-        }
+    // Drives both nets of a GAN through the protected cost derivatives
+    friend class GAN;
 
-        static float dMse(float predicted, float observed, [[maybe_unused]] const bool realData = true) {
-            return 2 * (observed - predicted);
-        }
+    std::unique_ptr<ThreadPool> ownedPool;
+    ThreadPool *pool = nullptr;
 
-        static float logDz(const std::vector<float> &predicted, [[maybe_unused]] const std::vector<float> &observed = {},  const bool realData = true) {
-            float out = 0;
-            if (realData) {
-                for (size_t i = 0; i < predicted.size(); ++i) {
-                    out += (predicted[i] <= 0 ? -templates::logn(std::numeric_limits<float>::min()) : -std::log(predicted[i]));
-                }
-            } else {
-                for (size_t i = 0; i < predicted.size(); ++i) {
-                    out += (predicted[i] >= 1 ? -templates::logn(1 - std::numeric_limits<float>::min()) : -std::log(1 - predicted[i]));
-                }
-            }
-            // TODO: Will precision here ever be an issue?
-            return out / static_cast<float>(predicted.size());
+    template <typename F>
+    void parallelFor(size_t count, F &&fn, size_t grain = 1) {
+        if (pool) {
+            pool->parallelFor(count, fn, grain);
+        } else {
+            fn(size_t(0), count);
         }
+    }
 
-        static float dLogDz(float predicted, [[maybe_unused]] float observed = 0, const bool realData = true) {
-            if (realData) {
-                if (predicted <= .0001) {
-                    return -9999;
-                }
-                return -1 / predicted;
-            } else {
-                if (predicted >= .9999) {
-                    return 9999;
-                }
-                return 1 / (1 - predicted);
-            }
-        }
+    // statpack::gemmAccumulate split by rows of C over the pool
+    void gemmAccumulate(const statpack::MatrixView<float> &C, const statpack::MatrixView<const float> &A, const statpack::MatrixView<const float> &B);
 
-        static float logGdz(const std::vector<float> &predicted, [[maybe_unused]] const std::vector<float> &observed = {}, [[maybe_unused]] const bool realData = true) {
-            float out = 0;
-            for (size_t i = 0; i < predicted.size(); ++i) {
-                out += (predicted[i] <= 0 ? -std::log(std::numeric_limits<float>::min()) : -std::log(predicted[i]));
-            }
-            // TODO: Will precision here ever be an issue?
-            return out / static_cast<float>(predicted.size());
-        }
+    // Backpropagates the delta_nodes of every hidden layer
+    void backPropagateHidden(const float batchSize);
 
-        static float dLogGdz(float predicted, [[maybe_unused]] float observed = 0, [[maybe_unused]] const bool realData = true) {
-            return predicted - 1;
-        }
-    };
+    // Adds one sample's bpTerms of layers[i] into the deltas of layers[i - 1]
+    void accumulateDeltas(size_t i, const float *terms, const float batchSize);
 
-    struct ActivationFunctions {
-        static float sigmoid(float x) {
-            return 1.0f / (1.0f + std::exp(-x));
-        }
-
-        static float dSigmoid(float x) {
-            const float s = sigmoid(x);
-            return s * (1.0f - s);
-        }
+    /**
+     *  Scratch for inputGradient and for the transposed weights and scaled
+     *  bpTerms of the batch path. build() reserves the per-sample needs and
+     *  forwardBatch grows it when the batch size changes, never in between.
+     */
+    statpack::Workspace workspace;
+    void reserveWorkspace(size_t batchRows);
+    // Resets the workspace and takes one matrix from it
+    statpack::MatrixView<float> workspaceMatrix(size_t rows, size_t cols);
 
-        static float relu(float x) {
-            return std::max(0.0f, x);
-        }
+    // applyDeltas calls so far, for Adam's bias correction
+    size_t optimizerSteps = 0;
 
-        static float dRelu(float x) {
-            return x > 0 ? 1 : 0;
-        }
-    };
+    // Work of one sample through layers[i]'s weights, for the profiler
+    uint64_t forwardFlops(size_t i) const;
+    uint64_t forwardBytes(size_t i) const;
 
-    float costFunction(const std::vector<float> &predicted, const std::vector<float> &observed = {}, const bool realData = true);
-    float dCostFunction(float predicted,  float observed = 0., const bool realData = true);
+    void activate(const float *wSum, float *nodes, size_t size) const;
+    void dActivate(const float *wSum, float *out, size_t size) const;
 };
\ No newline at end of file
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <string>
+#include <ostream>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ *  Scoped timers and work counters for the hot paths
+ *
+ *  Configure with -DMNIST_PROFILE=ON to enable them. Otherwise every macro
+ *  below expands to nothing and the dump functions are empty inlines, so
+ *  instrumented code costs nothing and callers need no #ifdefs.
+ *
+ *      MNIST_PROFILE_SCOPE(name)           times the enclosing scope
+ *      MNIST_PROFILE_LAYER(name, layer)    same, kept apart per layer index
+ *      MNIST_PROFILE_WORK(name, layer, flops, bytes, samples)
+ *                                          adds work to a zone's counters
+ *
+ *  name must be a string literal; a zone is identified by name and layer.
+ *  Each thread records into its own log, so enabled zones take two clock
+ *  reads and no locks. Call writeSummary, writeChromeTrace and reset while
+ *  no other thread is inside a zone.
+ */
+namespace profiler {
+    // Trace events kept per thread; zones past the limit only count
+    inline constexpr const size_t DEFAULT_EVENT_LIMIT = size_t(1) << 20;
+
+#ifdef MNIST_PROFILE
+    // Id of the zone called name, registered on first use
+    size_t zone(const char *name);
+
+    class Scope {
+    public:
+        Scope(size_t zone, size_t layer = 0);
+        ~Scope();
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        size_t zoneId;
+        size_t layer;
+        int64_t start;
+    };
+
+    void addWork(size_t zone, size_t layer, uint64_t flops, uint64_t bytes, uint64_t samples);
+
+    /**
+     *  Per zone and layer: calls, total/min/max time, ns per sample and,
+     *  where work was recorded, GFLOP/s and GB/s.
+     */
+    void writeSummary(std::ostream &out);
+    // Chrome trace event JSON, viewable in chrome://tracing or Perfetto
+    bool writeChromeTrace(const std::string &path);
+    void setEventLimit(size_t eventsPerThread);
+    void reset();
+#else
+    inline void writeSummary(std::ostream&) {}
+    inline bool writeChromeTrace(const std::string&) { return true; }
+    inline void setEventLimit(size_t) {}
+    inline void reset() {}
+#endif
+}
+
+#ifdef MNIST_PROFILE
+    #define MNIST_PROFILE_CONCAT_(a, b) a##b
+    #define MNIST_PROFILE_CONCAT(a, b) MNIST_PROFILE_CONCAT_(a, b)
+    #define MNIST_PROFILE_LAYER(name, layer) \
+        static const size_t MNIST_PROFILE_CONCAT(profileZone_, __LINE__) = profiler::zone(name); \
+        const profiler::Scope MNIST_PROFILE_CONCAT(profileScope_, __LINE__)(MNIST_PROFILE_CONCAT(profileZone_, __LINE__), (layer))
+    #define MNIST_PROFILE_SCOPE(name) MNIST_PROFILE_LAYER(name, 0)
+    #define MNIST_PROFILE_WORK(name, layer, flops, bytes, samples) \
+        do { \
+            static const size_t profileZone = profiler::zone(name); \
+            profiler::addWork(profileZone, (layer), (flops), (bytes), (samples)); \
+        } while (false)
+#else
+    #define MNIST_PROFILE_LAYER(name, layer)
+    #define MNIST_PROFILE_SCOPE(name)
+    #define MNIST_PROFILE_WORK(name, layer, flops, bytes, samples) do {} while (false)
+#endif
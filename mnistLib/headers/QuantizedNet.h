@@ -0,0 +1,88 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include "NeuralNet.h"
+#include "matrix.h"
+
+/**
+ *  Inference-only copy of a trained NeuralNet with reduced precision weights
+ *
+ *  Int8       every weight row gets its own scale, max |w| / 127. Layer
+ *             inputs are quantized the same way per sample, so the dot
+ *             products run on int8 pairs with 32-bit integer sums.
+ *  BFloat16   weights keep the upper half of their float bits, rounded to
+ *             nearest even. Inputs and sums stay float.
+ *
+ *  Biases, activations and outputs stay float. Weights take a quarter
+ *  (Int8) or half (BFloat16) of the NeuralNet's memory and no delta
+ *  buffers are kept.
+ */
+class QuantizedNet {
+public:
+    enum class Precision {
+        Int8,
+        BFloat16
+    };
+
+    // Differences between the float net and this one over a set of inputs
+    struct Drift {
+        size_t samples = 0;
+        float maxAbs = 0;
+        float meanAbs = 0;
+        float rms = 0;
+    };
+
+    /**
+     *  Converts the current parameters of net. Returns false if net has not
+     *  been built. Later training of net does not affect this copy.
+     */
+    bool quantize(const NeuralNet &net, Precision precision);
+
+    // Same contract as NeuralNet::generate
+    void generate(statpack::Span<const float> inputs, statpack::Span<float> outputs);
+
+    /**
+     *  Runs every row of inputs through reference and this net and compares
+     *  the outputs element by element.
+     */
+    Drift drift(const NeuralNet &reference, statpack::MatrixView<const float> inputs);
+
+    Precision precision() const { return mode; }
+    size_t inputSize() const;
+    size_t outputSize() const;
+    // Bytes of weights and biases held
+    size_t parameterBytes() const;
+    // Bytes the same parameters take as floats in a NeuralNet
+    size_t floatParameterBytes() const;
+
+private:
+    struct Layer {
+        size_t sizeIn = 0;
+        size_t sizeOut = 0;
+        // Elements per weight row, padded to a cache line
+        size_t stride = 0;
+        statpack::AlignedVector<int8_t> weightsI8;
+        statpack::AlignedVector<uint16_t> weightsBf16;
+        // Per row dequantization scale of weightsI8
+        std::vector<float> scales;
+        std::vector<float> biases;
+    };
+
+    Precision mode = Precision::Int8;
+    NeuralNet::Activation activation = NeuralNet::Activation::Sigmoid;
+    float activationMin = 0;
+    float activationMax = 1;
+    float targetMin = 0;
+    float targetMax = 1;
+    std::vector<Layer> layers;
+
+    // Activations of the layer being evaluated and the one before it
+    statpack::AlignedVector<float> nodes;
+    statpack::AlignedVector<float> nextNodes;
+    statpack::AlignedVector<int8_t> quantizedNodes;
+
+    void forward(const Layer &layer);
+};
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "matrix.h"
+#include "kernels.h"
+
+namespace statpack {
+    /**
+     *  xoshiro128++ in kernels::RANDOM_LANES interleaved lanes, so whole
+     *  blocks of numbers come out of one vectorized kernel call.
+     *
+     *  A (seed, stream) pair fully determines the sequence, on every
+     *  instruction set. Different streams of one seed are independent, so
+     *  give each thread its own Rng with the thread's index as stream
+     *  instead of sharing one. An Rng itself is not thread-safe.
+     *
+     *  Single draws come from a buffered block. The fills generate straight
+     *  into the output and only round their tail up to a whole block, so
+     *  mixing the two still gives a reproducible, if different, sequence.
+     */
+    class Rng {
+    public:
+        using result_type = uint32_t;
+        static constexpr const size_t LANES = kernels::RANDOM_LANES;
+
+        explicit Rng(uint64_t seed = 0, uint64_t stream = 0);
+        void seed(uint64_t seed, uint64_t stream = 0);
+
+        // UniformRandomBitGenerator, for the std distributions
+        static constexpr result_type min() { return 0; }
+        static constexpr result_type max() { return UINT32_MAX; }
+        result_type operator()() {
+            if (nextBits == LANES) {
+                kernels::randomBits(state, bits, 1);
+                nextBits = 0;
+            }
+            return bits[nextBits++];
+        }
+
+        // [0, 1) from the top 24 bits of a word
+        float uniform() {
+            return static_cast<float>((*this)() >> 8) * 5.9604644775390625e-08f;
+        }
+        float uniform(float min, float max) {
+            return min + (max - min) * uniform();
+        }
+        // [min, max] without modulo bias
+        int32_t uniformInt(int32_t min, int32_t max);
+        // [min, max) with 53 random bits
+        double uniformDouble(double min, double max);
+        float normal(float mean = 0.0f, float stddev = 1.0f);
+
+        void fillUniform(Span<float> out, float min, float max);
+        void fillNormal(Span<float> out, float mean, float stddev);
+        // Every row of out, leaving the padding past cols alone
+        void fillUniform(const MatrixView<float> &out, float min, float max);
+        void fillNormal(const MatrixView<float> &out, float mean, float stddev);
+
+    private:
+        alignas(BUFFER_ALIGNMENT) uint32_t state[4 * LANES];
+        uint32_t bits[LANES];
+        size_t nextBits = LANES;
+        float normals[2 * LANES];
+        size_t nextNormal = 2 * LANES;
+    };
+
+    /**
+     *  Weight initializers for a layer whose weights have one row per output
+     *  and one column per input, like NeuralNet's. Xavier (Glorot) keeps the
+     *  variance of sigmoid and tanh layers, He that of ReLU layers:
+     *      xavierUniform  U(-a, a), a = sqrt(6 / (inputs + outputs))
+     *      xavierNormal   N(0, 2 / (inputs + outputs))
+     *      heUniform      U(-a, a), a = sqrt(6 / inputs)
+     *      heNormal       N(0, 2 / inputs)
+     */
+    void xavierUniform(Rng &rng, const MatrixView<float> &weights);
+    void xavierNormal(Rng &rng, const MatrixView<float> &weights);
+    void heUniform(Rng &rng, const MatrixView<float> &weights);
+    void heNormal(Rng &rng, const MatrixView<float> &weights);
+}
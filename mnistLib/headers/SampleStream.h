@@ -0,0 +1,231 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include "matrix.h"
+#include "mnistParser.h"
+
+namespace mnistParser {
+    /**
+     *  Buffered sequential reads from a file or a pipe, with one fixed
+     *  buffer however long the stream is. The path "-" reads stdin.
+     *  Consumed parts of a regular file are dropped from the page cache as
+     *  the reader moves on, so a pass over a file larger than RAM does not
+     *  push everything else out of memory.
+     */
+    class StreamReader {
+    public:
+        inline static constexpr const size_t BUFFER_SIZE = 1 << 20;
+
+        StreamReader() = default;
+        ~StreamReader();
+        StreamReader(const StreamReader&) = delete;
+        StreamReader& operator=(const StreamReader&) = delete;
+
+        bool open(const std::string &path);
+        void close();
+        bool isOpen() const { return fd >= 0; }
+        const std::string& path() const { return streamPath; }
+
+        // Whether the stream is a regular file, whose size is then known up front
+        bool isFile() const { return regular; }
+        uint64_t fileSize() const { return size; }
+        // Bytes handed out by read so far
+        uint64_t position() const { return consumed; }
+
+        // Reads up to bytes bytes; fewer only at the end of the stream or on an I/O error
+        size_t read(void *out, size_t bytes);
+        bool failed() const { return error; }
+
+    private:
+        int fd = -1;
+        bool ownsFd = false;
+        bool regular = false;
+        bool eof = false;
+        bool error = false;
+        uint64_t size = 0;
+        uint64_t consumed = 0;
+        uint64_t dropped = 0;
+        std::string streamPath;
+        std::unique_ptr<uint8_t[]> buffer;
+        size_t head = 0;
+        size_t tail = 0;
+
+        // Reads once from fd into out, retrying on EINTR; 0 at the end of the stream
+        size_t fetch(void *out, size_t bytes);
+        void dropConsumed();
+    };
+
+    /**
+     *  A sequence of (input, target) samples read in order, possibly
+     *  without end and possibly larger than memory. Sizes come from the
+     *  stream's own header and are checked against what the stream holds.
+     */
+    class SampleSource {
+    public:
+        virtual ~SampleSource() = default;
+
+        virtual size_t inputSize() const = 0;
+        // 0 if the samples carry no targets
+        virtual size_t targetSize() const = 0;
+
+        /**
+         *  Reads up to inputs.rows samples into consecutive rows of inputs
+         *  and targets. Returns the number of samples read, which is only
+         *  short at the end of the stream or when it turns out malformed.
+         */
+        virtual size_t read(const statpack::MatrixView<float> &inputs, const statpack::MatrixView<float> &targets) = 0;
+
+        // Set once the stream is found malformed or truncated
+        bool failed() const { return error; }
+        // Samples read so far
+        uint64_t position() const { return samplesRead; }
+
+    protected:
+        bool error = false;
+        uint64_t samplesRead = 0;
+    };
+
+    /**
+     *  An IDX image file and an optional IDX label file read front to back
+     *  instead of being mapped, so either may be a pipe. Pixels are mapped
+     *  onto [normMin, normMax]. Labels become one-hot targets of classes
+     *  values, targetMax at the label and targetMin elsewhere.
+     */
+    class IdxStream : public SampleSource {
+    public:
+        struct Config {
+            float normMin = 0.0f;
+            float normMax = 1.0f;
+            size_t classes = 10;
+            float targetMin = 0.0f;
+            float targetMax = 1.0f;
+        };
+
+        bool open(const std::string &imagePath, const std::string &labelPath, const Config &config);
+        // Default Config
+        bool open(const std::string &imagePath, const std::string &labelPath = "");
+        void close();
+        bool isOpen() const { return images.isOpen(); }
+        bool hasLabels() const { return labels.isOpen(); }
+
+        // Number of images the header declares
+        int32_t count() const { return declared; }
+        int32_t rows() const { return imageRows; }
+        int32_t cols() const { return imageCols; }
+
+        size_t inputSize() const override { return pixels; }
+        size_t targetSize() const override { return (hasLabels() ? settings.classes : 0); }
+        size_t read(const statpack::MatrixView<float> &inputs, const statpack::MatrixView<float> &targets) override;
+
+    private:
+        StreamReader images;
+        StreamReader labels;
+        Config settings;
+        int32_t declared = 0;
+        int32_t imageRows = 0;
+        int32_t imageCols = 0;
+        size_t pixels = 0;
+        std::vector<uint8_t> rowBytes;
+
+        // Reads and checks the IDX header of reader; dims receives its dimensions
+        bool readHeader(StreamReader &reader, int32_t expectedMagic, int32_t *dims, size_t dimCount);
+    };
+
+    /**
+     *  Float samples as one header and then records of inputSize input
+     *  floats followed by targetSize target floats, all in native byte
+     *  order with no padding:
+     *      uint32_t magic      MAGIC
+     *      uint32_t version    VERSION
+     *      uint32_t inputSize
+     *      uint32_t targetSize
+     *      uint64_t count      records that follow, 0 if unknown
+     *  A count of 0 reads until the stream ends, which suits a producer
+     *  piping samples in as it makes them.
+     */
+    class FloatStream : public SampleSource {
+    public:
+        inline static constexpr const uint32_t MAGIC = 0x53504E4D; // "MNPS"
+        inline static constexpr const uint32_t VERSION = 1;
+        // Upper bound on inputSize and targetSize, against garbage headers
+        inline static constexpr const uint32_t MAX_RECORD_FLOATS = 1 << 24;
+
+        struct Header {
+            uint32_t magic = MAGIC;
+            uint32_t version = VERSION;
+            uint32_t inputSize = 0;
+            uint32_t targetSize = 0;
+            uint64_t count = 0;
+        };
+
+        bool open(const std::string &path);
+        void close();
+        bool isOpen() const { return reader.isOpen(); }
+        const Header& header() const { return fileHeader; }
+
+        size_t inputSize() const override { return fileHeader.inputSize; }
+        size_t targetSize() const override { return fileHeader.targetSize; }
+        size_t read(const statpack::MatrixView<float> &inputs, const statpack::MatrixView<float> &targets) override;
+
+    private:
+        StreamReader reader;
+        Header fileHeader;
+    };
+
+    /**
+     *  Reads batches of batchSize samples from a SampleSource on a
+     *  background thread, one batch ahead of the consumer, so reading
+     *  overlaps with training. Two batch buffers are all it ever holds.
+     */
+    class StreamBatcher {
+    public:
+        // Stops after limit samples, 0 reads until the source ends
+        StreamBatcher(SampleSource &source, size_t batchSize, uint64_t limit = 0);
+        ~StreamBatcher();
+        StreamBatcher(const StreamBatcher&) = delete;
+        StreamBatcher& operator=(const StreamBatcher&) = delete;
+
+        /**
+         *  Blocks until the next batch is read and hands it out. It stays
+         *  valid until the following call. The last batch may be short.
+         *  Returns false once the source is exhausted.
+         */
+        bool next(statpack::MatrixView<const float> &inputs, statpack::MatrixView<const float> &targets);
+        // Stops and joins the reader; next() returns false afterwards
+        void stop();
+
+    private:
+        struct Slot {
+            statpack::AlignedVector<float> inputs;
+            statpack::AlignedVector<float> targets;
+            size_t rows = 0;
+            bool ready = false;
+        };
+
+        SampleSource &source;
+        size_t batchSize;
+        uint64_t limit;
+        size_t inputStride;
+        size_t targetStride;
+        Slot slots[2];
+
+        // Guards ready, finished and stopping
+        std::mutex mutex;
+        std::condition_variable changed;
+        bool finished = false;
+        bool stopping = false;
+        uint64_t consumed = 0;
+        bool holding = false;
+        std::thread reader;
+
+        void readLoop();
+    };
+}
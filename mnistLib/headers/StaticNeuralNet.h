@@ -0,0 +1,236 @@
+#pragma once
+
+#include <array>
+#include <tuple>
+#include <utility>
+#include <algorithm>
+#include <cstddef>
+#include <cassert>
+
+#include "Network.h"
+#include "statpack.h"
+#include "kernels.h"
+
+/**
+ *  Network with its topology fixed at compile time, e.g.
+ *      StaticNeuralNet<Network::Activation::Relu, 100, 256, 784>
+ *
+ *  Every buffer is a std::array member, so the net does no heap allocation
+ *  of its own and every loop has a constant trip count the compiler can
+ *  unroll and vectorize. Large nets are megabytes in size, so create them
+ *  with std::make_unique or as statics rather than on the stack.
+ *
+ *  The arithmetic follows NeuralNet::backPropagate, so both classes learn
+ *  the same way given the same weights. Input layer delta_nodes, which
+ *  NeuralNet accumulates but never reads, are not kept.
+ */
+template <Network::Activation A, size_t... Sizes>
+class StaticNeuralNet : public Network {
+    static_assert(sizeof...(Sizes) >= 2, "StaticNeuralNet requires at least 2 layers (input & output)");
+
+public:
+    static constexpr size_t LAYER_COUNT = sizeof...(Sizes);
+    static constexpr std::array<size_t, LAYER_COUNT> SIZES = { Sizes... };
+    static constexpr size_t INPUT_SIZE = SIZES.front();
+    static constexpr size_t OUTPUT_SIZE = SIZES.back();
+
+    /**
+     *  Weights from In inputs to Out outputs plus the state of the outputs.
+     *  Weight rows are padded to statpack::alignedStride like NeuralNet's.
+     */
+    template <size_t In, size_t Out>
+    struct Layer {
+        static constexpr size_t STRIDE = statpack::alignedStride<float>(In);
+
+        alignas(statpack::BUFFER_ALIGNMENT) std::array<float, Out * STRIDE> weights{};
+        alignas(statpack::BUFFER_ALIGNMENT) std::array<float, Out * STRIDE> deltaWeights{};
+        alignas(statpack::BUFFER_ALIGNMENT) std::array<float, Out> biases{};
+        alignas(statpack::BUFFER_ALIGNMENT) std::array<float, Out> deltaBiases{};
+        alignas(statpack::BUFFER_ALIGNMENT) std::array<float, Out> wSum{};
+        alignas(statpack::BUFFER_ALIGNMENT) std::array<float, Out> nodes{};
+        alignas(statpack::BUFFER_ALIGNMENT) std::array<float, Out> bpTerms{};
+        // Incoming delta of nodes, the delta_nodes of NeuralNet's next layer
+        alignas(statpack::BUFFER_ALIGNMENT) std::array<float, Out> deltaNodes{};
+
+        float* weightRow(size_t k) { return weights.data() + k * STRIDE; }
+        const float* weightRow(size_t k) const { return weights.data() + k * STRIDE; }
+    };
+
+private:
+    template <size_t... I>
+    static auto layerTypes(std::index_sequence<I...>) -> std::tuple<Layer<SIZES[I], SIZES[I + 1]>...>;
+
+public:
+    using Layers = decltype(layerTypes(std::make_index_sequence<LAYER_COUNT - 1>()));
+
+    alignas(statpack::BUFFER_ALIGNMENT) std::array<float, INPUT_SIZE> inputs{};
+    alignas(statpack::BUFFER_ALIGNMENT) std::array<float, OUTPUT_SIZE> targetVector{};
+    // layer<I>() connects SIZES[I] to SIZES[I + 1]
+    Layers layers;
+
+    template <size_t I>
+    auto& layer() { return std::get<I>(layers); }
+    template <size_t I>
+    const auto& layer() const { return std::get<I>(layers); }
+
+    size_t inputSize() const override { return INPUT_SIZE; }
+    size_t outputSize() const override { return OUTPUT_SIZE; }
+
+    // Same draws as NeuralNet::randomizeWeightsAndBiases
+    void randomizeWeightsAndBiases(unsigned int seed = 0) {
+        statpack::Rng rng(seed);
+        forEachLayer([&rng](auto &l, auto in) {
+            rng.fillUniform(statpack::Span<float>(l.biases.data(), l.biases.size()), -10, 10);
+            rng.fillUniform(statpack::MatrixView<float>(l.weights.data(), l.biases.size(), decltype(in)::value, l.STRIDE), -10, 10);
+        });
+    }
+
+    void forwardPropagate(const float *in) {
+        std::copy(in, in + INPUT_SIZE, inputs.begin());
+        forward<0>();
+    }
+
+    void backPropagate(const float *target, const float batchSize = 1.f, const bool realData = true) {
+        auto &last = layer<LAYER_COUNT - 2>();
+        dActivate(last.wSum.data(), last.bpTerms.data(), OUTPUT_SIZE);
+        applyDCost(target, 1, last.nodes.data(), last.bpTerms.data(), OUTPUT_SIZE, realData);
+        backward<LAYER_COUNT - 2>(batchSize);
+    }
+
+    float train(statpack::Span<const float> in, statpack::Span<const float> target, const float epoch = 1.f, const bool realData = true) override {
+#ifdef CUSTOM_DEBUG
+        assert(in.size() == INPUT_SIZE && "Input vector has an incorrect size.");
+        assert(target.size() == OUTPUT_SIZE && "Target and ouput vectors have different lengths.");
+#endif
+        for (size_t i = 0; i < OUTPUT_SIZE; ++i) {
+            targetVector[i] = statpack::normalize(target[i], targetMin, targetMax, activationMin, activationMax);
+        }
+        forwardPropagate(in.data());
+        backPropagate(targetVector.data(), epoch, realData);
+        const auto &nodes = layer<LAYER_COUNT - 2>().nodes;
+        return costFunction(statpack::Span<const float>(nodes.data(), OUTPUT_SIZE), statpack::Span<const float>(targetVector.data(), OUTPUT_SIZE), realData);
+    }
+
+    void generate(statpack::Span<const float> in, statpack::Span<float> outputs) override {
+#ifdef CUSTOM_DEBUG
+        assert(outputs.size() >= OUTPUT_SIZE && "Output span is too small.");
+#endif
+        forwardPropagate(in.data());
+        const auto &nodes = layer<LAYER_COUNT - 2>().nodes;
+        for (size_t i = 0; i < OUTPUT_SIZE; ++i) {
+            outputs[i] = statpack::normalize(nodes[i], activationMin, activationMax, targetMin, targetMax);
+        }
+    }
+
+    void applyDeltas() override {
+        forEachLayer([this](auto &l, auto) {
+            statpack::kernels::scaledUpdate(l.weights.data(), l.deltaWeights.data(), learnRate, l.weights.size());
+            statpack::kernels::scaledUpdate(l.biases.data(), l.deltaBiases.data(), learnRate, l.biases.size());
+        });
+    }
+
+private:
+    // fn(layer, std::integral_constant<size_t, In>) for every layer in order
+    template <typename F>
+    void forEachLayer(F &&fn) {
+        forEachLayer(fn, std::make_index_sequence<LAYER_COUNT - 1>());
+    }
+
+    template <typename F, size_t... I>
+    void forEachLayer(F &fn, std::index_sequence<I...>) {
+        (fn(std::get<I>(layers), std::integral_constant<size_t, SIZES[I]>()), ...);
+    }
+
+    template <size_t I>
+    const float* layerInput() const {
+        if constexpr (I == 0) {
+            return inputs.data();
+        } else {
+            return layer<I - 1>().nodes.data();
+        }
+    }
+
+    // Eight independent partial sums so the fixed-length loop vectorizes
+    template <size_t N>
+    static float dot(const float *a, const float *b) {
+        constexpr size_t LANES = 8;
+        constexpr size_t FULL = N / LANES * LANES;
+        float acc[LANES] = {};
+        for (size_t i = 0; i < FULL; i += LANES) {
+            for (size_t l = 0; l < LANES; ++l) {
+                acc[l] += a[i + l] * b[i + l];
+            }
+        }
+        float sum = ((acc[0] + acc[1]) + (acc[2] + acc[3])) + ((acc[4] + acc[5]) + (acc[6] + acc[7]));
+        for (size_t i = FULL; i < N; ++i) {
+            sum += a[i] * b[i];
+        }
+        return sum;
+    }
+
+    // y += alpha * x over a fixed length
+    template <size_t N>
+    static void axpy(float *y, const float *x, const float alpha) {
+        for (size_t i = 0; i < N; ++i) {
+            y[i] += x[i] * alpha;
+        }
+    }
+
+    static void activate(const float *wSum, float *nodes, size_t size) {
+        if constexpr (A == Activation::Relu) {
+            statpack::kernels::relu(wSum, nodes, size);
+        } else {
+            statpack::kernels::sigmoid(wSum, nodes, size);
+        }
+    }
+
+    static void dActivate(const float *wSum, float *out, size_t size) {
+        if constexpr (A == Activation::Relu) {
+            statpack::kernels::dRelu(wSum, out, size);
+        } else {
+            statpack::kernels::dSigmoid(wSum, out, size);
+        }
+    }
+
+    template <size_t I>
+    void forward() {
+        constexpr size_t IN = SIZES[I];
+        constexpr size_t OUT = SIZES[I + 1];
+        auto &l = layer<I>();
+        const float *in = layerInput<I>();
+        for (size_t k = 0; k < OUT; ++k) {
+            l.wSum[k] = dot<IN>(in, l.weightRow(k)) + l.biases[k];
+        }
+        activate(l.wSum.data(), l.nodes.data(), OUT);
+        if constexpr (I + 2 < LAYER_COUNT) {
+            forward<I + 1>();
+        }
+    }
+
+    // Adds layer I's bpTerms into its deltas and the deltaNodes of layer I - 1,
+    // then continues with layer I - 1
+    template <size_t I>
+    void backward(const float batchSize) {
+        constexpr size_t IN = SIZES[I];
+        constexpr size_t OUT = SIZES[I + 1];
+        auto &l = layer<I>();
+        const float *in = layerInput<I>();
+        const float nodeCount = static_cast<float>(OUT);
+        for (size_t k = 0; k < OUT; ++k) {
+            axpy<IN>(l.deltaWeights.data() + k * l.STRIDE, in, l.bpTerms[k] / batchSize);
+            l.deltaBiases[k] += l.bpTerms[k] / batchSize;
+        }
+        if constexpr (I > 0) {
+            auto &prev = layer<I - 1>();
+            for (size_t k = 0; k < OUT; ++k) {
+                axpy<IN>(prev.deltaNodes.data(), l.weightRow(k), l.bpTerms[k] / nodeCount);
+            }
+            dActivate(prev.wSum.data(), prev.bpTerms.data(), IN);
+            for (size_t k = 0; k < IN; ++k) {
+                prev.bpTerms[k] = prev.bpTerms[k] * prev.deltaNodes[k];
+                prev.deltaNodes[k] = 0;
+            }
+            backward<I - 1>(batchSize);
+        }
+    }
+};
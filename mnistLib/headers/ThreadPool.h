@@ -0,0 +1,60 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+/**
+ *  Persistent worker threads for splitting a loop into contiguous chunks.
+ *  The calling thread works on the first chunk itself, so a pool of size 1
+ *  has no workers and simply runs the loop inline.
+ */
+class ThreadPool {
+public:
+    // threads is the total number of participants, including the caller
+    explicit ThreadPool(size_t threads = std::thread::hardware_concurrency());
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t size() const {
+        return workers.size() + 1;
+    }
+
+    /**
+     *  Calls fn(begin, end) over [0, count) split into at most size() chunks
+     *  and blocks until every chunk is done. Chunk boundaries are multiples
+     *  of grain. Not reentrant: fn must not call parallelFor on the same pool.
+     */
+    template <typename F>
+    void parallelFor(size_t count, F &&fn, size_t grain = 1) {
+        using Fn = std::remove_reference_t<F>;
+        run(count, grain, [](void *context, size_t begin, size_t end) {
+            (*static_cast<Fn*>(context))(begin, end);
+        }, const_cast<void*>(static_cast<const void*>(&fn)));
+    }
+
+private:
+    using Task = void (*)(void*, size_t, size_t);
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable finished;
+
+    // Current job, guarded by mutex
+    Task task = nullptr;
+    void *context = nullptr;
+    size_t count = 0;
+    size_t chunk = 0;
+    uint64_t generation = 0;
+    size_t pending = 0;
+    bool stopping = false;
+
+    void run(size_t count, size_t grain, Task task, void *context);
+    void workerLoop(size_t index);
+};
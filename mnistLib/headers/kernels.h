@@ -0,0 +1,180 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ *  Vectorized float kernels
+ *
+ *  Every kernel has a portable scalar version and, on x86, SSE2, AVX2+FMA
+ *  and AVX-512 versions living in their own translation units. The widest
+ *  one the CPU supports is picked once from CPUID on first use.
+ */
+namespace statpack::kernels {
+    enum class Isa {
+        Scalar,
+        SSE2,
+        AVX2,
+        AVX512
+    };
+
+    // Lanes of the random generator kernels, the same for every instruction set
+    inline constexpr const size_t RANDOM_LANES = 16;
+
+    struct KernelTable {
+        float (*dot)(const float *a, const float *b, size_t size);
+        void (*axpy)(float *y, const float *x, float alpha, size_t size);
+        void (*scaledUpdate)(float *values, float *deltas, float scale, size_t size);
+        void (*gemmAccumulate)(float *C, size_t ldc, const float *A, size_t lda, const float *B, size_t ldb,
+                               size_t rows, size_t cols, size_t depth);
+        void (*sigmoid)(const float *in, float *out, size_t size);
+        void (*dSigmoid)(const float *in, float *out, size_t size);
+        void (*relu)(const float *in, float *out, size_t size);
+        void (*dRelu)(const float *in, float *out, size_t size);
+        void (*decodeBytes)(const uint8_t *in, float *out, float scale, float offset, size_t size);
+        float (*dotBf16)(const uint16_t *a, const float *b, size_t size);
+        int32_t (*dotI8)(const int8_t *a, const int8_t *b, size_t size);
+        void (*momentumUpdate)(float *values, float *deltas, float *velocity, float rate, float momentum, size_t size);
+        void (*rmsPropUpdate)(float *values, float *deltas, float *meanSquare, float rate, float decay, float epsilon, size_t size);
+        void (*adamUpdate)(float *values, float *deltas, float *moment1, float *moment2, float rate,
+                           float beta1, float beta2, float epsilon, size_t size);
+        void (*randomBits)(uint32_t *state, uint32_t *out, size_t blocks);
+        void (*randomUniform)(uint32_t *state, float *out, size_t blocks, float scale, float offset);
+        void (*randomNormal)(uint32_t *state, float *out, size_t blocks, float mean, float stddev);
+    };
+
+    // Table of the currently active instruction set
+    const KernelTable& table();
+    Isa activeIsa();
+    // Widest instruction set this CPU and build support
+    Isa supportedIsa();
+    /**
+     *  Forces a narrower instruction set, for example to compare against the
+     *  scalar kernels. Requests wider than supportedIsa() are clamped.
+     *  Not thread-safe; call before any worker threads use the kernels.
+     */
+    Isa setIsa(Isa isa);
+    const char* isaName(Isa isa);
+
+    // sum(a[i] * b[i]), accumulated in several vector lanes
+    inline float dot(const float *a, const float *b, size_t size) {
+        return table().dot(a, b, size);
+    }
+
+    // y += alpha * x
+    inline void axpy(float *y, const float *x, float alpha, size_t size) {
+        table().axpy(y, x, alpha, size);
+    }
+
+    // values -= deltas * scale, then deltas = 0
+    inline void scaledUpdate(float *values, float *deltas, float scale, size_t size) {
+        table().scaledUpdate(values, deltas, scale, size);
+    }
+
+    /**
+     *  C += A * B for row-major rows x depth A and depth x cols B.
+     *  Each element accumulates in ascending depth with the same per-element
+     *  arithmetic as axpy, so calling axpy once per row of B gives identical
+     *  results.
+     */
+    inline void gemmAccumulate(float *C, size_t ldc, const float *A, size_t lda, const float *B, size_t ldb,
+                               size_t rows, size_t cols, size_t depth) {
+        table().gemmAccumulate(C, ldc, A, lda, B, ldb, rows, cols, depth);
+    }
+
+    /**
+     *  Whole-array activations and their derivatives, out[i] = f(in[i]).
+     *  in and out may be the same array. sigmoid uses a polynomial exp that
+     *  stays within a few ulp of std::exp.
+     */
+    inline void sigmoid(const float *in, float *out, size_t size) {
+        table().sigmoid(in, out, size);
+    }
+
+    inline void dSigmoid(const float *in, float *out, size_t size) {
+        table().dSigmoid(in, out, size);
+    }
+
+    inline void relu(const float *in, float *out, size_t size) {
+        table().relu(in, out, size);
+    }
+
+    inline void dRelu(const float *in, float *out, size_t size) {
+        table().dRelu(in, out, size);
+    }
+
+    // out[i] = in[i] * scale + offset, widening bytes to float on the way
+    inline void decodeBytes(const uint8_t *in, float *out, float scale, float offset, size_t size) {
+        table().decodeBytes(in, out, scale, offset, size);
+    }
+
+    /**
+     *  sum(a[i] * b[i]) for bfloat16 a, the upper 16 bits of a float.
+     *  Widening is exact, so only the accumulation order differs from dot.
+     */
+    inline float dotBf16(const uint16_t *a, const float *b, size_t size) {
+        return table().dotBf16(a, b, size);
+    }
+
+    /**
+     *  sum(a[i] * b[i]) in 32-bit integers, exact for size < 2^17.
+     *  Values must lie in [-127, 127]; the AVX2 and AVX-512 versions use
+     *  16-bit pair sums that -128 * -128 can saturate.
+     */
+    inline int32_t dotI8(const int8_t *a, const int8_t *b, size_t size) {
+        return table().dotI8(a, b, size);
+    }
+
+    /**
+     *  Optimizer steps fused into one pass: each reads the deltas, updates
+     *  its moment buffers and the values, then sets the deltas to 0 like
+     *  scaledUpdate.
+     *
+     *  momentumUpdate  velocity = momentum * velocity + delta
+     *                  value -= rate * velocity
+     *  rmsPropUpdate   meanSquare = decay * meanSquare + (1 - decay) * delta^2
+     *                  value -= rate * delta / (sqrt(meanSquare) + epsilon)
+     *  adamUpdate      moment1 = beta1 * moment1 + (1 - beta1) * delta
+     *                  moment2 = beta2 * moment2 + (1 - beta2) * delta^2
+     *                  value -= rate * moment1 / (sqrt(moment2) + epsilon)
+     *
+     *  adamUpdate leaves bias correction to the caller, folded into rate
+     *  and epsilon.
+     */
+    inline void momentumUpdate(float *values, float *deltas, float *velocity, float rate, float momentum, size_t size) {
+        table().momentumUpdate(values, deltas, velocity, rate, momentum, size);
+    }
+
+    inline void rmsPropUpdate(float *values, float *deltas, float *meanSquare, float rate, float decay, float epsilon, size_t size) {
+        table().rmsPropUpdate(values, deltas, meanSquare, rate, decay, epsilon, size);
+    }
+
+    inline void adamUpdate(float *values, float *deltas, float *moment1, float *moment2, float rate,
+                           float beta1, float beta2, float epsilon, size_t size) {
+        table().adamUpdate(values, deltas, moment1, moment2, rate, beta1, beta2, epsilon, size);
+    }
+
+    /**
+     *  Random generators advancing 4 * RANDOM_LANES words of xoshiro128++
+     *  state, see statpack::Rng. A block is one step of every lane, and
+     *  every instruction set produces the same bits.
+     *
+     *  randomBits     RANDOM_LANES raw words per block
+     *  randomUniform  RANDOM_LANES floats u * scale + offset per block, u in
+     *                 [0, 1) from the top 24 bits of a word
+     *  randomNormal   2 * RANDOM_LANES normal floats per block, from two
+     *                 steps of every lane through Box-Muller with polynomial
+     *                 log, sin and cos
+     */
+    inline void randomBits(uint32_t *state, uint32_t *out, size_t blocks) {
+        table().randomBits(state, out, blocks);
+    }
+
+    inline void randomUniform(uint32_t *state, float *out, size_t blocks, float scale, float offset) {
+        table().randomUniform(state, out, blocks, scale, offset);
+    }
+
+    inline void randomNormal(uint32_t *state, float *out, size_t blocks, float mean, float stddev) {
+        table().randomNormal(state, out, blocks, mean, stddev);
+    }
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <new>
+#include <cassert>
+#include <type_traits>
+
+/**
+ *  Memory templates
+ */
+namespace statpack {
+    // Alignment used for all contiguous parameter buffers. 64 bytes covers
+    // a cache line and the widest vector register we dispatch to.
+    inline constexpr const size_t BUFFER_ALIGNMENT = 64;
+
+    template <typename T, size_t Alignment = BUFFER_ALIGNMENT>
+    struct AlignedAllocator {
+        using value_type = T;
+
+        template <typename U>
+        struct rebind {
+            using other = AlignedAllocator<U, Alignment>;
+        };
+
+        AlignedAllocator() = default;
+
+        template <typename U>
+        AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+        T* allocate(size_t n) {
+            return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Alignment)));
+        }
+
+        void deallocate(T* ptr, [[maybe_unused]] size_t n) {
+            ::operator delete(ptr, std::align_val_t(Alignment));
+        }
+
+        template <typename U>
+        bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+
+        template <typename U>
+        bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+    };
+
+    template <typename T>
+    using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+    /**
+     *  Rounds count up so that consecutive rows of T start on BUFFER_ALIGNMENT
+     */
+    template <typename T>
+    constexpr size_t alignedStride(const size_t count) {
+        constexpr size_t perLine = BUFFER_ALIGNMENT / sizeof(T);
+        return (count + perLine - 1) / perLine * perLine;
+    }
+
+    /**
+     *  Non-owning view over count contiguous elements
+     */
+    template <typename T>
+    class Span {
+    public:
+        Span() : ptr(nullptr), count(0) {}
+        Span(T *data, size_t size) : ptr(data), count(size) {}
+
+        T* data() const { return ptr; }
+        size_t size() const { return count; }
+        bool empty() const { return count == 0; }
+
+        T* begin() const { return ptr; }
+        T* end() const { return ptr + count; }
+
+        T& operator[](size_t i) const {
+#ifdef CUSTOM_DEBUG
+            assert(i < count && "Span index out of range.");
+#endif
+            return ptr[i];
+        }
+
+    private:
+        T *ptr;
+        size_t count;
+    };
+
+    /**
+     *  Non-owning row-major matrix view. Rows are stride elements apart
+     *  so they can be padded to the buffer alignment.
+     */
+    template <typename T>
+    struct MatrixView {
+        T *data = nullptr;
+        size_t rows = 0;
+        size_t cols = 0;
+        size_t stride = 0;
+
+        MatrixView() = default;
+        MatrixView(T *ptr, size_t nRows, size_t nCols, size_t rowStride) :
+            data(ptr), rows(nRows), cols(nCols), stride(rowStride) {}
+
+        // Allows passing a mutable view where a read-only one is expected
+        template <typename U, typename = std::enable_if_t<std::is_same_v<const U, T>>>
+        MatrixView(const MatrixView<U> &other) :
+            data(other.data), rows(other.rows), cols(other.cols), stride(other.stride) {}
+
+        Span<T> operator[](size_t row) const {
+#ifdef CUSTOM_DEBUG
+            assert(row < rows && "Matrix row out of range.");
+#endif
+            return Span<T>(data + row * stride, cols);
+        }
+
+        T* row(size_t r) const {
+            return data + r * stride;
+        }
+    };
+
+    /**
+     *  Scratch arena over one aligned buffer. reserve() is the only call
+     *  that allocates; take() hands out cache-line aligned chunks from it
+     *  until reset(), so callers size it once up front and reuse it.
+     */
+    class Workspace {
+    public:
+        // Grows the arena to hold at least floats values. Invalidates earlier chunks.
+        void reserve(size_t floats) {
+            if (floats > buffer.size()) {
+                buffer.assign(floats, 0.0f);
+            }
+            used = 0;
+        }
+
+        void reset() {
+            used = 0;
+        }
+
+        size_t capacity() const {
+            return buffer.size();
+        }
+
+        float* take(size_t count) {
+            const size_t size = alignedStride<float>(count);
+#ifdef CUSTOM_DEBUG
+            assert(used + size <= buffer.size() && "Workspace was not reserved large enough.");
+#endif
+            float *chunk = buffer.data() + used;
+            used += size;
+            return chunk;
+        }
+
+        MatrixView<float> matrix(size_t rows, size_t cols) {
+            const size_t stride = alignedStride<float>(cols);
+            return MatrixView<float>(take(rows * stride), rows, cols, stride);
+        }
+
+    private:
+        AlignedVector<float> buffer;
+        size_t used = 0;
+    };
+}
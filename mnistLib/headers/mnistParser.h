@@ -1,7 +1,10 @@
 #pragma once
 
-#include <fstream>
-#include <array>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+#include "matrix.h"
 
 namespace mnistParser {
     inline constexpr const int IMAGE_PIXELS = 784; // 28x28
@@ -9,6 +12,8 @@ namespace mnistParser {
     inline constexpr const int IMAGE_OFFSET = 16; // 32 * 4 = 128 bits = 16 bytes
     inline constexpr const int LABEL_OFFSET = 8; // 32 * 2 = 64 bits = 8 bytes
     
+    // Sizes of the original MNIST files, for reference only. Dataset and
+    // IdxStream take every size from the IDX headers.
     inline constexpr const int TRAIN_DATA_SIZE = 47040016;
     inline constexpr const int TRAIN_LABEL_SIZE = 60008;
 
@@ -18,8 +23,60 @@ namespace mnistParser {
     inline constexpr const int TRAIN_IMAGE_MAX = 60000;
     inline constexpr const int TEST_IMAGE_MAX = 10000;
     
+    inline constexpr const int32_t LABEL_MAGIC = 0x00000801;
+    inline constexpr const int32_t IMAGE_MAGIC = 0x00000803;
+
+    inline constexpr const char* TRAIN_IMAGE_FILE = "train-images-idx3-ubyte";
+    inline constexpr const char* TRAIN_LABEL_FILE = "train-labels-idx1-ubyte";
+    inline constexpr const char* TEST_IMAGE_FILE = "t10k-images-idx3-ubyte";
+    inline constexpr const char* TEST_LABEL_FILE = "t10k-labels-idx1-ubyte";
+
     int flipInt32(int32_t i);
-    
+
+    /**
+     *  Converts size pixels 0..255 to floats mapped linearly onto [min, max]
+     *  in one vectorized pass. The defaults keep the raw pixel values.
+     */
+    void decodePixels(const uint8_t *pixels, float *out, size_t size, float min = 0.0f, float max = 255.0f);
+
+    /**
+     *  Read-only memory map of a single IDX file. The magic number gives the
+     *  element type (only unsigned byte is supported) and the number of
+     *  dimensions, each of which is a big-endian int32 following it.
+     */
+    class IdxFile {
+    public:
+        IdxFile() = default;
+        ~IdxFile();
+        IdxFile(const IdxFile&) = delete;
+        IdxFile& operator=(const IdxFile&) = delete;
+        IdxFile(IdxFile &&other) noexcept;
+        IdxFile& operator=(IdxFile &&other) noexcept;
+
+        // Maps path and validates its header against expectedMagic
+        bool open(const std::string &path, int32_t expectedMagic);
+        void close();
+        bool isOpen() const { return mapping != nullptr; }
+
+        // Size of the first dimension, i.e. number of items
+        int32_t count() const { return dims[0]; }
+        int32_t dim(size_t i) const { return dims[i]; }
+        size_t dimCount() const { return nDims; }
+        // Bytes per item, the product of every dimension after the first
+        size_t itemSize() const { return itemBytes; }
+        const uint8_t* data() const { return payload; }
+
+    private:
+        static constexpr const size_t MAX_DIMS = 4;
+
+        void *mapping = nullptr;
+        size_t mappedSize = 0;
+        const uint8_t *payload = nullptr;
+        int32_t dims[MAX_DIMS] = {};
+        size_t nDims = 0;
+        size_t itemBytes = 0;
+    };
+
     /**
      * TEST SET LABEL FILE (t10k-labels-idx1-ubyte):
      * [offset] [type]          [value]          [description]
@@ -43,21 +100,6 @@ namespace mnistParser {
      * xxxx     unsigned byte   ??               pixel
      * Pixels are organized row-wise. Pixel values are 0 to 255. 0 means background (white), 255 means foreground (black).
      */
-    namespace test {
-        extern int32_t currentImageNr; 
-        extern std::array<int32_t, IMAGE_PIXELS> currentImageInt;
-        extern std::array<float, IMAGE_PIXELS> currentImageFloat;
-        
-        // Open these streams to point to the proper files
-        extern std::ifstream testImgStrm;
-        extern std::ifstream testLabelStrm;
-
-        extern std::ofstream outStream;
-
-        std::array<float, IMAGE_PIXELS> getImage(int32_t nr);
-        int32_t getImageNr(int32_t nr);
-    }
-
     /**
      * TRAINING SET LABEL FILE (train-labels-idx1-ubyte):
      * [offset] [type]          [value]          [description]
@@ -80,18 +122,43 @@ namespace mnistParser {
      * ........
      * xxxx     unsigned byte   ??               pixel
      */
-    namespace training {
-        extern int32_t currentImageNr; 
-        extern std::array<int32_t, IMAGE_PIXELS> currentImageInt;
-        extern std::array<float, IMAGE_PIXELS> currentImageFloat;
-        
-        // Open these streams to point to the proper files
-        extern std::ifstream trainImgStrm;
-        extern std::ifstream trainLabelStrm;
-
-        extern std::ofstream outStream;
-
-        std::array<float, IMAGE_PIXELS> getImage(int32_t nr);
-        int32_t getImageNr(int32_t nr);
-    }    
-}
\ No newline at end of file
+
+    /**
+     *  An IDX image file and its optional label file, both mapped once.
+     *  Images and labels are handed out as zero-copy views into the maps or
+     *  converted into caller-provided buffers. Nothing is mutated after
+     *  open(), so any number of threads may read through the const methods
+     *  concurrently without locking.
+     */
+    class Dataset {
+    public:
+        bool open(const std::string &imagePath, const std::string &labelPath = "");
+        void close();
+        bool isOpen() const { return imageFile.isOpen(); }
+        bool hasLabels() const { return labelFile.isOpen(); }
+
+        int32_t size() const { return imageFile.count(); }
+        int32_t rows() const { return imageFile.dim(1); }
+        int32_t cols() const { return imageFile.dim(2); }
+        size_t imagePixels() const { return imageFile.itemSize(); }
+
+        statpack::Span<const uint8_t> image(int32_t nr) const;
+        // count consecutive images starting from first, row after row
+        statpack::Span<const uint8_t> images(int32_t first, int32_t count) const;
+        uint8_t label(int32_t nr) const;
+        statpack::Span<const uint8_t> labels(int32_t first, int32_t count) const;
+
+        // Pixel values 0..255 of image nr as floats. out must hold imagePixels() values.
+        bool getImage(int32_t nr, statpack::Span<float> out) const;
+        // count images starting from first, one per row of out
+        bool getImages(int32_t first, int32_t count, statpack::MatrixView<float> out) const;
+        // Same as getImages, with pixels mapped onto [min, max]
+        bool decodeImages(int32_t first, int32_t count, statpack::MatrixView<float> out, float min, float max) const;
+        // Label of image nr, or -1 if out of range
+        int32_t getImageNr(int32_t nr) const;
+
+    private:
+        IdxFile imageFile;
+        IdxFile labelFile;
+    };
+}
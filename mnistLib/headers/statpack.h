@@ -7,36 +7,71 @@
 #include <cmath>
 #include <cassert>
 #include <iostream>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+
+#include "matrix.h"
+#include "kernels.h"
+#include "Rng.h"
 
 namespace statpack {
+    /**
+     *  Convenience draws from a generator of the calling thread. seed()
+     *  sets one seed for the whole process and every thread reseeds from
+     *  it on its next draw, with its own Rng stream.
+     *
+     *  Threads are numbered in the order they first draw and that number
+     *  is their stream, so which thread gets which sequence depends on
+     *  scheduling. Workers that need the same sequence on every run should
+     *  own a statpack::Rng built with an explicit stream index instead.
+     */
     class Random {
     public:
         static void seed() {
-            engine.seed(rd());
+            std::random_device device;
+            seed((static_cast<uint64_t>(device()) << 32) | device());
         }
 
-        static void seed(const unsigned int value) {
-            engine.seed(value);
+        static void seed(const uint64_t value) {
+            globalSeed.store(value, std::memory_order_relaxed);
+            epoch.fetch_add(1, std::memory_order_release);
         }
 
         static int Int(const int min, const int max) {
-            std::uniform_int_distribution<int> dist(min,max);
-            return dist(engine);
+            return generator().uniformInt(min, max);
         }
 
         static float Float(const float min, const float max) {
-            std::uniform_real_distribution<float> dist(min, max);
-            return dist(engine);
+            return generator().uniform(min, max);
         }
 
         static double Double(const double min, const double max) {
-            std::uniform_real_distribution<double> dist(min,max);
-            return dist(engine);
+            return generator().uniformDouble(min, max);
+        }
+
+        static Rng& generator() {
+            thread_local Rng rng(0, threadStream());
+            thread_local uint64_t seenEpoch = 0;
+            // A seed() since this thread's last draw
+            const uint64_t current = epoch.load(std::memory_order_acquire);
+            if (current != seenEpoch) {
+                seenEpoch = current;
+                rng.seed(globalSeed.load(std::memory_order_relaxed), threadStream());
+            }
+            return rng;
         }
 
     private:
-        inline static std::random_device rd;
-        inline static std::mt19937 engine;
+        inline static std::atomic<uint64_t> threads{0};
+        inline static std::atomic<uint64_t> globalSeed{0};
+        inline static std::atomic<uint64_t> epoch{0};
+
+        static uint64_t threadStream() {
+            thread_local const uint64_t stream = threads.fetch_add(1, std::memory_order_relaxed);
+            return stream;
+        }
     };
 }
 
@@ -115,55 +150,207 @@ namespace statpack {
         return mse / observed.size();
     }
 
+    template <typename T>
+    float weightedSum(const T *inputs, const T *weights, const size_t size) {
+        float wSum = 0;
+        for (size_t i = 0; i < size; i++) {
+            wSum += weights[i] * inputs[i];
+        }
+        return wSum;
+    }
+
+    template <>
+    inline float weightedSum<float>(const float *inputs, const float *weights, const size_t size) {
+        return kernels::dot(inputs, weights, size);
+    }
+
     template <typename T>
     float weightedSum(const std::vector<T>& inputs, const std::vector<T> &weights) {
 #ifdef CUSTOM_DEBUG
         assert(!(inputs.size() != weights.size()) && "Vector sizes are not equal.");
 #endif
-        float wSum = 0;
-        for (size_t i = 0; i < inputs.size(); i++) {
-            wSum += weights[i] * inputs[i];
+        return weightedSum(inputs.data(), weights.data(), inputs.size());
+    }
+
+    template <typename T>
+    float weightedSum(const std::vector<T>& inputs, const Span<T> weights) {
+#ifdef CUSTOM_DEBUG
+        assert(!(inputs.size() != weights.size()) && "Vector sizes are not equal.");
+#endif
+        return weightedSum(inputs.data(), weights.data(), inputs.size());
+    }
+
+    /**
+     *  Source index of every output pixel along one axis of rescaleImage,
+     *  or -1 where no source pixel lands and the output stays 0. The
+     *  rescale is a pure gather through one of these per axis, so tables
+     *  can be built once per (input, output) size pair and reused.
+     */
+    inline std::vector<int> resampleIndices(const int sizeIn, const int sizeOut) {
+        std::vector<int> indices(static_cast<size_t>(sizeOut), -1);
+        const float scale = static_cast<float>(sizeOut) / static_cast<float>(sizeIn);
+        for (int pixel = 0; pixel < sizeIn; ++pixel) {
+            const int thisPixel = static_cast<int>(std::ceil(scale * static_cast<float>(pixel)));
+            // ceil can round the last edge up past the output size
+            const int nextPixel = std::min(static_cast<int>(std::ceil(scale * static_cast<float>(pixel + 1))), sizeOut);
+            for (int i = thisPixel; i < nextPixel; ++i) {
+                indices[static_cast<size_t>(i)] = pixel;
+            }
+        }
+        return indices;
+    }
+
+    // out[row][col] = img[rows[row]][cols[col]], background where either index is -1
+    template <typename K>
+    void resample(const K *img, const int width, const int *rows, const int *cols, K *out, const int widthOut, const int heightOut,
+                  const K background = K{}) {
+        for (int row = 0; row < heightOut; ++row) {
+            K *outRow = out + static_cast<ptrdiff_t>(row) * widthOut;
+            if (rows[row] < 0) {
+                std::fill(outRow, outRow + widthOut, background);
+                continue;
+            }
+            // Upscaling repeats source rows, so copy the finished one
+            if (row > 0 && rows[row] == rows[row - 1]) {
+                std::copy(outRow - widthOut, outRow, outRow);
+                continue;
+            }
+            const K *inRow = img + static_cast<ptrdiff_t>(rows[row]) * width;
+            for (int col = 0; col < widthOut; ++col) {
+                outRow[col] = (cols[col] < 0 ? background : inRow[cols[col]]);
+            }
         }
-        return wSum;
     }
 
     template <typename K, int W_OUT, int H_OUT>
     std::array<K, W_OUT*H_OUT> rescaleImage(const std::vector<K> &img, const int width, const int height) {
-        std::array<K, W_OUT*H_OUT> tmp{};
-        const float xScale = static_cast<float>(W_OUT) / static_cast<float>(width);
-        const float yScale = static_cast<float>(H_OUT) / static_cast<float>(height);
-
-        // horizontal rescale
-        for (int row = 0; row < height; ++row) {
-            for (int pixel = 0; pixel < width; ++pixel) {
-                const int thisPixel = std::ceil(xScale * pixel );
-                const int nextPixel = std::ceil(xScale * (pixel + 1));
-                
-                for (int i = thisPixel; i < nextPixel; ++i) {
-                    if (i + row *W_OUT >= W_OUT*H_OUT) {
-                        break;
-                    }
-                    tmp.at(i + row * W_OUT) = img.at(pixel + row * width);
+#ifdef CUSTOM_DEBUG
+        assert(img.size() >= static_cast<size_t>(width * height) && "Image is smaller than width * height.");
+#endif
+        const std::vector<int> cols = resampleIndices(width, W_OUT);
+        const std::vector<int> rows = resampleIndices(height, H_OUT);
+        std::array<K, W_OUT*H_OUT> out;
+        resample(img.data(), width, rows.data(), cols.data(), out.data(), W_OUT, H_OUT);
+        return out;
+    }
+}
+
+/**
+ *  Matrix templates
+ *
+ *  Row kernels are shared by the per-sample and mini-batch paths of
+ *  NeuralNet so both accumulate every element in the same order.
+ */
+namespace statpack {
+    // Register tile of gemmAccumulate and the depth it is blocked by
+    inline constexpr const size_t GEMM_TILE_ROWS = 4;
+    inline constexpr const size_t GEMM_TILE_COLS = 32;
+    inline constexpr const size_t GEMM_BLOCK_DEPTH = 256;
+
+    // y += alpha * x
+    template <typename T>
+    void axpy(T *y, const T *x, const T alpha, const size_t size) {
+        for (size_t i = 0; i < size; ++i) {
+            y[i] += x[i] * alpha;
+        }
+    }
+
+    template <>
+    inline void axpy<float>(float *y, const float *x, const float alpha, const size_t size) {
+        kernels::axpy(y, x, alpha, size);
+    }
+
+    // out[c][r] = in[r][c] / divisor
+    template <typename T>
+    void transpose(const MatrixView<const T> &in, const MatrixView<T> &out, const T divisor = 1) {
+#ifdef CUSTOM_DEBUG
+        assert(in.rows == out.cols && in.cols == out.rows && "Matrix dimensions do not match.");
+#endif
+        constexpr size_t BLOCK = 16;
+        for (size_t rb = 0; rb < in.rows; rb += BLOCK) {
+            const size_t rEnd = std::min(rb + BLOCK, in.rows);
+            for (size_t c = 0; c < in.cols; ++c) {
+                T *outRow = out.row(c);
+                for (size_t r = rb; r < rEnd; ++r) {
+                    outRow[r] = in.row(r)[c] / divisor;
                 }
             }
         }
-        
-        std::array<K, W_OUT*H_OUT> out{};
-        // vertical rescale
-        for (int col = 0; col < W_OUT; ++col) {
-            for (int pixel = 0; pixel < height; ++pixel) {
-                const int thisPixel = std::ceil(yScale * pixel );
-                const int nextPixel = std::ceil(yScale * (pixel + 1));
-                
-                for (int i = thisPixel; i < nextPixel; ++i) {
-                    if (col + i * W_OUT >= W_OUT*H_OUT) {
-                        break;
+    }
+
+    /**
+     *  C += A * B
+     *  C is walked in GEMM_TILE_ROWS x GEMM_TILE_COLS register tiles over
+     *  GEMM_BLOCK_DEPTH rows of B at a time. Every element still accumulates
+     *  A[m][p] * B[p][n] in ascending p, the same order as calling axpy once
+     *  per row of B, so per-sample and batched results agree.
+     */
+    template <typename T>
+    void gemmAccumulate(const MatrixView<T> &C, const MatrixView<const T> &A, const MatrixView<const T> &B) {
+#ifdef CUSTOM_DEBUG
+        assert(A.cols == B.rows && C.rows == A.rows && C.cols == B.cols && "Matrix dimensions do not match.");
+#endif
+        static_assert(GEMM_TILE_ROWS == 4, "gemmAccumulate tile is written out for four rows.");
+        constexpr size_t MR = GEMM_TILE_ROWS;
+        constexpr size_t NR = GEMM_TILE_COLS;
+        const size_t mFull = C.rows - C.rows % MR;
+        const size_t nFull = C.cols - C.cols % NR;
+        for (size_t pb = 0; pb < B.rows; pb += GEMM_BLOCK_DEPTH) {
+            const size_t pEnd = std::min(pb + GEMM_BLOCK_DEPTH, B.rows);
+            for (size_t m = 0; m < mFull; m += MR) {
+                for (size_t n = 0; n < nFull; n += NR) {
+                    T acc[MR][NR];
+                    for (size_t r = 0; r < MR; ++r) {
+                        for (size_t c = 0; c < NR; ++c) {
+                            acc[r][c] = C.row(m + r)[n + c];
+                        }
+                    }
+                    const T *aRows[MR];
+                    for (size_t r = 0; r < MR; ++r) {
+                        aRows[r] = A.row(m + r);
+                    }
+                    for (size_t p = pb; p < pEnd; ++p) {
+                        const T *bRow = B.row(p) + n;
+                        const T a0 = aRows[0][p];
+                        const T a1 = aRows[1][p];
+                        const T a2 = aRows[2][p];
+                        const T a3 = aRows[3][p];
+                        for (size_t c = 0; c < NR; ++c) {
+                            const T b = bRow[c];
+                            acc[0][c] += b * a0;
+                            acc[1][c] += b * a1;
+                            acc[2][c] += b * a2;
+                            acc[3][c] += b * a3;
+                        }
                     }
-                    out.at(col + i * W_OUT) = tmp.at(col + pixel * W_OUT);
+                    for (size_t r = 0; r < MR; ++r) {
+                        for (size_t c = 0; c < NR; ++c) {
+                            C.row(m + r)[n + c] = acc[r][c];
+                        }
+                    }
+                }
+                // Leftover columns
+                for (size_t r = m; r < m + MR; ++r) {
+                    for (size_t p = pb; p < pEnd; ++p) {
+                        axpy(C.row(r) + nFull, B.row(p) + nFull, A.row(r)[p], C.cols - nFull);
+                    }
+                }
+            }
+            // Leftover rows
+            for (size_t r = mFull; r < C.rows; ++r) {
+                for (size_t p = pb; p < pEnd; ++p) {
+                    axpy(C.row(r), B.row(p), A.row(r)[p], C.cols);
                 }
             }
         }
-        return out;
+    }
+
+    template <>
+    inline void gemmAccumulate<float>(const MatrixView<float> &C, const MatrixView<const float> &A, const MatrixView<const float> &B) {
+#ifdef CUSTOM_DEBUG
+        assert(A.cols == B.rows && C.rows == A.rows && C.cols == B.cols && "Matrix dimensions do not match.");
+#endif
+        kernels::gemmAccumulate(C.data, C.stride, A.data, A.stride, B.data, B.stride, C.rows, C.cols, A.cols);
     }
 }
 
@@ -212,11 +399,7 @@ namespace statpack {
 
     template<int T>
     float weightedSum(const std::array<float, T> &activations, const std::array<float, T> &weight) {
-        float weightedSum = 0;
-        for (int i = 0; i < activations.size(); i++) {
-            weightedSum += weight[i] * activations[i];
-        }
-        return weightedSum;
+        return kernels::dot(activations.data(), weight.data(), T);
     }
 
     template<typename K, int T>
@@ -257,7 +440,7 @@ namespace statpack {
         int yMax = 0;
         for (int row = 0; row < HEIGHT; ++row) {
             for (int col = 0; col < WIDTH; ++col) {
-                if (image.at(col + row*WIDTH) != BLACK) {
+                if (image[static_cast<size_t>(col + row*WIDTH)] != BLACK) {
                     xMin = (col < xMin ? col : xMin);
                     xMax = (col > xMax ? col : xMax);
                     
@@ -266,13 +449,12 @@ namespace statpack {
                 }
             }
         }
-        int ind = 0;
         yMax = (yMax < HEIGHT - 1 ? yMax + 1 : yMax);
         xMax = (xMax < WIDTH  - 1 ? xMax + 1 : xMax);
+        imgOut.data.reserve(static_cast<size_t>(std::max(xMax - xMin, 0) * std::max(yMax - yMin, 0)));
         for (int row = yMin; row < yMax; ++row) {
-            for (int col = xMin; col < xMax; ++col) {
-                imgOut.data.emplace_back(image.at(col + row*WIDTH));
-            }
+            const T *rowStart = image.data() + (xMin + row*WIDTH);
+            imgOut.data.insert(imgOut.data.end(), rowStart, rowStart + (xMax - xMin));
         }
         imgOut.width = xMax - xMin;
         imgOut.height = yMax - yMin;
@@ -281,34 +463,10 @@ namespace statpack {
 
     template <typename K, int W_IN, int H_IN, int W_OUT, int H_OUT>
     std::array<K, W_OUT*H_OUT> rescaleImage(const std::array<K, W_IN*H_IN>& img) {
-        std::array<K, W_OUT*H_OUT> tmp{};
-        const float xScale = static_cast<float>(W_OUT) / static_cast<float>(W_IN);
-        const float yScale = static_cast<float>(H_OUT) / static_cast<float>(H_IN);
-
-        // horizontal rescale
-        for (int row = 0; row < H_IN; ++row) {
-            for (int pixel = 0; pixel < W_IN; ++pixel) {
-                const int thisPixel = std::ceil(xScale * pixel );
-                const int nextPixel = std::ceil(xScale * (pixel + 1));
-                
-                for (int i = thisPixel; i < nextPixel; ++i) {
-                    tmp.at(i + row * W_OUT) = img.at(pixel + row * W_IN);
-                }
-            }
-        }
-        
-        std::array<K, W_OUT*H_OUT> out{};
-        // vertical rescale
-        for (int col = 0; col < W_OUT; ++col) {
-            for (int pixel = 0; pixel < H_IN; ++pixel) {
-                const int thisPixel = std::ceil(yScale * pixel );
-                const int nextPixel = std::ceil(yScale * (pixel + 1));
-                
-                for (int i = thisPixel; i < nextPixel; ++i) {
-                    out.at(col + i * W_OUT) = tmp.at(col + pixel * W_OUT);
-                }
-            }
-        }
+        static const std::vector<int> cols = resampleIndices(W_IN, W_OUT);
+        static const std::vector<int> rows = resampleIndices(H_IN, H_OUT);
+        std::array<K, W_OUT*H_OUT> out;
+        resample(img.data(), W_IN, rows.data(), cols.data(), out.data(), W_OUT, H_OUT);
         return out;
     }
 }
\ No newline at end of file
@@ -0,0 +1,338 @@
+#include "Checkpoint.h"
+
+#include <fstream>
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace checkpoint {
+    namespace {
+        size_t alignUp(size_t bytes) {
+            return (bytes + statpack::BUFFER_ALIGNMENT - 1) / statpack::BUFFER_ALIGNMENT * statpack::BUFFER_ALIGNMENT;
+        }
+
+        void copyName(char (&out)[16], const char *name) {
+            std::memset(out, 0, sizeof(out));
+            std::strncpy(out, name, sizeof(out) - 1);
+        }
+
+        // Bytes of the header block of a file of version
+        size_t headerBytes(uint32_t version) {
+            return alignUp(version == 1 ? offsetof(Header, optimizer) : sizeof(Header));
+        }
+
+        // Bytes of the parameter and state blocks of one layer
+        size_t layerBytes(size_t paramCount, size_t stateSlots) {
+            size_t bytes = alignUp(paramCount * sizeof(float));
+            if (stateSlots > 0) {
+                bytes += alignUp(stateSlots * paramCount * sizeof(float));
+            }
+            return bytes;
+        }
+
+        // Layer sizes in a file above this are rejected before any arithmetic
+        constexpr uint64_t MAX_LAYER_SIZE = INT32_MAX;
+
+        /**
+         *  layerBytes of a layer of sizeIn inputs and sizeOut outputs taken
+         *  from a file. False if any step of it would not fit in a size_t.
+         */
+        bool checkedLayerBytes(size_t sizeIn, size_t sizeOut, size_t stateSlots, size_t &bytes) {
+            size_t count = 0;
+            size_t blocks = 0;
+            size_t padded = 0;
+            if (__builtin_mul_overflow(sizeOut, statpack::alignedStride<float>(sizeIn), &count)
+                || __builtin_add_overflow(count, statpack::alignedStride<float>(sizeOut), &count)
+                || __builtin_add_overflow(stateSlots, size_t{1}, &blocks)
+                || __builtin_mul_overflow(blocks, sizeof(float), &padded)
+                || __builtin_mul_overflow(count, padded, &padded)
+                || __builtin_add_overflow(padded, blocks * statpack::BUFFER_ALIGNMENT, &padded)) {
+                return false;
+            }
+            // padded bounds every product and alignUp in layerBytes
+            bytes = layerBytes(count, stateSlots);
+            return true;
+        }
+
+        void serialize(const NeuralNet &net, std::vector<unsigned char> &out) {
+            const size_t layerCount = net.layers.size();
+            const size_t stateSlots = net.optimizerSlots();
+            size_t size = headerBytes(VERSION) + alignUp(layerCount * sizeof(uint64_t));
+            for (size_t i = 0; i + 1 < layerCount; ++i) {
+                size += layerBytes(net.layers[i].paramCount(), stateSlots);
+            }
+            out.assign(size, 0);
+
+            Header header = {};
+            header.magic = MAGIC;
+            header.version = VERSION;
+            header.layerCount = static_cast<uint32_t>(layerCount);
+            header.rowAlignment = static_cast<uint32_t>(statpack::alignedStride<float>(1));
+            header.fileSize = size;
+            copyName(header.activation, net.activationFunctionName());
+            copyName(header.cost, net.costFunctionName());
+            header.learnRate = net.learnRate;
+            header.inputMin = net.inputMin;
+            header.inputMax = net.inputMax;
+            header.targetMin = net.targetMin;
+            header.targetMax = net.targetMax;
+            header.activationMin = net.activationMin;
+            header.activationMax = net.activationMax;
+            copyName(header.optimizer, net.optimizerName());
+            header.stateSlots = static_cast<uint32_t>(stateSlots);
+            header.optimizerStep = net.optimizerStep();
+            header.momentum = net.momentum;
+            header.rmsDecay = net.rmsDecay;
+            header.beta1 = net.beta1;
+            header.beta2 = net.beta2;
+            header.epsilon = net.epsilon;
+            std::memcpy(out.data(), &header, sizeof(header));
+
+            size_t offset = headerBytes(VERSION);
+            for (size_t i = 0; i < layerCount; ++i) {
+                const uint64_t layerSize = net.layers[i].sizeIn;
+                std::memcpy(out.data() + offset + i * sizeof(uint64_t), &layerSize, sizeof(layerSize));
+            }
+            offset += alignUp(layerCount * sizeof(uint64_t));
+            for (size_t i = 0; i + 1 < layerCount; ++i) {
+                const NeuralNet::Layer &layer = net.layers[i];
+                const size_t count = layer.paramCount();
+                std::memcpy(out.data() + offset, layer.params.data(), count * sizeof(float));
+                if (stateSlots > 0) {
+                    // Layer::state blocks follow the deltas back to back
+                    std::memcpy(out.data() + offset + alignUp(count * sizeof(float)), layer.params.data() + 2 * count,
+                                stateSlots * count * sizeof(float));
+                }
+                offset += layerBytes(count, stateSlots);
+            }
+        }
+
+        bool writeFile(const std::vector<unsigned char> &data, const std::string &path) {
+            const std::string tmpPath = path + ".tmp";
+            std::ofstream stream(tmpPath, std::ios::binary | std::ios::trunc);
+            stream.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+            stream.close();
+            if (!stream) {
+                std::cout << "Could not write checkpoint " << tmpPath << "\n";
+                return false;
+            }
+            if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+                std::cout << "Could not move checkpoint to " << path << "\n";
+                return false;
+            }
+            return true;
+        }
+
+        // Read-only mapping released when it goes out of scope
+        struct Mapping {
+            void *data = MAP_FAILED;
+            size_t size = 0;
+
+            ~Mapping() {
+                if (data != MAP_FAILED) {
+                    munmap(data, size);
+                }
+            }
+        };
+
+        bool mapFile(const std::string &path, Mapping &mapping) {
+            const int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) {
+                std::cout << "Could not open checkpoint " << path << "\n";
+                return false;
+            }
+            struct stat info;
+            if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(Header)) {
+                std::cout << path << " is too small to be a checkpoint!\n";
+                ::close(fd);
+                return false;
+            }
+            mapping.size = static_cast<size_t>(info.st_size);
+            mapping.data = mmap(nullptr, mapping.size, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if (mapping.data == MAP_FAILED) {
+                std::cout << "Could not map checkpoint " << path << "\n";
+                return false;
+            }
+            return true;
+        }
+    }
+
+    bool save(const NeuralNet &net, const std::string &path) {
+        std::vector<unsigned char> data;
+        serialize(net, data);
+        return writeFile(data, path);
+    }
+
+    bool load(NeuralNet &net, const std::string &path) {
+        Mapping mapping;
+        if (!mapFile(path, mapping)) {
+            return false;
+        }
+        const unsigned char *bytes = static_cast<const unsigned char*>(mapping.data);
+
+        Header header = {};
+        std::memcpy(&header, bytes, offsetof(Header, optimizer));
+        if (header.magic != MAGIC) {
+            std::cout << path << " is not a checkpoint!\n";
+            return false;
+        }
+        if (header.version != 1 && header.version != VERSION) {
+            std::cout << path << " has checkpoint version " << header.version << ", expected 1 to " << VERSION << "\n";
+            return false;
+        }
+        if (header.rowAlignment != statpack::alignedStride<float>(1) || header.fileSize != mapping.size || header.layerCount < 2
+            || headerBytes(header.version) > mapping.size) {
+            std::cout << path << " does not match this build or is truncated!\n";
+            return false;
+        }
+        const bool hasOptimizer = (header.version >= 2);
+        if (hasOptimizer) {
+            std::memcpy(&header, bytes, sizeof(header));
+        }
+
+        const size_t layerCount = header.layerCount;
+        const size_t stateSlots = header.stateSlots;
+        size_t offset = headerBytes(header.version);
+        if (offset + layerCount * sizeof(uint64_t) > mapping.size) {
+            std::cout << path << " is truncated!\n";
+            return false;
+        }
+        std::vector<uint64_t> sizes(layerCount);
+        std::memcpy(sizes.data(), bytes + offset, layerCount * sizeof(uint64_t));
+        offset += alignUp(layerCount * sizeof(uint64_t));
+
+        // Sizes are untrusted. Bound them and check the parameter blocks
+        // against the file size before touching net.
+        for (const uint64_t size : sizes) {
+            if (size == 0 || size > MAX_LAYER_SIZE) {
+                std::cout << path << " has a layer of " << size << " nodes!\n";
+                return false;
+            }
+        }
+        size_t expected = offset;
+        for (size_t i = 0; i + 1 < layerCount; ++i) {
+            size_t bytes = 0;
+            if (!checkedLayerBytes(static_cast<size_t>(sizes[i]), static_cast<size_t>(sizes[i + 1]), stateSlots, bytes)
+                || __builtin_add_overflow(expected, bytes, &expected)) {
+                std::cout << path << " has layer sizes that do not fit in memory!\n";
+                return false;
+            }
+        }
+        if (expected != mapping.size) {
+            std::cout << path << " has layer sizes that do not match its length!\n";
+            return false;
+        }
+
+        header.activation[sizeof(header.activation) - 1] = '\0';
+        header.cost[sizeof(header.cost) - 1] = '\0';
+        NeuralNet probe;
+        probe.setActivationFunction(header.activation);
+        probe.setCostFunction(header.cost);
+        if (std::strcmp(probe.activationFunctionName(), header.activation) != 0 || std::strcmp(probe.costFunctionName(), header.cost) != 0) {
+            std::cout << path << " uses unknown functions " << header.activation << " / " << header.cost << "\n";
+            return false;
+        }
+        if (hasOptimizer) {
+            header.optimizer[sizeof(header.optimizer) - 1] = '\0';
+            probe.setOptimizer(header.optimizer);
+            if (std::strcmp(probe.optimizerName(), header.optimizer) != 0 || probe.optimizerSlots() != stateSlots) {
+                std::cout << path << " uses unknown optimizer " << header.optimizer << "\n";
+                return false;
+            }
+        }
+
+        net.setActivationFunction(header.activation);
+        net.setCostFunction(header.cost);
+        net.learnRate = header.learnRate;
+        net.inputMin = header.inputMin;
+        net.inputMax = header.inputMax;
+        net.targetMin = header.targetMin;
+        net.targetMax = header.targetMax;
+        net.activationMin = header.activationMin;
+        net.activationMax = header.activationMax;
+
+        net.layers.clear();
+        if (hasOptimizer) {
+            net.momentum = header.momentum;
+            net.rmsDecay = header.rmsDecay;
+            net.beta1 = header.beta1;
+            net.beta2 = header.beta2;
+            net.epsilon = header.epsilon;
+            net.setOptimizer(header.optimizer);
+        }
+        for (const uint64_t size : sizes) {
+            net.addLayer(static_cast<size_t>(size));
+        }
+        net.build();
+        for (size_t i = 0; i + 1 < layerCount; ++i) {
+            NeuralNet::Layer &layer = net.layers[i];
+            const size_t count = layer.paramCount();
+            std::memcpy(layer.params.data(), bytes + offset, count * sizeof(float));
+            if (stateSlots > 0) {
+                std::memcpy(layer.state(0), bytes + offset + alignUp(count * sizeof(float)), stateSlots * count * sizeof(float));
+            }
+            offset += layerBytes(count, stateSlots);
+        }
+        if (hasOptimizer) {
+            net.setOptimizerStep(static_cast<size_t>(header.optimizerStep));
+        }
+        return true;
+    }
+
+    Snapshotter::Snapshotter(std::string path) : path(std::move(path)) {
+        writer = std::thread(&Snapshotter::writerLoop, this);
+    }
+
+    Snapshotter::~Snapshotter() {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            finished.wait(lock, [this] { return !pending; });
+            stopping = true;
+        }
+        wake.notify_one();
+        writer.join();
+    }
+
+    bool Snapshotter::snapshot(const NeuralNet &net) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (pending) {
+                return false;
+            }
+            // The writer only touches buffer while pending is set
+            serialize(net, buffer);
+            pending = true;
+        }
+        wake.notify_one();
+        return true;
+    }
+
+    void Snapshotter::wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [this] { return !pending; });
+    }
+
+    void Snapshotter::writerLoop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wake.wait(lock, [this] { return pending || stopping; });
+            if (stopping) {
+                return;
+            }
+            lock.unlock();
+            writeFile(buffer, path);
+            lock.lock();
+            pending = false;
+            finished.notify_all();
+        }
+    }
+}
@@ -0,0 +1,161 @@
+#include "DataLoader.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <chrono>
+#include <iostream>
+
+namespace mnistParser {
+    DataLoader::DataLoader(const Dataset &dataset, const Config &config) :
+        dataset(dataset), config(config) {
+        if (!dataset.isOpen() || dataset.size() == 0) {
+            std::cout << "DataLoader needs an open, non-empty dataset!\n";
+            return;
+        }
+        if (this->config.batchSize == 0) {
+            this->config.batchSize = 1;
+        }
+        const size_t samples = static_cast<size_t>(dataset.size());
+        const size_t batch = std::min(this->config.batchSize, samples);
+        this->config.batchSize = batch;
+        perEpoch = (this->config.dropLast ? samples / batch : (samples + batch - 1) / batch);
+        totalBatches = this->config.epochs * perEpoch;
+
+        pixels = dataset.imagePixels();
+        stride = statpack::alignedStride<float>(pixels);
+        slotCount = std::clamp<size_t>(this->config.prefetch, 1, perEpoch);
+        slots = std::make_unique<Slot[]>(slotCount);
+        for (size_t i = 0; i < slotCount; ++i) {
+            slots[i].images.assign(batch * stride, 0.0f);
+            slots[i].labels.assign(batch, -1);
+        }
+
+        for (size_t i = 0; i < 2; ++i) {
+            order[i].resize(samples);
+            orderEpoch[i].store(0, std::memory_order_relaxed);
+        }
+        writeOrder(0);
+
+        const size_t threads = std::max<size_t>(this->config.workers, 1);
+        workers.reserve(threads);
+        for (size_t i = 0; i < threads; ++i) {
+            workers.emplace_back(&DataLoader::workerLoop, this);
+        }
+    }
+
+    DataLoader::~DataLoader() {
+        stop();
+    }
+
+    void DataLoader::stop() {
+        stopping.store(true, std::memory_order_release);
+        for (std::thread &worker : workers) {
+            worker.join();
+        }
+        workers.clear();
+    }
+
+    bool DataLoader::next(Batch &batch) {
+        if (slotCount == 0) {
+            return false;
+        }
+        if (holding) {
+            Slot &previous = slots[nextToConsume % slotCount];
+            const uint64_t lap = nextToConsume / slotCount;
+            previous.turn.store(2 * lap + 2, std::memory_order_release);
+            ++nextToConsume;
+            holding = false;
+        }
+        if (totalBatches != 0 && nextToConsume >= totalBatches) {
+            return false;
+        }
+        Slot &slot = slots[nextToConsume % slotCount];
+        const uint64_t lap = nextToConsume / slotCount;
+        if (!waitFor(slot.turn, 2 * lap + 1)) {
+            return false;
+        }
+        holding = true;
+        batch.images = statpack::MatrixView<const float>(slot.images.data(), slot.rows, pixels, stride);
+        batch.labels = (dataset.hasLabels() ? statpack::Span<const int32_t>(slot.labels.data(), slot.rows) : statpack::Span<const int32_t>());
+        batch.epoch = slot.epoch;
+        batch.index = static_cast<size_t>(nextToConsume % perEpoch);
+        return true;
+    }
+
+    void DataLoader::workerLoop() {
+        while (!stopping.load(std::memory_order_acquire)) {
+            const uint64_t sequence = nextToFill.fetch_add(1, std::memory_order_relaxed);
+            if (totalBatches != 0 && sequence >= totalBatches) {
+                return;
+            }
+            Slot &slot = slots[sequence % slotCount];
+            const uint64_t lap = sequence / slotCount;
+            if (!waitFor(slot.turn, 2 * lap)) {
+                return;
+            }
+            const size_t epoch = static_cast<size_t>(sequence / perEpoch);
+            // The slot being free means every batch up to sequence - slotCount
+            // has been consumed, and slotCount <= perEpoch, so nobody still
+            // reads the order of epoch - 2 that shares this buffer.
+            if (epoch > 0 && sequence % perEpoch == 0) {
+                writeOrder(epoch);
+            }
+            if (!waitFor(orderEpoch[epoch % 2], epoch + 1)) {
+                return;
+            }
+            fill(slot, sequence);
+            slot.turn.store(2 * lap + 1, std::memory_order_release);
+        }
+    }
+
+    void DataLoader::fill(Slot &slot, uint64_t sequence) {
+        const size_t epoch = static_cast<size_t>(sequence / perEpoch);
+        const size_t first = static_cast<size_t>(sequence % perEpoch) * config.batchSize;
+        const std::vector<int32_t> &indices = order[epoch % 2];
+        const size_t rows = std::min(config.batchSize, indices.size() - first);
+        MNIST_PROFILE_SCOPE("DataLoader::fill");
+        MNIST_PROFILE_WORK("DataLoader::fill", 0, 2 * rows * pixels, 5 * rows * pixels, rows);
+
+        const statpack::MatrixView<float> images(slot.images.data(), rows, pixels, stride);
+        for (size_t r = 0; r < rows; ++r) {
+            const int32_t nr = indices[first + r];
+            if (config.normalizeImages) {
+                decodePixels(dataset.image(nr).data(), images.row(r), pixels, config.normMin, config.normMax);
+            } else {
+                decodePixels(dataset.image(nr).data(), images.row(r), pixels);
+            }
+            slot.labels[r] = (dataset.hasLabels() ? static_cast<int32_t>(dataset.label(nr)) : -1);
+        }
+        slot.rows = rows;
+        slot.epoch = epoch;
+    }
+
+    void DataLoader::writeOrder(size_t epoch) {
+        std::vector<int32_t> &indices = order[epoch % 2];
+        std::iota(indices.begin(), indices.end(), 0);
+        if (config.shuffle) {
+            std::seed_seq seq{config.seed, static_cast<uint32_t>(epoch)};
+            std::mt19937 engine(seq);
+            std::shuffle(indices.begin(), indices.end(), engine);
+        }
+        orderEpoch[epoch % 2].store(epoch + 1, std::memory_order_release);
+    }
+
+    bool DataLoader::waitFor(const std::atomic<uint64_t> &value, uint64_t expected) const {
+        for (uint32_t spin = 0; value.load(std::memory_order_acquire) != expected; ++spin) {
+            if (stopping.load(std::memory_order_acquire)) {
+                return false;
+            }
+            if (spin < 64) {
+                continue;
+            } else if (spin < 128) {
+                std::this_thread::yield();
+            } else {
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+            }
+        }
+        return true;
+    }
+}
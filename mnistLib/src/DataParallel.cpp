@@ -0,0 +1,88 @@
+#include "DataParallel.h"
+
+#include <algorithm>
+#include <cassert>
+
+#include "Profiler.h"
+
+DataParallel::DataParallel(NeuralNet &net, size_t replicas) :
+        net(net),
+        pool(std::max<size_t>(replicas, 1))
+    {
+#ifdef CUSTOM_DEBUG
+    assert(net.layers.size() >= 2 && !net.layers[0].params.empty() && "Build the net before DataParallel.");
+#endif
+    for (size_t r = 1; r < pool.size(); ++r) {
+        auto copy = std::make_unique<NeuralNet>();
+        for (const auto &layer : net.layers) {
+            copy->addLayer(layer.sizeIn);
+        }
+        copy->activation = net.activation;
+        copy->activationMin = net.activationMin;
+        copy->activationMax = net.activationMax;
+        copy->cost = net.cost;
+        copy->inputMin = net.inputMin;
+        copy->inputMax = net.inputMax;
+        copy->targetMin = net.targetMin;
+        copy->targetMax = net.targetMax;
+        copy->GANLink = net.GANLink;
+        // Replicas only accumulate deltas, so they keep no optimizer state
+        copy->build();
+        copies.push_back(std::move(copy));
+    }
+    broadcast();
+}
+
+void DataParallel::trainBatch(const statpack::MatrixView<const float> &inputs, const statpack::MatrixView<const float> &targets, const bool realData) {
+    MNIST_PROFILE_SCOPE("DataParallel::trainBatch");
+#ifdef CUSTOM_DEBUG
+    assert(inputs.rows == targets.rows && "Input and target matrices have different sample counts.");
+#endif
+    const float batchSize = static_cast<float>(inputs.rows);
+    forEachShard(inputs.rows, [&](NeuralNet &replica, size_t begin, size_t end) {
+        const statpack::MatrixView<const float> shardInputs(inputs.row(begin), end - begin, inputs.cols, inputs.stride);
+        const statpack::MatrixView<const float> shardTargets(targets.row(begin), end - begin, targets.cols, targets.stride);
+        replica.forwardBatch(shardInputs);
+        replica.backwardBatch(shardTargets, realData, batchSize);
+    });
+    applyDeltas();
+}
+
+void DataParallel::reduceDeltas() {
+    MNIST_PROFILE_SCOPE("DataParallel::reduceDeltas");
+    const size_t n = replicas();
+    for (size_t i = 0; i + 1 < net.layers.size(); ++i) {
+        const size_t count = net.layers[i].paramCount();
+        // Every thread runs the whole tree over its own range of the deltas:
+        // replica r takes r + step for step = 1, 2, 4, ... while r % (2 * step) == 0
+        pool.parallelFor(count, [&](size_t begin, size_t end) {
+            for (size_t step = 1; step < n; step *= 2) {
+                for (size_t r = 0; r + step < n; r += 2 * step) {
+                    float *sum = replica(r).layers[i].params.data() + count + begin;
+                    float *other = replica(r + step).layers[i].params.data() + count + begin;
+                    statpack::axpy(sum, other, 1.0f, end - begin);
+                    std::fill(other, other + (end - begin), 0.0f);
+                }
+            }
+        }, statpack::alignedStride<float>(1));
+    }
+}
+
+void DataParallel::applyDeltas() {
+    reduceDeltas();
+    net.applyDeltas();
+    broadcast();
+}
+
+void DataParallel::broadcast() {
+    MNIST_PROFILE_SCOPE("DataParallel::broadcast");
+    for (size_t i = 0; i + 1 < net.layers.size(); ++i) {
+        const size_t count = net.layers[i].paramCount();
+        const float *source = net.layers[i].params.data();
+        pool.parallelFor(count, [&](size_t begin, size_t end) {
+            for (const auto &copy : copies) {
+                std::copy(source + begin, source + end, copy->layers[i].params.data() + begin);
+            }
+        }, statpack::alignedStride<float>(1));
+    }
+}
@@ -0,0 +1,357 @@
+#include "DatasetCache.h"
+
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <filesystem>
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Profiler.h"
+
+namespace mnistParser {
+    namespace {
+        // Images preprocessed per pass while building
+        constexpr const size_t BUILD_CHUNK = 1024;
+
+        constexpr const uint64_t HASH_SEED = 0xCBF29CE484222325ull;
+        constexpr const uint64_t HASH_PRIME = 0x100000001B3ull;
+
+        // FNV-1a over 8-byte words, with the high half folded back in so
+        // every input bit reaches the low bits of the key
+        uint64_t hashBytes(uint64_t hash, const void *data, size_t size) {
+            const uint8_t *bytes = static_cast<const uint8_t*>(data);
+            size_t i = 0;
+            for (; i + 8 <= size; i += 8) {
+                uint64_t word;
+                std::memcpy(&word, bytes + i, sizeof(word));
+                hash = (hash ^ word) * HASH_PRIME;
+                hash ^= hash >> 32;
+            }
+            for (; i < size; ++i) {
+                hash = (hash ^ bytes[i]) * HASH_PRIME;
+            }
+            return hash;
+        }
+
+        template <typename T>
+        uint64_t hashValue(uint64_t hash, const T value) {
+            return hashBytes(hash, &value, sizeof(value));
+        }
+
+        size_t alignUp(size_t bytes) {
+            return (bytes + statpack::BUFFER_ALIGNMENT - 1) / statpack::BUFFER_ALIGNMENT * statpack::BUFFER_ALIGNMENT;
+        }
+
+        size_t elementBytes(DatasetCache::Format format) {
+            return (format == DatasetCache::Format::Float16 ? sizeof(uint16_t) : sizeof(float));
+        }
+
+        size_t rowStride(DatasetCache::Format format, size_t pixels) {
+            return (format == DatasetCache::Format::Float16 ? statpack::alignedStride<uint16_t>(pixels) : statpack::alignedStride<float>(pixels));
+        }
+
+        // IEEE half precision, rounded to nearest even
+        uint16_t toHalf(const float value) {
+            uint32_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            const uint32_t sign = bits & 0x80000000u;
+            bits ^= sign;
+            uint32_t half;
+            if (bits >= 0x47800000u) {
+                // Too large for a half: infinity, or a quiet NaN
+                half = (bits > 0x7F800000u ? 0x7E00u : 0x7C00u);
+            } else if (bits < 0x38800000u) {
+                // Subnormal or zero; adding 0.5 lets the float unit round the mantissa
+                float shifted;
+                std::memcpy(&shifted, &bits, sizeof(shifted));
+                shifted += 0.5f;
+                std::memcpy(&half, &shifted, sizeof(half));
+                half -= 0x3F000000u;
+            } else {
+                const uint32_t odd = (bits >> 13) & 1u;
+                bits += 0xC8000FFFu + odd;
+                half = bits >> 13;
+            }
+            return static_cast<uint16_t>(half | (sign >> 16));
+        }
+
+        // Branch free, so the conversion loop in getImages vectorizes.
+        // Multiplying by 2^112 rebiases the exponent and renormalizes
+        // subnormals in one exact step.
+        float fromHalf(const uint16_t half) {
+            uint32_t bits = static_cast<uint32_t>(half & 0x7FFFu) << 13;
+            float value;
+            std::memcpy(&value, &bits, sizeof(value));
+            value *= 5.192296858534828e+33f;
+            std::memcpy(&bits, &value, sizeof(bits));
+            // Infinity or NaN
+            bits |= (value >= 65536.0f ? 0xFFu << 23 : 0u);
+            bits |= static_cast<uint32_t>(half & 0x8000u) << 16;
+            std::memcpy(&value, &bits, sizeof(value));
+            return value;
+        }
+    }
+
+    DatasetCache::~DatasetCache() {
+        close();
+    }
+
+    uint64_t DatasetCache::key(const Dataset &dataset, const Config &config) {
+        MNIST_PROFILE_SCOPE("DatasetCache::key");
+        uint64_t hash = HASH_SEED;
+        hash = hashValue(hash, VERSION);
+        hash = hashValue(hash, static_cast<uint32_t>(statpack::BUFFER_ALIGNMENT));
+        hash = hashValue(hash, static_cast<uint32_t>(config.format));
+        hash = hashValue(hash, config.normMin);
+        hash = hashValue(hash, config.normMax);
+        const statpack::ImagePipeline::Config &pipeline = config.pipeline;
+        hash = hashValue(hash, pipeline.crop);
+        hash = hashValue(hash, pipeline.widthOut);
+        hash = hashValue(hash, pipeline.heightOut);
+        hash = hashValue(hash, pipeline.downsample);
+        hash = hashValue(hash, pipeline.standardize);
+
+        hash = hashValue(hash, dataset.size());
+        hash = hashValue(hash, dataset.rows());
+        hash = hashValue(hash, dataset.cols());
+        const statpack::Span<const uint8_t> pixels = dataset.images(0, dataset.size());
+        hash = hashBytes(hash, pixels.data(), pixels.size());
+        hash = hashValue(hash, dataset.hasLabels());
+        if (dataset.hasLabels()) {
+            const statpack::Span<const uint8_t> labels = dataset.labels(0, dataset.size());
+            hash = hashBytes(hash, labels.data(), labels.size());
+        }
+        return hash;
+    }
+
+    std::string DatasetCache::fileName(uint64_t key) {
+        std::ostringstream name;
+        name << "mnist-" << std::hex << std::setw(16) << std::setfill('0') << key << ".cache";
+        return name.str();
+    }
+
+    bool DatasetCache::open(const Dataset &dataset, const Config &config, const std::string &directory, ThreadPool *pool) {
+        MNIST_PROFILE_SCOPE("DatasetCache::open");
+        close();
+        if (!dataset.isOpen()) {
+            std::cout << "DatasetCache: the dataset is not open.\n";
+            return false;
+        }
+        const uint64_t cacheKey = key(dataset, config);
+        std::error_code error;
+        std::filesystem::create_directories(directory, error);
+        const std::string path = (std::filesystem::path(directory) / fileName(cacheKey)).string();
+
+        if (std::filesystem::exists(path, error) && map(path, cacheKey)) {
+            return true;
+        }
+        if (!build(dataset, config, cacheKey, path, pool) || !map(path, cacheKey)) {
+            return false;
+        }
+        wasBuilt = true;
+        return true;
+    }
+
+    void DatasetCache::close() {
+        if (mapping) {
+            munmap(mapping, mappedSize);
+        }
+        mapping = nullptr;
+        mappedSize = 0;
+        header = {};
+        filePath.clear();
+        wasBuilt = false;
+    }
+
+    bool DatasetCache::map(const std::string &path, uint64_t expectedKey) {
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            std::cout << "Could not open dataset cache " << path << "\n";
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(Header)) {
+            std::cout << path << " is too small to be a dataset cache!\n";
+            ::close(fd);
+            return false;
+        }
+        const size_t fileSize = static_cast<size_t>(info.st_size);
+        void *mapped = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED) {
+            std::cout << "Could not map dataset cache " << path << "\n";
+            return false;
+        }
+
+        Header read;
+        std::memcpy(&read, mapped, sizeof(read));
+        const Format format = static_cast<Format>(read.format);
+        const bool known = (format == Format::Float32 || format == Format::Float16);
+        const size_t pixels = static_cast<size_t>(read.width) * read.height;
+        const size_t labelBytes = (read.hasLabels ? static_cast<size_t>(read.count) * sizeof(int32_t) : 0);
+        if (read.magic != MAGIC || read.version != VERSION || read.key != expectedKey || !known) {
+            std::cout << path << " is not a dataset cache of this version and configuration!\n";
+            munmap(mapped, fileSize);
+            return false;
+        }
+        if (read.fileSize != fileSize || read.stride != rowStride(format, pixels)
+            || read.imageOffset != alignUp(sizeof(Header)) + alignUp(labelBytes)
+            || read.imageOffset + read.count * read.stride * elementBytes(format) != fileSize) {
+            std::cout << path << " has a header that does not match its length!\n";
+            munmap(mapped, fileSize);
+            return false;
+        }
+        mapping = mapped;
+        mappedSize = fileSize;
+        header = read;
+        filePath = path;
+        madvise(mapping, mappedSize, MADV_WILLNEED);
+        return true;
+    }
+
+    bool DatasetCache::build(const Dataset &dataset, const Config &config, uint64_t key, const std::string &path, ThreadPool *pool) {
+        MNIST_PROFILE_SCOPE("DatasetCache::build");
+        statpack::ImagePipeline::Config pipelineConfig = config.pipeline;
+        pipelineConfig.widthIn = dataset.cols();
+        pipelineConfig.heightIn = dataset.rows();
+        // Blank pixels decode to normMin, which is what the crop trims
+        pipelineConfig.background = config.normMin;
+        const statpack::ImagePipeline pipeline(pipelineConfig);
+        const size_t count = static_cast<size_t>(dataset.size());
+        const size_t pixelsIn = dataset.imagePixels();
+        const size_t pixelsOut = pipeline.outputSize();
+
+        Header out = {};
+        out.magic = MAGIC;
+        out.version = VERSION;
+        out.key = key;
+        out.format = static_cast<uint32_t>(config.format);
+        out.hasLabels = (dataset.hasLabels() ? 1 : 0);
+        out.count = count;
+        out.width = static_cast<uint32_t>(pipeline.outputWidth());
+        out.height = static_cast<uint32_t>(pipeline.outputHeight());
+        out.stride = rowStride(config.format, pixelsOut);
+        const size_t labelBytes = (dataset.hasLabels() ? count * sizeof(int32_t) : 0);
+        out.imageOffset = alignUp(sizeof(Header)) + alignUp(labelBytes);
+        const size_t rowBytes = static_cast<size_t>(out.stride) * elementBytes(config.format);
+        out.fileSize = out.imageOffset + count * rowBytes;
+
+        // A file of this build's own, so runs building the same key at once
+        // never write into each other's. Each renames a complete file.
+        std::string tmpPath = path + ".XXXXXX";
+        const int tmpFd = mkstemp(tmpPath.data());
+        if (tmpFd < 0) {
+            std::cout << "Could not create a temporary file next to " << path << "\n";
+            return false;
+        }
+        fchmod(tmpFd, 0644);
+        ::close(tmpFd);
+        std::ofstream stream(tmpPath, std::ios::binary | std::ios::trunc);
+        std::vector<char> padding(statpack::BUFFER_ALIGNMENT, 0);
+        stream.write(reinterpret_cast<const char*>(&out), sizeof(out));
+        stream.write(padding.data(), static_cast<std::streamsize>(alignUp(sizeof(Header)) - sizeof(Header)));
+        if (dataset.hasLabels()) {
+            std::vector<int32_t> labels(count);
+            const statpack::Span<const uint8_t> raw = dataset.labels(0, dataset.size());
+            std::copy(raw.begin(), raw.end(), labels.begin());
+            stream.write(reinterpret_cast<const char*>(labels.data()), static_cast<std::streamsize>(labelBytes));
+            stream.write(padding.data(), static_cast<std::streamsize>(alignUp(labelBytes) - labelBytes));
+        }
+
+        // Padding between rows stays 0 in both buffers
+        const size_t strideIn = statpack::alignedStride<float>(pixelsIn);
+        const size_t strideOut = statpack::alignedStride<float>(pixelsOut);
+        statpack::AlignedVector<float> decoded(BUILD_CHUNK * strideIn, 0.0f);
+        statpack::AlignedVector<float> processed(BUILD_CHUNK * strideOut, 0.0f);
+        statpack::AlignedVector<uint16_t> halves;
+        if (config.format == Format::Float16) {
+            halves.assign(BUILD_CHUNK * out.stride, 0);
+        }
+        for (size_t first = 0; first < count; first += BUILD_CHUNK) {
+            const size_t rows = std::min(BUILD_CHUNK, count - first);
+            const statpack::MatrixView<float> in(decoded.data(), rows, pixelsIn, strideIn);
+            const statpack::MatrixView<float> result(processed.data(), rows, pixelsOut, strideOut);
+            dataset.decodeImages(static_cast<int32_t>(first), static_cast<int32_t>(rows), in, config.normMin, config.normMax);
+            pipeline.run(in, result, pool);
+            if (config.format == Format::Float16) {
+                for (size_t r = 0; r < rows; ++r) {
+                    const float *row = result.row(r);
+                    uint16_t *halfRow = halves.data() + r * out.stride;
+                    for (size_t i = 0; i < pixelsOut; ++i) {
+                        halfRow[i] = toHalf(row[i]);
+                    }
+                }
+                stream.write(reinterpret_cast<const char*>(halves.data()), static_cast<std::streamsize>(rows * rowBytes));
+            } else {
+                stream.write(reinterpret_cast<const char*>(processed.data()), static_cast<std::streamsize>(rows * rowBytes));
+            }
+        }
+        stream.close();
+        if (!stream) {
+            std::cout << "Could not write dataset cache " << tmpPath << "\n";
+            std::remove(tmpPath.c_str());
+            return false;
+        }
+        if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+            std::cout << "Could not move dataset cache to " << path << "\n";
+            std::remove(tmpPath.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    statpack::MatrixView<const float> DatasetCache::images() const {
+        if (!mapping || format() != Format::Float32) {
+            return {};
+        }
+        const float *data = reinterpret_cast<const float*>(static_cast<const uint8_t*>(mapping) + header.imageOffset);
+        return statpack::MatrixView<const float>(data, size(), imagePixels(), static_cast<size_t>(header.stride));
+    }
+
+    bool DatasetCache::getImages(size_t first, size_t count, statpack::MatrixView<float> out) const {
+        if (!mapping || first > size() || count > size() - first) {
+            std::cout << "Cached images " << first << ".." << first + count << " are out of range!\n";
+            return false;
+        }
+#ifdef CUSTOM_DEBUG
+        assert(out.rows >= count && out.cols >= imagePixels() && "Output matrix too small.");
+#endif
+        const size_t pixels = imagePixels();
+        const uint8_t *base = static_cast<const uint8_t*>(mapping) + header.imageOffset;
+        if (format() == Format::Float32) {
+            const float *rows = reinterpret_cast<const float*>(base) + first * header.stride;
+            for (size_t r = 0; r < count; ++r) {
+                std::copy(rows + r * header.stride, rows + r * header.stride + pixels, out.row(r));
+            }
+            return true;
+        }
+        const uint16_t *rows = reinterpret_cast<const uint16_t*>(base) + first * header.stride;
+        for (size_t r = 0; r < count; ++r) {
+            const uint16_t *row = rows + r * header.stride;
+            float *outRow = out.row(r);
+            for (size_t i = 0; i < pixels; ++i) {
+                outRow[i] = fromHalf(row[i]);
+            }
+        }
+        return true;
+    }
+
+    statpack::Span<const int32_t> DatasetCache::labels() const {
+        if (!mapping || !hasLabels()) {
+            return {};
+        }
+        const int32_t *data = reinterpret_cast<const int32_t*>(static_cast<const uint8_t*>(mapping) + alignUp(sizeof(Header)));
+        return statpack::Span<const int32_t>(data, size());
+    }
+}
@@ -0,0 +1,90 @@
+#include "GAN.h"
+
+#include <algorithm>
+
+void GAN::build() {
+#ifdef CUSTOM_DEBUG
+    assert(generator.layers.size() >= 2 && discriminator.layers.size() >= 2 && "Both nets need their layers before GAN::build.");
+    assert(generator.layers.back().sizeIn == discriminator.layers[0].sizeIn && "Generator output and discriminator input sizes differ.");
+#endif
+    generator.GANLink = nullptr;
+    generator.build();
+    discriminator.build();
+    fakeProbability.resize(discriminator.layers.back().sizeIn);
+    realProbability.resize(discriminator.layers.back().sizeIn);
+    outputTerms.resize(discriminator.layers.back().sizeIn);
+    generatorGradient.resize(discriminator.layers[0].sizeIn);
+}
+
+void GAN::fakeStep(const float *noise, const float batchSize) {
+    std::vector<float> &noiseNodes = generator.layers[0].nodes;
+    std::copy(noise, noise + noiseNodes.size(), noiseNodes.begin());
+    generator.forwardPropagate(noiseNodes);
+
+    // The generator output becomes the discriminator input without a copy out
+    const std::vector<float> &fake = generator.layers.back().nodes;
+    std::vector<float> &fakeNodes = discriminator.layers[0].nodes;
+    for (size_t k = 0; k < fake.size(); ++k) {
+        fakeNodes[k] = statpack::normalize(fake[k], generator.activationMin, generator.activationMax, generator.targetMin, generator.targetMax);
+    }
+    discriminator.forwardPropagate(fakeNodes);
+    const std::vector<float> &probability = discriminator.layers.back().nodes;
+    for (size_t k = 0; k < probability.size(); ++k) {
+        fakeProbability[k] = statpack::normalize(probability[k], discriminator.activationMin, discriminator.activationMax, discriminator.targetMin, discriminator.targetMax);
+    }
+
+    // Generator cost derivative at the discriminator output, carried back
+    // to the generator output through the discriminator's current weights
+    std::fill(outputTerms.begin(), outputTerms.end(), 1.0f);
+    generator.applyDCost(fakeProbability.data(), 1, fakeProbability.data(), outputTerms.data(), outputTerms.size(), false);
+    discriminator.inputGradient(outputTerms.data(), generatorGradient.data());
+
+    discriminator.backPropagate(fakeProbability, batchSize, false);
+    generator.backPropagateGradient(generatorGradient.data(), batchSize);
+}
+
+void GAN::realStep(const float *sample, const float batchSize) {
+    std::vector<float> &realNodes = discriminator.layers[0].nodes;
+    std::copy(sample, sample + realNodes.size(), realNodes.begin());
+    discriminator.forwardPropagate(realNodes);
+    const std::vector<float> &probability = discriminator.layers.back().nodes;
+    for (size_t k = 0; k < probability.size(); ++k) {
+        realProbability[k] = statpack::normalize(probability[k], discriminator.activationMin, discriminator.activationMax, discriminator.targetMin, discriminator.targetMax);
+    }
+    discriminator.backPropagate(realProbability, batchSize, true);
+}
+
+void GAN::score(const statpack::MatrixView<const float> &noise, const statpack::MatrixView<float> &scores, NeuralNet::Context &generatorContext, NeuralNet::Context &discriminatorContext) const {
+#ifdef CUSTOM_DEBUG
+    assert(scores.rows == noise.rows && scores.cols == discriminator.outputSize() && "Score matrix has an incorrect shape.");
+#endif
+    generator.forward(generatorContext, noise);
+    // Same scaling as fakeStep, in place
+    const statpack::MatrixView<float> &samples = generatorContext.nodes.back();
+    for (size_t s = 0; s < samples.rows; ++s) {
+        float *row = samples.row(s);
+        for (size_t k = 0; k < samples.cols; ++k) {
+            row[k] = statpack::normalize(row[k], generator.activationMin, generator.activationMax, generator.targetMin, generator.targetMax);
+        }
+    }
+    discriminator.forward(discriminatorContext, samples);
+    const statpack::MatrixView<const float> probability = discriminatorContext.outputs();
+    for (size_t s = 0; s < probability.rows; ++s) {
+        for (size_t k = 0; k < probability.cols; ++k) {
+            scores.row(s)[k] = statpack::normalize(probability.row(s)[k], discriminator.activationMin, discriminator.activationMax, discriminator.targetMin, discriminator.targetMax);
+        }
+    }
+}
+
+void GAN::applyDeltas() {
+    discriminator.applyDeltas();
+    generator.applyDeltas();
+}
+
+float GAN::generatorLoss() const {
+    return generator.costFunction(fakeProbability, {}, false);
+}
+
+float GAN::discriminatorLoss() const {
+    return discriminator.costFunction(fakeProbability, {}, false);
+}
@@ -0,0 +1,175 @@
+#include "ImagePipeline.h"
+
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+
+#include "statpack.h"
+#include "Profiler.h"
+
+namespace statpack {
+    ImagePipeline::ImagePipeline(const Config &config) : settings(config) {
+#ifdef CUSTOM_DEBUG
+        assert(config.widthIn > 0 && config.heightIn > 0 && config.widthOut > 0 && config.heightOut > 0 && "Image sizes must be positive.");
+        assert((!config.downsample || (config.widthOut % 2 == 0 && config.heightOut % 2 == 0)) && "Downsampling needs an even image size.");
+#endif
+        // A crop can leave any size up to the input, otherwise only the input size is used
+        for (int w = 1; w <= settings.widthIn; ++w) {
+            columnTables.push_back((settings.crop || w == settings.widthIn) ? resampleIndices(w, settings.widthOut) : std::vector<int>());
+        }
+        for (int h = 1; h <= settings.heightIn; ++h) {
+            rowTables.push_back((settings.crop || h == settings.heightIn) ? resampleIndices(h, settings.heightOut) : std::vector<int>());
+        }
+        ones.assign(alignedStride<float>(outputSize()), 1.0f);
+    }
+
+    int ImagePipeline::outputWidth() const {
+        return (settings.downsample ? settings.widthOut / 2 : settings.widthOut);
+    }
+
+    int ImagePipeline::outputHeight() const {
+        return (settings.downsample ? settings.heightOut / 2 : settings.heightOut);
+    }
+
+    size_t ImagePipeline::outputSize() const {
+        return static_cast<size_t>(outputWidth()) * static_cast<size_t>(outputHeight());
+    }
+
+    void ImagePipeline::run(const MatrixView<const float> &in, const MatrixView<float> &out, ThreadPool *pool) const {
+        MNIST_PROFILE_SCOPE("ImagePipeline::run");
+        MNIST_PROFILE_WORK("ImagePipeline::run", 0, 0, in.rows * (in.cols + outputSize()) * sizeof(float), in.rows);
+#ifdef CUSTOM_DEBUG
+        assert(in.cols == static_cast<size_t>(settings.widthIn * settings.heightIn) && "Input rows are not widthIn * heightIn.");
+        assert(out.rows >= in.rows && out.cols >= outputSize() && "Output matrix is too small.");
+#endif
+        const auto images = [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                process(in.row(i), out.row(i));
+            }
+        };
+        if (pool) {
+            pool->parallelFor(in.rows, images);
+        } else {
+            images(0, in.rows);
+        }
+    }
+
+    void ImagePipeline::process(const float *image, float *out) const {
+        const int width = settings.widthIn;
+        const int height = settings.heightIn;
+        int xMin = 0;
+        int yMin = 0;
+        int xEnd = width;
+        int yEnd = height;
+        const float background = settings.background;
+        if (settings.crop) {
+            // Bounding box of the non-background pixels. Rows are scanned from both
+            // ends, so a digit in the middle only reads up to its edges.
+            int xLast = -1;
+            int yLast = -1;
+            int x0 = width;
+            int y0 = height;
+            for (int row = 0; row < height; ++row) {
+                const float *pixels = image + row * width;
+                int first = 0;
+                while (first < width && pixels[first] == background) {
+                    ++first;
+                }
+                if (first == width) {
+                    continue;
+                }
+                int last = width - 1;
+                while (pixels[last] == background) {
+                    --last;
+                }
+                x0 = std::min(x0, first);
+                xLast = std::max(xLast, last);
+                y0 = std::min(y0, row);
+                yLast = row;
+            }
+            // A blank image is rescaled whole; cropBlackBackground has no box for it
+            if (yLast >= 0) {
+                // Same exclusive ends as cropBlackBackground, which drops a
+                // box edge lying on the image border
+                xMin = x0;
+                yMin = y0;
+                xEnd = (xLast < width - 1 ? xLast + 1 : xLast);
+                yEnd = (yLast < height - 1 ? yLast + 1 : yLast);
+                // A box of one pixel on the border crops to nothing
+                if (xEnd <= xMin || yEnd <= yMin) {
+                    xMin = 0;
+                    yMin = 0;
+                    xEnd = width;
+                    yEnd = height;
+                }
+            }
+        }
+        const int *cols = columnTables[static_cast<size_t>(xEnd - xMin - 1)].data();
+        const int *rows = rowTables[static_cast<size_t>(yEnd - yMin - 1)].data();
+        const float *origin = image + yMin * width + xMin;
+
+        const int widthOut = outputWidth();
+        const int heightOut = outputHeight();
+        if (!settings.downsample) {
+            resample(origin, width, rows, cols, out, widthOut, heightOut, background);
+        } else {
+            // The rescaled image is gathered on the fly and never stored. A
+            // rescale of scale 1 maps every column to itself, which leaves
+            // contiguous loads the compiler vectorizes.
+            const bool sameWidth = (xEnd - xMin == settings.widthOut);
+            for (int row = 0; row < heightOut; ++row) {
+                float *outRow = out + row * widthOut;
+                const int top = rows[2 * row];
+                const int bottom = rows[2 * row + 1];
+                if (top < 0 || bottom < 0) {
+                    // Rows no source pixel lands on hold the background
+                    const float *upperLine = (top < 0 ? nullptr : origin + top * width);
+                    const float *lowerLine = (bottom < 0 ? nullptr : origin + bottom * width);
+                    const auto at = [&](const float *line, int col) {
+                        return (line && col >= 0 ? line[col] : background);
+                    };
+                    for (int col = 0; col < widthOut; ++col) {
+                        outRow[col] = (at(upperLine, cols[2 * col]) + at(upperLine, cols[2 * col + 1])
+                                     + at(lowerLine, cols[2 * col]) + at(lowerLine, cols[2 * col + 1])) / 4;
+                    }
+                    continue;
+                }
+                const float *upper = origin + top * width;
+                const float *lower = origin + bottom * width;
+                // Same sum order as rescaleMnistToHalf
+                if (sameWidth) {
+                    for (int col = 0; col < widthOut; ++col) {
+                        outRow[col] = (upper[2 * col] + upper[2 * col + 1] + lower[2 * col] + lower[2 * col + 1]) / 4;
+                    }
+                } else {
+                    for (int col = 0; col < widthOut; ++col) {
+                        const int left = cols[2 * col];
+                        const int right = cols[2 * col + 1];
+                        const float a = (left < 0 ? background : upper[left]);
+                        const float b = (right < 0 ? background : upper[right]);
+                        const float c = (left < 0 ? background : lower[left]);
+                        const float d = (right < 0 ? background : lower[right]);
+                        outRow[col] = (a + b + c + d) / 4;
+                    }
+                }
+            }
+        }
+
+        if (settings.standardize) {
+            const size_t size = outputSize();
+            const float count = static_cast<float>(size);
+            const float mean = kernels::dot(out, ones.data(), size) / count;
+            for (size_t i = 0; i < size; ++i) {
+                out[i] -= mean;
+            }
+            const float variance = kernels::dot(out, out, size) / count;
+            // A flat image stays all zeros
+            if (variance > 0) {
+                const float scale = 1.0f / std::sqrt(variance);
+                for (size_t i = 0; i < size; ++i) {
+                    out[i] *= scale;
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,428 @@
+#include "InferenceServer.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+    uint64_t nowNs() {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    // Reads exactly bytes bytes; false on end of stream or error
+    bool readFull(int fd, void *out, size_t bytes) {
+        uint8_t *dst = static_cast<uint8_t*>(out);
+        while (bytes > 0) {
+            const ssize_t n = ::recv(fd, dst, bytes, 0);
+            if (n > 0) {
+                dst += n;
+                bytes -= static_cast<size_t>(n);
+            } else if (n == 0 || errno != EINTR) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Never raises SIGPIPE on a closed peer
+    bool writeFull(int fd, const void *data, size_t bytes) {
+        const uint8_t *src = static_cast<const uint8_t*>(data);
+        while (bytes > 0) {
+            const ssize_t n = ::send(fd, src, bytes, MSG_NOSIGNAL);
+            if (n > 0) {
+                src += n;
+                bytes -= static_cast<size_t>(n);
+            } else if (n == 0 || errno != EINTR) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool socketAddress(const std::string &path, sockaddr_un &address) {
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+            std::cout << "Socket path " << path << " is empty or too long\n";
+            return false;
+        }
+        std::memcpy(address.sun_path, path.c_str(), path.size());
+        return true;
+    }
+}
+
+statpack::MatrixView<const float> InferenceServer::Layer::weights() const {
+    return statpack::MatrixView<const float>(weightsT.data(), sizeIn, sizeOut, statpack::alignedStride<float>(sizeOut));
+}
+
+InferenceServer::~InferenceServer() {
+    stop();
+}
+
+bool InferenceServer::start(const NeuralNet &net) {
+    return start(net, Config());
+}
+
+bool InferenceServer::start(const NeuralNet &net, const Config &config) {
+    if (running) {
+        std::cout << "Inference server is already running\n";
+        return false;
+    }
+    if (net.layers.size() < 2 || net.layers[0].params.empty()) {
+        std::cout << "Inference server needs a built net\n";
+        return false;
+    }
+    settings = config;
+    settings.maxBatch = std::max<size_t>(settings.maxBatch, 1);
+    settings.workers = std::max<size_t>(settings.workers, 1);
+    settings.latencyWindow = std::max<size_t>(settings.latencyWindow, 1);
+    activation = net.activation;
+    activationMin = net.activationMin;
+    activationMax = net.activationMax;
+    targetMin = net.targetMin;
+    targetMax = net.targetMax;
+
+    layers.clear();
+    layers.resize(net.layers.size() - 1);
+    for (size_t i = 0; i < layers.size(); ++i) {
+        const NeuralNet::Layer &source = net.layers[i];
+        Layer &layer = layers[i];
+        layer.sizeIn = source.sizeIn;
+        layer.sizeOut = source.sizeOut;
+        const size_t stride = statpack::alignedStride<float>(layer.sizeOut);
+        layer.weightsT.assign(layer.sizeIn * stride, 0.0f);
+        statpack::transpose<float>(source.weights, statpack::MatrixView<float>(layer.weightsT.data(), layer.sizeIn, layer.sizeOut, stride));
+        layer.biases.assign(source.biases.begin(), source.biases.end());
+    }
+
+    stopping = false;
+    resetStats();
+    running = true;
+    for (size_t i = 0; i < settings.workers; ++i) {
+        workers.emplace_back(&InferenceServer::workerLoop, this);
+    }
+    return true;
+}
+
+void InferenceServer::stop() {
+    if (!running) {
+        return;
+    }
+    if (listenFd >= 0) {
+        // Wakes the acceptor out of accept()
+        ::shutdown(listenFd, SHUT_RDWR);
+        acceptor.join();
+        ::close(listenFd);
+        ::unlink(socketPath.c_str());
+        listenFd = -1;
+        socketPath.clear();
+    }
+    {
+        std::lock_guard<std::mutex> lock(clientsMutex);
+        for (auto &client : clients) {
+            if (client->fd >= 0) {
+                ::shutdown(client->fd, SHUT_RDWR);
+            }
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        for (Request *request : queue) {
+            request->failed = true;
+            request->done = true;
+        }
+        queue.clear();
+    }
+    queued.notify_all();
+    finished.notify_all();
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    workers.clear();
+    for (auto &client : clients) {
+        client->thread.join();
+    }
+    clients.clear();
+    running = false;
+}
+
+bool InferenceServer::generate(statpack::Span<const float> inputs, statpack::Span<float> outputs) {
+    if (!running || inputs.size() != inputSize() || outputs.size() < outputSize()) {
+        return false;
+    }
+    Request request{inputs.data(), outputs.data(), nowNs()};
+    std::unique_lock<std::mutex> lock(mutex);
+    if (stopping) {
+        return false;
+    }
+    queue.push_back(&request);
+    // Workers only care about a new oldest request or a full batch
+    if (queue.size() == 1 || queue.size() >= settings.maxBatch) {
+        queued.notify_all();
+    }
+    finished.wait(lock, [&] { return request.done; });
+    return !request.failed;
+}
+
+size_t InferenceServer::inputSize() const {
+    return (layers.empty() ? 0 : layers.front().sizeIn);
+}
+
+size_t InferenceServer::outputSize() const {
+    return (layers.empty() ? 0 : layers.back().sizeOut);
+}
+
+void InferenceServer::workerLoop() {
+    Scratch scratch;
+    for (const Layer &layer : layers) {
+        scratch.stride = std::max({ scratch.stride, statpack::alignedStride<float>(layer.sizeIn), statpack::alignedStride<float>(layer.sizeOut) });
+    }
+    for (auto &buffer : scratch.buffers) {
+        buffer.assign(settings.maxBatch * scratch.stride, 0.0f);
+    }
+    std::vector<Request*> batch;
+    batch.reserve(settings.maxBatch);
+
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            queued.wait(lock, [&] { return !queue.empty() || stopping; });
+            if (stopping) {
+                return;
+            }
+            const std::chrono::steady_clock::time_point deadline(std::chrono::nanoseconds(queue.front()->enqueued) + std::chrono::microseconds(settings.maxDelayUs));
+            queued.wait_until(lock, deadline, [&] { return queue.size() >= settings.maxBatch || stopping; });
+            if (stopping) {
+                return;
+            }
+            // Another worker may have taken the batch meanwhile
+            if (queue.empty()) {
+                continue;
+            }
+            const size_t rows = std::min(queue.size(), settings.maxBatch);
+            batch.assign(queue.begin(), queue.begin() + static_cast<std::ptrdiff_t>(rows));
+            queue.erase(queue.begin(), queue.begin() + static_cast<std::ptrdiff_t>(rows));
+        }
+
+        const size_t inputs = inputSize();
+        for (size_t s = 0; s < batch.size(); ++s) {
+            std::copy(batch[s]->inputs, batch[s]->inputs + inputs, scratch.buffers[0].data() + s * scratch.stride);
+        }
+        const statpack::MatrixView<const float> outputs = forward(scratch, batch.size());
+        for (size_t s = 0; s < batch.size(); ++s) {
+            const float *row = outputs.row(s);
+            for (size_t k = 0; k < outputs.cols; ++k) {
+                batch[s]->outputs[k] = statpack::normalize(row[k], activationMin, activationMax, targetMin, targetMax);
+            }
+        }
+        record(batch.data(), batch.size(), nowNs());
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (Request *request : batch) {
+                request->done = true;
+            }
+        }
+        finished.notify_all();
+    }
+}
+
+statpack::MatrixView<const float> InferenceServer::forward(Scratch &scratch, size_t rows) const {
+    MNIST_PROFILE_SCOPE("inference batch");
+    MNIST_PROFILE_WORK("inference batch", 0, 0, 0, rows);
+    for (size_t i = 0; i < layers.size(); ++i) {
+        const Layer &layer = layers[i];
+        const statpack::MatrixView<const float> in(scratch.buffers[i % 2].data(), rows, layer.sizeIn, scratch.stride);
+        const statpack::MatrixView<float> out(scratch.buffers[(i + 1) % 2].data(), rows, layer.sizeOut, scratch.stride);
+        for (size_t s = 0; s < rows; ++s) {
+            std::fill(out.row(s), out.row(s) + layer.sizeOut, 0.0f);
+        }
+        statpack::gemmAccumulate<float>(out, in, layer.weights());
+        for (size_t s = 0; s < rows; ++s) {
+            float *row = out.row(s);
+            for (size_t k = 0; k < layer.sizeOut; ++k) {
+                row[k] += layer.biases[k];
+            }
+            NeuralNet::activate(activation, row, row, layer.sizeOut);
+        }
+    }
+    return statpack::MatrixView<const float>(scratch.buffers[layers.size() % 2].data(), rows, outputSize(), scratch.stride);
+}
+
+void InferenceServer::record(const Request *const *batch, size_t rows, uint64_t now) {
+    std::lock_guard<std::mutex> lock(statsMutex);
+    for (size_t s = 0; s < rows; ++s) {
+        const uint64_t us = (now - batch[s]->enqueued) / 1000;
+        const uint32_t latency = static_cast<uint32_t>(std::min<uint64_t>(us, UINT32_MAX));
+        if (latencies.size() < settings.latencyWindow) {
+            latencies.push_back(latency);
+        } else {
+            latencies[latencyNext] = latency;
+        }
+        latencyNext = (latencyNext + 1) % settings.latencyWindow;
+    }
+    requestCount += rows;
+    ++batchCount;
+}
+
+InferenceServer::Stats InferenceServer::stats() const {
+    Stats out;
+    std::vector<uint32_t> sorted;
+    uint64_t epoch;
+    {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        out.requests = requestCount;
+        out.batches = batchCount;
+        sorted = latencies;
+        epoch = statsEpoch;
+    }
+    if (out.batches > 0) {
+        out.meanBatch = static_cast<float>(out.requests) / static_cast<float>(out.batches);
+    }
+    if (!sorted.empty()) {
+        const auto percentile = [&](double p) {
+            const size_t index = std::min(sorted.size() - 1, static_cast<size_t>(p * static_cast<double>(sorted.size())));
+            std::nth_element(sorted.begin(), sorted.begin() + static_cast<std::ptrdiff_t>(index), sorted.end());
+            return static_cast<float>(sorted[index]);
+        };
+        out.p50Us = percentile(0.5);
+        out.p99Us = percentile(0.99);
+        out.maxUs = static_cast<float>(*std::max_element(sorted.begin(), sorted.end()));
+    }
+    const double seconds = static_cast<double>(nowNs() - epoch) * 1e-9;
+    if (seconds > 0) {
+        out.throughput = static_cast<float>(static_cast<double>(out.requests) / seconds);
+    }
+    return out;
+}
+
+void InferenceServer::resetStats() {
+    std::lock_guard<std::mutex> lock(statsMutex);
+    latencies.clear();
+    latencies.reserve(settings.latencyWindow);
+    latencyNext = 0;
+    requestCount = 0;
+    batchCount = 0;
+    statsEpoch = nowNs();
+}
+
+bool InferenceServer::listen(const std::string &path) {
+    if (!running || listenFd >= 0) {
+        std::cout << "Inference server must be running and not yet listening\n";
+        return false;
+    }
+    sockaddr_un address;
+    if (!socketAddress(path, address)) {
+        return false;
+    }
+    const int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        std::cout << "Could not create a socket: " << std::strerror(errno) << "\n";
+        return false;
+    }
+    ::unlink(path.c_str());
+    if (::bind(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 || ::listen(fd, SOMAXCONN) != 0) {
+        std::cout << "Could not listen on " << path << ": " << std::strerror(errno) << "\n";
+        ::close(fd);
+        return false;
+    }
+    listenFd = fd;
+    socketPath = path;
+    acceptor = std::thread(&InferenceServer::acceptLoop, this);
+    return true;
+}
+
+void InferenceServer::acceptLoop() {
+    while (true) {
+        const int fd = ::accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            // Shut down by stop()
+            return;
+        }
+        std::lock_guard<std::mutex> lock(clientsMutex);
+        // Reaps clients that hung up, so a long-lived server keeps no dead threads
+        for (auto &client : clients) {
+            if (client->finished) {
+                client->thread.join();
+                client.reset();
+            }
+        }
+        clients.erase(std::remove(clients.begin(), clients.end(), nullptr), clients.end());
+        clients.push_back(std::make_unique<Client>());
+        Client *client = clients.back().get();
+        client->fd = fd;
+        client->thread = std::thread(&InferenceServer::serveClient, this, client);
+    }
+}
+
+void InferenceServer::serveClient(Client *client) {
+    const int fd = client->fd;
+    const uint32_t sizes[2] = { static_cast<uint32_t>(inputSize()), static_cast<uint32_t>(outputSize()) };
+    std::vector<float> inputs(inputSize());
+    std::vector<float> outputs(outputSize());
+    if (writeFull(fd, sizes, sizeof(sizes))) {
+        while (readFull(fd, inputs.data(), inputs.size() * sizeof(float))) {
+            if (!generate(statpack::Span<const float>(inputs.data(), inputs.size()), statpack::Span<float>(outputs.data(), outputs.size()))
+                || !writeFull(fd, outputs.data(), outputs.size() * sizeof(float))) {
+                break;
+            }
+        }
+    }
+    std::lock_guard<std::mutex> lock(clientsMutex);
+    ::close(fd);
+    client->fd = -1;
+    client->finished = true;
+}
+
+InferenceClient::~InferenceClient() {
+    close();
+}
+
+bool InferenceClient::connect(const std::string &path) {
+    close();
+    sockaddr_un address;
+    if (!socketAddress(path, address)) {
+        return false;
+    }
+    fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        std::cout << "Could not create a socket: " << std::strerror(errno) << "\n";
+        return false;
+    }
+    uint32_t sizes[2];
+    if (::connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 || !readFull(fd, sizes, sizeof(sizes))) {
+        std::cout << "Could not connect to " << path << ": " << std::strerror(errno) << "\n";
+        close();
+        return false;
+    }
+    sizeIn = sizes[0];
+    sizeOut = sizes[1];
+    return true;
+}
+
+void InferenceClient::close() {
+    if (fd >= 0) {
+        ::close(fd);
+    }
+    fd = -1;
+    sizeIn = 0;
+    sizeOut = 0;
+}
+
+bool InferenceClient::generate(statpack::Span<const float> inputs, statpack::Span<float> outputs) {
+    if (fd < 0 || inputs.size() != sizeIn || outputs.size() < sizeOut) {
+        return false;
+    }
+    return writeFull(fd, inputs.data(), sizeIn * sizeof(float)) && readFull(fd, outputs.data(), sizeOut * sizeof(float));
+}
@@ -0,0 +1,134 @@
+#include "Metrics.h"
+
+#include <algorithm>
+#include <iostream>
+#include <cstdint>
+
+MetricsSink::MetricsSink(size_t blockRows, size_t ringBlocks) :
+        blockRows(std::max<size_t>(blockRows, 1)),
+        ringBlocks(std::max<size_t>(ringBlocks, 2)) {
+    writer = std::thread(&MetricsSink::writerLoop, this);
+}
+
+MetricsSink::~MetricsSink() {
+    flush();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    writer.join();
+}
+
+size_t MetricsSink::addSeries(const std::string &path, const std::vector<std::string> &columns, size_t interval) {
+    std::unique_ptr<Series> s = std::make_unique<Series>();
+    s->stream.open(path, std::ios::binary | std::ios::trunc);
+    if (!s->stream.is_open()) {
+        std::cout << "Could not open metrics file " << path << "\n";
+        return SIZE_MAX;
+    }
+    s->columnCount = columns.size();
+    s->interval = std::max<size_t>(interval, 1);
+    s->ring.resize(ringBlocks);
+    for (Block &block : s->ring) {
+        block.steps.resize(blockRows);
+        block.values.resize(blockRows * s->columnCount);
+    }
+
+    auto put = [&s](uint32_t value) {
+        s->stream.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    };
+    put(MAGIC);
+    put(VERSION);
+    put(static_cast<uint32_t>(columns.size()));
+    for (const std::string &name : columns) {
+        put(static_cast<uint32_t>(name.size()));
+        s->stream.write(name.data(), static_cast<std::streamsize>(name.size()));
+    }
+
+    flush();
+    {
+        // The writer only ever sees Series through queued blocks, so with
+        // the queue drained adding one does not race with it
+        std::lock_guard<std::mutex> lock(mutex);
+        series.push_back(std::move(s));
+        queue.resize(series.size() * ringBlocks);
+        queueHead = 0;
+    }
+    return series.size() - 1;
+}
+
+bool MetricsSink::record(size_t id, uint64_t step, const float *values) {
+    // Series that failed to open are dropped like an unsampled step
+    if (id >= series.size()) {
+        return false;
+    }
+    Series &s = *series[id];
+    if (step % s.interval != 0) {
+        return false;
+    }
+    Block &block = s.ring[s.current];
+    block.steps[block.rows] = step;
+    for (size_t c = 0; c < s.columnCount; ++c) {
+        block.values[c * blockRows + block.rows] = values[c];
+    }
+    if (++block.rows == blockRows) {
+        submit(s);
+    }
+    return true;
+}
+
+void MetricsSink::flush() {
+    for (const std::unique_ptr<Series> &s : series) {
+        if (s->ring[s->current].rows > 0) {
+            submit(*s);
+        }
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    written.wait(lock, [this] { return queueCount == 0; });
+    for (const std::unique_ptr<Series> &s : series) {
+        s->stream.flush();
+    }
+}
+
+void MetricsSink::submit(Series &s) {
+    Block &block = s.ring[s.current];
+    const size_t next = (s.current + 1) % s.ring.size();
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        block.queued = true;
+        queue[(queueHead + queueCount) % queue.size()] = { &s, &block };
+        ++queueCount;
+        wake.notify_one();
+        // Only blocks when the writer has fallen a whole ring behind
+        written.wait(lock, [&] { return !s.ring[next].queued; });
+    }
+    s.current = next;
+    s.ring[next].rows = 0;
+}
+
+void MetricsSink::writerLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        wake.wait(lock, [this] { return stopping || queueCount > 0; });
+        if (queueCount == 0) {
+            return;
+        }
+        Series &s = *queue[queueHead].first;
+        Block &block = *queue[queueHead].second;
+        lock.unlock();
+
+        const uint32_t rows = static_cast<uint32_t>(block.rows);
+        s.stream.write(reinterpret_cast<const char*>(&rows), sizeof(rows));
+        s.stream.write(reinterpret_cast<const char*>(block.steps.data()), static_cast<std::streamsize>(rows * sizeof(uint64_t)));
+        for (size_t c = 0; c < s.columnCount; ++c) {
+            s.stream.write(reinterpret_cast<const char*>(block.values.data() + c * blockRows), static_cast<std::streamsize>(rows * sizeof(float)));
+        }
+
+        lock.lock();
+        block.queued = false;
+        queueHead = (queueHead + 1) % queue.size();
+        --queueCount;
+        written.notify_all();
+    }
+}
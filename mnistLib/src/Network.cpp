@@ -0,0 +1,59 @@
+#include "Network.h"
+#include "Profiler.h"
+
+void Network::setCostFunction(std::string name) {
+    if (name == "mse") {
+        cost = Cost::Mse;
+    } else if (name == "log-dz") {
+        cost = Cost::LogDz;
+    } else if (name == "log-gdz") {
+        cost = Cost::LogGdz;
+    }
+}
+
+const char* Network::costFunctionName() const {
+    switch (cost) {
+        case Cost::LogDz:
+            return "log-dz";
+        case Cost::LogGdz:
+            return "log-gdz";
+        default:
+            return "mse";
+    }
+}
+
+float Network::costFunction(const std::vector<float> &predicted, const std::vector<float> &observed, const bool realData) const {
+    return costFunction(statpack::Span<const float>(predicted.data(), predicted.size()), statpack::Span<const float>(observed.data(), observed.size()), realData);
+}
+
+float Network::costFunction(statpack::Span<const float> predicted, statpack::Span<const float> observed, const bool realData) const {
+    MNIST_PROFILE_SCOPE("costFunction");
+    switch (cost) {
+        case Cost::LogDz:
+            return CostFunctions::logDz(predicted, observed, realData);
+        case Cost::LogGdz:
+            return CostFunctions::logGdz(predicted, observed, realData);
+        default:
+            return CostFunctions::mse(predicted, observed, realData);
+    }
+}
+
+void Network::applyDCost(const float *predicted, size_t predictedStride, const float *observed, float *terms, size_t size, const bool realData) const {
+    switch (cost) {
+        case Cost::LogDz:
+            for (size_t k = 0; k < size; ++k) {
+                terms[k] = terms[k] * CostFunctions::dLogDz(predicted[k * predictedStride], observed[k], realData);
+            }
+            break;
+        case Cost::LogGdz:
+            for (size_t k = 0; k < size; ++k) {
+                terms[k] = terms[k] * CostFunctions::dLogGdz(predicted[k * predictedStride], observed[k], realData);
+            }
+            break;
+        default:
+            for (size_t k = 0; k < size; ++k) {
+                terms[k] = terms[k] * CostFunctions::dMse(predicted[k * predictedStride], observed[k], realData);
+            }
+            break;
+    }
+}
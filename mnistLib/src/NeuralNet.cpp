@@ -1,23 +1,140 @@
 #include <vector>
 #include <cstddef>
-#include <functional>
 #include <cassert>
 #include <iostream>
+#include <algorithm>
+#include <cmath>
 
 #include "NeuralNet.h"
+#include "Profiler.h"
+#include "SampleStream.h"
 
 NeuralNet::NeuralNet() : 
-        learnRate(0.01f),
-        inputMin(0.0f),
-        inputMax(1.0f),
-        targetMin(0.0f),
-        targetMax(1.0f),
-        costFunctionPointer(CostFunctions::mse),
-        dCostFunctionPointer(CostFunctions::dMse),
-        activationFunction(ActivationFunctions::sigmoid),
-        dActivationFunction(ActivationFunctions::dSigmoid)
+        activation(Activation::Sigmoid)
     {}
 
+NeuralNet::Layer::Layer(const Layer &other) :
+        sizeIn(other.sizeIn),
+        sizeOut(other.sizeOut),
+        nodes(other.nodes),
+        delta_nodes(other.delta_nodes),
+        params(other.params),
+        wSum(other.wSum),
+        bpTerms(other.bpTerms),
+        batchRows(other.batchRows),
+        batchBuffer(other.batchBuffer)
+    {
+    bindViews();
+}
+
+NeuralNet::Layer& NeuralNet::Layer::operator=(const Layer &other) {
+    if (this == &other) {
+        return *this;
+    }
+    sizeIn = other.sizeIn;
+    sizeOut = other.sizeOut;
+    nodes = other.nodes;
+    delta_nodes = other.delta_nodes;
+    params = other.params;
+    wSum = other.wSum;
+    bpTerms = other.bpTerms;
+    batchRows = other.batchRows;
+    batchBuffer = other.batchBuffer;
+    bindViews();
+    return *this;
+}
+
+void NeuralNet::Layer::allocate(size_t outputs, size_t stateSlots) {
+    sizeOut = outputs;
+    params.assign((2 + stateSlots) * paramCount(), 0.0f);
+    bindViews();
+}
+
+void NeuralNet::Layer::reserveState(size_t stateSlots) {
+    const size_t count = paramCount();
+    params.resize((2 + stateSlots) * count);
+    std::fill(params.begin() + static_cast<std::ptrdiff_t>(2 * count), params.end(), 0.0f);
+    bindViews();
+}
+
+void NeuralNet::Layer::reserveBatch(size_t rows) {
+    if (rows == batchRows) {
+        return;
+    }
+    batchRows = rows;
+    batchBuffer.assign(3 * rows * statpack::alignedStride<float>(sizeIn), 0.0f);
+    bindViews();
+}
+
+size_t NeuralNet::Layer::paramCount() const {
+    return sizeOut * statpack::alignedStride<float>(sizeIn) + statpack::alignedStride<float>(sizeOut);
+}
+
+size_t NeuralNet::Layer::stateSlots() const {
+    const size_t count = paramCount();
+    return (count == 0 || params.empty() ? 0 : params.size() / count - 2);
+}
+
+float* NeuralNet::Layer::state(size_t slot) {
+#ifdef CUSTOM_DEBUG
+    assert(slot < stateSlots() && "Optimizer state slot out of range.");
+#endif
+    return params.data() + (2 + slot) * paramCount();
+}
+
+void NeuralNet::Layer::bindViews() {
+    const size_t nodeStride = statpack::alignedStride<float>(sizeIn);
+    float *batchBase = batchBuffer.data();
+    batchNodes = statpack::MatrixView<float>(batchBase, batchRows, sizeIn, nodeStride);
+    batchWSum = statpack::MatrixView<float>(batchBase + batchRows * nodeStride, batchRows, sizeIn, nodeStride);
+    batchDeltaNodes = statpack::MatrixView<float>(batchBase + 2 * batchRows * nodeStride, batchRows, sizeIn, nodeStride);
+
+    if (params.empty()) {
+        weights = {};
+        delta_weights = {};
+        biases = {};
+        delta_biases = {};
+        return;
+    }
+    const size_t stride = statpack::alignedStride<float>(sizeIn);
+    float *base = params.data();
+    float *deltaBase = base + paramCount();
+    weights = statpack::MatrixView<float>(base, sizeOut, sizeIn, stride);
+    biases = statpack::Span<float>(base + sizeOut * stride, sizeOut);
+    delta_weights = statpack::MatrixView<float>(deltaBase, sizeOut, sizeIn, stride);
+    delta_biases = statpack::Span<float>(deltaBase + sizeOut * stride, sizeOut);
+}
+
+void NeuralNet::Context::reserve(const NeuralNet &net, size_t rows) {
+    bool fits = (rows == batchRows && nodes.size() == net.layers.size());
+    for (size_t i = 1; fits && i < net.layers.size(); ++i) {
+        fits = (nodes[i].cols == net.layers[i].sizeIn);
+    }
+    if (fits) {
+        return;
+    }
+    size_t floats = 0;
+    for (size_t i = 1; i < net.layers.size(); ++i) {
+        floats += 2 * rows * statpack::alignedStride<float>(net.layers[i].sizeIn);
+    }
+    batchRows = rows;
+    buffer.assign(floats, 0.0f);
+    nodes.assign(net.layers.size(), {});
+    wSum.assign(net.layers.size(), {});
+    float *base = buffer.data();
+    for (size_t i = 1; i < net.layers.size(); ++i) {
+        const size_t size = net.layers[i].sizeIn;
+        const size_t stride = statpack::alignedStride<float>(size);
+        nodes[i] = statpack::MatrixView<float>(base, rows, size, stride);
+        wSum[i] = statpack::MatrixView<float>(base + rows * stride, rows, size, stride);
+        base += 2 * rows * stride;
+    }
+}
+
+statpack::MatrixView<const float> NeuralNet::Context::outputs() const {
+    return (nodes.empty() ? statpack::MatrixView<const float>() : statpack::MatrixView<const float>(nodes.back()));
+}
+
 void NeuralNet::addLayer(size_t size) {
     layers.emplace_back(Layer(size));
 }
@@ -27,44 +144,75 @@ void NeuralNet::build() {
     assert(layers.size() >= 2 && "NeuralNet requires at least 2 layers (input & output) to work)");
 #endif
     for (size_t i = 0; i < layers.size() - 1; ++i) {
-        // Biases
-        layers[i].biases.resize(layers[i + 1].sizeIn);
-        layers[i].delta_biases.resize(layers[i + 1].sizeIn);
-        // Weights
-        layers[i].sizeOut = layers[i + 1].sizeIn;
-        layers[i].weights.resize(layers[i].sizeOut);
-        layers[i].delta_weights.resize(layers[i].sizeOut);
-        for (size_t k = 0; k < layers[i].sizeOut; ++k) {
-            layers[i].weights[k].resize(layers[i].sizeIn);
-            layers[i].delta_weights[k].resize(layers[i].sizeIn);
-        }
+        // Weights, biases, their deltas and the optimizer state
+        layers[i].allocate(layers[i + 1].sizeIn, optimizerSlots());
     }
     for (size_t i = 0; i < layers.size() - 1; ++i) {
         layers[i].delta_nodes.resize(layers[i].sizeIn);
     }
     for (size_t i = 1; i < layers.size(); ++i) {
         layers[i].wSum.resize(layers[i].sizeIn);
+        layers[i].bpTerms.resize(layers[i].sizeIn);
     }
     targetVector.resize(layers[layers.size() - 1].sizeIn);
+    optimizerSteps = 0;
+    reserveWorkspace(0);
 }
 
-void NeuralNet::randomizeWeightsAndBiases(unsigned int seed) {
-    statpack::Random::seed(seed);
-    for (auto& layer : layers) {
-        for (auto& bias : layer.biases) {
-            bias = statpack::Random::Float(-10, 10);
+void NeuralNet::reserveWorkspace(size_t batchRows) {
+    size_t floats = 0;
+    for (size_t i = 0; i < layers.size(); ++i) {
+        const size_t width = statpack::alignedStride<float>(layers[i].sizeIn);
+        // Node gradient and terms of inputGradient
+        floats = std::max(floats, 2 * width);
+        if (i + 1 < layers.size()) {
+            // Transposed weights of forwardBatch
+            floats = std::max(floats, layers[i].sizeIn * statpack::alignedStride<float>(layers[i].sizeOut));
         }
-        for (auto& weightArr : layer.weights) {
-            for (auto& weight : weightArr) {
-                weight = statpack::Random::Float(-10, 10);
-            }
+        if (i > 0) {
+            // Scaled bpTerms of backwardBatch, one way round or the other
+            floats = std::max(floats, layers[i].sizeIn * statpack::alignedStride<float>(batchRows));
+            floats = std::max(floats, batchRows * width);
         }
     }
+    workspace.reserve(floats);
+}
+
+void NeuralNet::randomizeWeightsAndBiases(unsigned int seed) {
+    statpack::Rng rng(seed);
+    for (auto& layer : layers) {
+        rng.fillUniform(layer.biases, -10, 10);
+        rng.fillUniform(layer.weights, -10, 10);
+    }
+}
+
+void NeuralNet::initializeWeights(std::string scheme, unsigned int seed) {
+    void (*init)(statpack::Rng&, const statpack::MatrixView<float>&) = nullptr;
+    if (scheme == "xavier") {
+        init = statpack::xavierUniform;
+    } else if (scheme == "xavier-normal") {
+        init = statpack::xavierNormal;
+    } else if (scheme == "he") {
+        init = statpack::heUniform;
+    } else if (scheme == "he-normal") {
+        init = statpack::heNormal;
+    } else {
+        return;
+    }
+    statpack::Rng rng(seed);
+    for (size_t i = 0; i + 1 < layers.size(); ++i) {
+        init(rng, layers[i].weights);
+        std::fill(layers[i].biases.begin(), layers[i].biases.end(), 0.0f);
+    }
 }
 
 float NeuralNet::train(const std::vector<float> &inputs, const std::vector<float> &target, const float epoch, const bool realData) {
+    return train(statpack::Span<const float>(inputs.data(), inputs.size()), statpack::Span<const float>(target.data(), target.size()), epoch, realData);
+}
+
+float NeuralNet::train(statpack::Span<const float> inputs, statpack::Span<const float> target, const float epoch, const bool realData) {
 #ifdef CUSTOM_DEBUG
-    assert(inputs.size() == layers[0].weights[0].size() && "Input vector has an incorrect size.");
+    assert(inputs.size() == layers[0].weights.cols && "Input vector has an incorrect size.");
     assert(target.size() == layers[layers.size()-1].nodes.size() && "Target and ouput vectors have different lengths.");
 #endif
     for (size_t i = 0; i < inputs.size(); ++i) {
@@ -74,117 +222,502 @@ float NeuralNet::train(const std::vector<float> &inputs, const std::vector<float
         targetVector[i] = statpack::normalize(target[i], targetMin, targetMax, activationMin, activationMax); // output limits depends on the activation function
     }
     
-    forwardPropagate(inputs);
+    forwardPropagate(layers[0].nodes);
     backPropagate(targetVector, epoch);
     return costFunction(layers[layers.size() - 1].nodes, targetVector, realData);
 }
 
 // TODO: add batch standardization
 std::vector<float> NeuralNet::generate(const std::vector<float> &inputs) {
+    std::vector<float> out(layers[layers.size() - 1].nodes.size());
+    generate(statpack::Span<const float>(inputs.data(), inputs.size()), statpack::Span<float>(out.data(), out.size()));
+    return out;
+}
+
+void NeuralNet::generate(statpack::Span<const float> inputs, statpack::Span<float> outputs) {
+#ifdef CUSTOM_DEBUG
+    assert(outputs.size() >= layers[layers.size() - 1].nodes.size() && "Output span is too small.");
+#endif
     for (size_t i = 0; i < inputs.size(); ++i) {
         layers[0].nodes[i] = inputs[i]; // statpack::normalize(inputs[i], inputMin, inputMax, -1.0f, 1.0f); // -1 to 1 works fine
     }
     forwardPropagate(layers[0].nodes);
 
-    std::vector<float> out;
-    out.resize(layers[layers.size() - 1].nodes.size());
     for (size_t i = 0; i < layers[layers.size() - 1].nodes.size(); ++i) {
-        out[i] = statpack::normalize(layers[layers.size() - 1].nodes[i], activationMin, activationMax, targetMin, targetMax);
+        outputs[i] = statpack::normalize(layers[layers.size() - 1].nodes[i], activationMin, activationMax, targetMin, targetMax);
+    }
+}
+
+void NeuralNet::forward(Context &context, const statpack::MatrixView<const float> &inputs) const {
+    MNIST_PROFILE_SCOPE("forward");
+    MNIST_PROFILE_WORK("forward", 0, 0, 0, inputs.rows);
+#ifdef CUSTOM_DEBUG
+    assert(inputs.cols == layers[0].sizeIn && "Input matrix has an incorrect width.");
+#endif
+    context.reserve(*this, inputs.rows);
+    // Samples go through each weight row a few at a time, so the row is
+    // read from memory once per group instead of once per sample
+    constexpr size_t GROUP = statpack::GEMM_TILE_ROWS;
+    for (size_t i = 0; i + 1 < layers.size(); ++i) {
+        const Layer &layer = layers[i];
+        const statpack::MatrixView<const float> in = (i == 0 ? inputs : statpack::MatrixView<const float>(context.nodes[i]));
+        const statpack::MatrixView<float> &wSum = context.wSum[i + 1];
+        for (size_t first = 0; first < inputs.rows; first += GROUP) {
+            const size_t last = std::min(first + GROUP, inputs.rows);
+            for (size_t k = 0; k < layer.sizeOut; ++k) {
+                const float *weightRow = layer.weights.row(k);
+                for (size_t s = first; s < last; ++s) {
+                    wSum.row(s)[k] = statpack::weightedSum(in.row(s), weightRow, layer.sizeIn) + layer.biases[k];
+                }
+            }
+            for (size_t s = first; s < last; ++s) {
+                activate(wSum.row(s), context.nodes[i + 1].row(s), layer.sizeOut);
+            }
+        }
+    }
+}
+
+void NeuralNet::generate(Context &context, statpack::Span<const float> inputs, statpack::Span<float> outputs) const {
+#ifdef CUSTOM_DEBUG
+    assert(outputs.size() >= outputSize() && "Output span is too small.");
+#endif
+    forward(context, statpack::MatrixView<const float>(inputs.data(), 1, inputs.size(), inputs.size()));
+    const float *nodes = context.outputs().row(0);
+    for (size_t i = 0; i < outputSize(); ++i) {
+        outputs[i] = statpack::normalize(nodes[i], activationMin, activationMax, targetMin, targetMax);
     }
-    return out;
 }
 
 void NeuralNet::forwardPropagate(const std::vector<float> &inputs) {
+    MNIST_PROFILE_SCOPE("forwardPropagate");
+    MNIST_PROFILE_WORK("forwardPropagate", 0, 0, 0, 1);
     // First layer calculation differs slightly from the rest
-    for (size_t k = 0; k < layers[0].sizeOut; ++k) {
-        layers[1].wSum[k] = statpack::weightedSum(inputs, layers[0].weights[k]) + layers[0].biases[k];
-        layers[1].nodes[k] = activationFunction(layers[1].wSum[k]);
+    {
+        MNIST_PROFILE_LAYER("forward layer", 0);
+        MNIST_PROFILE_WORK("forward layer", 0, forwardFlops(0), forwardBytes(0), 1);
+        parallelFor(layers[0].sizeOut, [&](size_t begin, size_t end) {
+            for (size_t k = begin; k < end; ++k) {
+                layers[1].wSum[k] = statpack::weightedSum(inputs, layers[0].weights[k]) + layers[0].biases[k];
+            }
+            activate(layers[1].wSum.data() + begin, layers[1].nodes.data() + begin, end - begin);
+        });
     }
 
     for (size_t i = 1; i < layers.size() - 1; ++i) {
-        for (size_t k = 0; k < layers[i].sizeOut; ++k) {
-            layers[i+1].wSum[k] = statpack::weightedSum(layers[i].nodes, layers[i].weights[k]) + layers[i].biases[k];
-            layers[i+1].nodes[k] = activationFunction(layers[i+1].wSum[k]);
-        }
+        MNIST_PROFILE_LAYER("forward layer", i);
+        MNIST_PROFILE_WORK("forward layer", i, forwardFlops(i), forwardBytes(i), 1);
+        parallelFor(layers[i].sizeOut, [&](size_t begin, size_t end) {
+            for (size_t k = begin; k < end; ++k) {
+                layers[i+1].wSum[k] = statpack::weightedSum(layers[i].nodes, layers[i].weights[k]) + layers[i].biases[k];
+            }
+            activate(layers[i+1].wSum.data() + begin, layers[i+1].nodes.data() + begin, end - begin);
+        });
     }
 }
 
 void NeuralNet::backPropagate(const std::vector<float>& target, const float batchSize, const bool realData) {
+    MNIST_PROFILE_SCOPE("backPropagate");
+    MNIST_PROFILE_WORK("backPropagate", 0, 0, 0, 1);
     // First layer calculation differs slightly from the rest
     const size_t lastLayer = layers.size() - 1;
+    std::vector<float> &lastTerms = layers[lastLayer].bpTerms;
+    dActivate(layers[lastLayer].wSum.data(), lastTerms.data(), layers[lastLayer].sizeIn);
+    if (GANLink) {
+        for (size_t k = 0; k < layers[lastLayer].sizeIn; ++k) {
+            lastTerms[k] = GANLink->layers[0].weights[0][k] * lastTerms[k];
+        }
+        applyDCost(target.data(), 0, layers[lastLayer].nodes.data(), lastTerms.data(), layers[lastLayer].sizeIn, realData);
+    } else {
+        applyDCost(target.data(), 1, layers[lastLayer].nodes.data(), lastTerms.data(), layers[lastLayer].sizeIn, realData);
+    }
+    accumulateDeltas(lastLayer, lastTerms.data(), batchSize);
+    backPropagateHidden(batchSize);
+}
+
+void NeuralNet::backPropagateGradient(const float *outputGradient, const float batchSize) {
+    MNIST_PROFILE_SCOPE("backPropagate");
+    MNIST_PROFILE_WORK("backPropagate", 0, 0, 0, 1);
+    const size_t lastLayer = layers.size() - 1;
+    std::vector<float> &lastTerms = layers[lastLayer].bpTerms;
+    dActivate(layers[lastLayer].wSum.data(), lastTerms.data(), layers[lastLayer].sizeIn);
     for (size_t k = 0; k < layers[lastLayer].sizeIn; ++k) {
-        float bpTerm = 0;
-        if (GANLink) {
-            bpTerm = GANLink->layers[0].weights[0][k] * dActivationFunction(layers[lastLayer].wSum[k]) * dCostFunction(target[0], layers[lastLayer].nodes[k], realData);
-        } else {
-            bpTerm = dActivationFunction(layers[lastLayer].wSum[k]) * dCostFunction(target[k], layers[lastLayer].nodes[k], realData);
+        lastTerms[k] = lastTerms[k] * outputGradient[k];
+    }
+    accumulateDeltas(lastLayer, lastTerms.data(), batchSize);
+    backPropagateHidden(batchSize);
+}
+
+void NeuralNet::inputGradient(const float *outputTerms, float *gradient) {
+    size_t widest = 0;
+    for (const auto &layer : layers) {
+        widest = std::max(widest, layer.sizeIn);
+    }
+    workspace.reset();
+    float *nodeGradient = workspace.take(widest);
+    float *terms = workspace.take(widest);
+    const float *current = outputTerms;
+    for (size_t i = layers.size() - 1; i > 0; --i) {
+        Layer &prev = layers[i - 1];
+        float *out = (i == 1 ? gradient : nodeGradient);
+        const float nodeCount = static_cast<float>(layers[i].sizeIn);
+        std::fill(out, out + prev.sizeIn, 0.0f);
+        for (size_t k = 0; k < layers[i].sizeIn; ++k) {
+            statpack::axpy(out, prev.weights.row(k), current[k] / nodeCount, prev.sizeIn);
         }
-        for (size_t n = 0; n < layers[lastLayer - 1].sizeIn; ++n) {
-            layers[lastLayer - 1].delta_weights[k][n] += layers[lastLayer - 1].nodes[n] * bpTerm / batchSize;
-            layers[lastLayer - 1].delta_nodes[n] += layers[lastLayer - 1].weights[k][n] * bpTerm / static_cast<float>(layers[lastLayer].sizeIn);
+        if (i > 1) {
+            dActivate(prev.wSum.data(), terms, prev.sizeIn);
+            for (size_t k = 0; k < prev.sizeIn; ++k) {
+                terms[k] = terms[k] * out[k];
+            }
+            current = terms;
         }
-        layers[lastLayer - 1].delta_biases[k] += bpTerm / batchSize;
     }
+}
 
-    if (lastLayer == 1) return;
-    
+void NeuralNet::backPropagateHidden(const float batchSize) {
     for (size_t i = layers.size() - 2; i > 0; --i) {
+        std::vector<float> &terms = layers[i].bpTerms;
+        dActivate(layers[i].wSum.data(), terms.data(), layers[i].sizeIn);
         for (size_t k = 0; k < layers[i].sizeIn; ++k) {
-            const float bpTerm = dActivationFunction(layers[i].wSum[k]) * layers[i].delta_nodes[k];
-            for (size_t n = 0; n < layers[i - 1].sizeIn; ++n) {
-                layers[i - 1].delta_weights[k][n] += layers[i - 1].nodes[n] * bpTerm / batchSize;
-                layers[i - 1].delta_nodes[n] += layers[i - 1].weights[k][n] * bpTerm / static_cast<float>(layers[i].sizeIn);
-            }
-            layers[i - 1].delta_biases[k] += bpTerm / batchSize;
+            terms[k] = terms[k] * layers[i].delta_nodes[k];
             layers[i].delta_nodes[k] = 0;
         }
+        accumulateDeltas(i, terms.data(), batchSize);
     }
 }
 
-void NeuralNet::applyDeltas() {
+void NeuralNet::accumulateDeltas(size_t i, const float *terms, const float batchSize) {
+    MNIST_PROFILE_LAYER("backward layer", i - 1);
+    // delta_weights and delta_nodes each take a multiply-add per weight
+    MNIST_PROFILE_WORK("backward layer", i - 1, 2 * forwardFlops(i - 1), 3 * forwardBytes(i - 1), 1);
+    Layer &prev = layers[i - 1];
+    const float nodeCount = static_cast<float>(layers[i].sizeIn);
+    // Rows of delta_weights are independent
+    parallelFor(layers[i].sizeIn, [&](size_t begin, size_t end) {
+        for (size_t k = begin; k < end; ++k) {
+            statpack::axpy(prev.delta_weights.row(k), prev.nodes.data(), terms[k] / batchSize, prev.sizeIn);
+            prev.delta_biases[k] += terms[k] / batchSize;
+        }
+    });
+    // delta_nodes is a sum over every row, so split it by column instead.
+    // Each column still adds the rows in ascending order.
+    parallelFor(prev.sizeIn, [&](size_t begin, size_t end) {
+        for (size_t k = 0; k < layers[i].sizeIn; ++k) {
+            statpack::axpy(prev.delta_nodes.data() + begin, prev.weights.row(k) + begin, terms[k] / nodeCount, end - begin);
+        }
+    }, statpack::alignedStride<float>(1));
+}
+
+void NeuralNet::forwardBatch(const statpack::MatrixView<const float> &inputs) {
+    MNIST_PROFILE_SCOPE("forwardBatch");
+    MNIST_PROFILE_WORK("forwardBatch", 0, 0, 0, inputs.rows);
+#ifdef CUSTOM_DEBUG
+    assert(inputs.cols == layers[0].sizeIn && "Input matrix has an incorrect width.");
+#endif
+    if (layers[0].batchRows != inputs.rows) {
+        reserveWorkspace(inputs.rows);
+    }
+    for (auto &layer : layers) {
+        layer.reserveBatch(inputs.rows);
+    }
+    for (size_t s = 0; s < inputs.rows; ++s) {
+        std::copy(inputs.row(s), inputs.row(s) + inputs.cols, layers[0].batchNodes.row(s));
+    }
+
     for (size_t i = 0; i < layers.size() - 1; ++i) {
-        for (size_t k = 0; k < layers[i].sizeOut; ++k) {
-            for (size_t n = 0; n < layers[i].sizeIn; ++n) {
-                layers[i].weights[k][n] -= layers[i].delta_weights[k][n] * learnRate; 
-                layers[i].delta_weights[k][n] = 0;
+        Layer &next = layers[i + 1];
+        const statpack::MatrixView<float> weightsT = workspaceMatrix(layers[i].sizeIn, layers[i].sizeOut);
+        statpack::transpose<float>(layers[i].weights, weightsT);
+        for (size_t s = 0; s < inputs.rows; ++s) {
+            std::fill(next.batchWSum.row(s), next.batchWSum.row(s) + next.sizeIn, 0.0f);
+        }
+        gemmAccumulate(next.batchWSum, layers[i].batchNodes, weightsT);
+        for (size_t s = 0; s < inputs.rows; ++s) {
+            float *wSumRow = next.batchWSum.row(s);
+            float *nodeRow = next.batchNodes.row(s);
+            for (size_t k = 0; k < next.sizeIn; ++k) {
+                wSumRow[k] += layers[i].biases[k];
+            }
+            activate(wSumRow, nodeRow, next.sizeIn);
+        }
+    }
+}
+
+void NeuralNet::backwardBatch(const statpack::MatrixView<const float> &targets, const bool realData, const float samples) {
+    const size_t lastLayer = layers.size() - 1;
+    const size_t rows = layers[lastLayer].batchRows;
+    MNIST_PROFILE_SCOPE("backwardBatch");
+    MNIST_PROFILE_WORK("backwardBatch", 0, 0, 0, rows);
+    const float batchSize = (samples > 0 ? samples : static_cast<float>(rows));
+#ifdef CUSTOM_DEBUG
+    assert(targets.rows == rows && "Target matrix and the last forwardBatch have different sample counts.");
+#endif
+
+    // batchDeltaNodes of the layer being processed is overwritten with its bpTerms
+    for (size_t s = 0; s < rows; ++s) {
+        const float *target = targets.row(s);
+        const float *wSumRow = layers[lastLayer].batchWSum.row(s);
+        const float *nodeRow = layers[lastLayer].batchNodes.row(s);
+        float *bpRow = layers[lastLayer].batchDeltaNodes.row(s);
+        dActivate(wSumRow, bpRow, layers[lastLayer].sizeIn);
+        if (GANLink) {
+            for (size_t k = 0; k < layers[lastLayer].sizeIn; ++k) {
+                bpRow[k] = GANLink->layers[0].weights[0][k] * bpRow[k];
+            }
+            applyDCost(target, 0, nodeRow, bpRow, layers[lastLayer].sizeIn, realData);
+        } else {
+            applyDCost(target, 1, nodeRow, bpRow, layers[lastLayer].sizeIn, realData);
+        }
+    }
+
+    for (size_t i = lastLayer; i > 0; --i) {
+        Layer &layer = layers[i];
+        Layer &prev = layers[i - 1];
+        if (i != lastLayer) {
+            for (size_t s = 0; s < rows; ++s) {
+                float *terms = layer.bpTerms.data();
+                float *bpRow = layer.batchDeltaNodes.row(s);
+                dActivate(layer.batchWSum.row(s), terms, layer.sizeIn);
+                for (size_t k = 0; k < layer.sizeIn; ++k) {
+                    bpRow[k] = terms[k] * bpRow[k];
+                }
+            }
+        }
+        // delta_weights += (bpTerms / batchSize)^T * nodes
+        const statpack::MatrixView<float> scaledT = workspaceMatrix(layer.sizeIn, rows);
+        statpack::transpose<float>(layer.batchDeltaNodes, scaledT, batchSize);
+        gemmAccumulate(prev.delta_weights, scaledT, prev.batchNodes);
+
+        // delta_nodes = (bpTerms / sizeIn) * weights
+        const statpack::MatrixView<float> scaled = workspaceMatrix(rows, layer.sizeIn);
+        for (size_t s = 0; s < rows; ++s) {
+            const float *bpRow = layer.batchDeltaNodes.row(s);
+            float *scaledRow = scaled.row(s);
+            for (size_t k = 0; k < layer.sizeIn; ++k) {
+                scaledRow[k] = bpRow[k] / static_cast<float>(layer.sizeIn);
+            }
+            std::fill(prev.batchDeltaNodes.row(s), prev.batchDeltaNodes.row(s) + prev.sizeIn, 0.0f);
+        }
+        gemmAccumulate(prev.batchDeltaNodes, scaled, prev.weights);
+        for (size_t s = 0; s < rows; ++s) {
+            const float *bpRow = layer.batchDeltaNodes.row(s);
+            for (size_t k = 0; k < layer.sizeIn; ++k) {
+                prev.delta_biases[k] += bpRow[k] / batchSize;
+            }
+        }
+    }
+
+    // The per-sample path keeps accumulating the input layer's delta_nodes
+    for (size_t s = 0; s < rows; ++s) {
+        statpack::axpy(layers[0].delta_nodes.data(), layers[0].batchDeltaNodes.row(s), 1.0f, layers[0].sizeIn);
+    }
+}
+
+uint64_t NeuralNet::trainStream(mnistParser::SampleSource &source, size_t batchSize, uint64_t maxSamples, const bool realData) {
+    MNIST_PROFILE_SCOPE("trainStream");
+    if (source.inputSize() != inputSize() || source.targetSize() != outputSize()) {
+        std::cout << "Samples of " << source.inputSize() << " inputs and " << source.targetSize() << " targets do not fit a net of "
+                  << inputSize() << " inputs and " << outputSize() << " outputs!\n";
+        return 0;
+    }
+    mnistParser::StreamBatcher batcher(source, batchSize, maxSamples);
+    statpack::MatrixView<const float> inputs;
+    statpack::MatrixView<const float> targets;
+    uint64_t samples = 0;
+    while (batcher.next(inputs, targets)) {
+        forwardBatch(inputs);
+        // Targets onto the activation range like train(). forwardBatch sized
+        // the workspace for the batch, and backwardBatch reads the targets
+        // before it takes the workspace over.
+        const statpack::MatrixView<float> scaled = workspaceMatrix(targets.rows, targets.cols);
+        for (size_t s = 0; s < targets.rows; ++s) {
+            const float *row = targets.row(s);
+            float *scaledRow = scaled.row(s);
+            for (size_t k = 0; k < targets.cols; ++k) {
+                scaledRow[k] = statpack::normalize(row[k], targetMin, targetMax, activationMin, activationMax);
             }
-            layers[i].biases[k] -= layers[i].delta_biases[k] * learnRate;
-            layers[i].delta_biases[k] = 0;
         }
+        backwardBatch(scaled, realData);
+        applyDeltas();
+        samples += inputs.rows;
     }
+    batcher.stop();
+    return samples;
+}
+
+size_t NeuralNet::inputSize() const {
+    return layers.front().sizeIn;
 }
 
-void NeuralNet::setCostFunction(std::string name) {
-    if (name == "mse") {
-        costFunctionPointer = CostFunctions::mse;
-        dCostFunctionPointer = CostFunctions::dMse;
-    } else if (name == "log-dz") {
-        costFunctionPointer = CostFunctions::logDz;
-        dCostFunctionPointer = CostFunctions::dLogDz;
-    } else if (name == "log-gdz") {
-        costFunctionPointer = CostFunctions::logGdz;
-        dCostFunctionPointer = CostFunctions::dLogGdz;
+size_t NeuralNet::outputSize() const {
+    return layers.back().sizeIn;
+}
+
+void NeuralNet::applyDeltas() {
+    MNIST_PROFILE_SCOPE("applyDeltas");
+    ++optimizerSteps;
+    // Adam's bias correction folded into the step size and epsilon
+    float adamRate = learnRate;
+    float adamEpsilon = epsilon;
+    if (optimizer == Optimizer::Adam) {
+        const double t = static_cast<double>(optimizerSteps);
+        const double correction1 = 1.0 - std::pow(static_cast<double>(beta1), t);
+        const double correction2 = std::sqrt(1.0 - std::pow(static_cast<double>(beta2), t));
+        adamRate = static_cast<float>(learnRate * correction2 / correction1);
+        adamEpsilon = static_cast<float>(epsilon * correction2);
+    }
+
+    // Weights and biases are one block followed by their deltas and state
+    for (size_t i = 0; i < layers.size() - 1; ++i) {
+        Layer &layer = layers[i];
+        const size_t count = layer.paramCount();
+        float *values = layer.params.data();
+        float *deltas = values + count;
+        // Parameters, deltas and moments are each read and written once
+        MNIST_PROFILE_WORK("applyDeltas", 0, 0, 2 * (2 + optimizerSlots()) * count * sizeof(float), 0);
+        switch (optimizer) {
+            case Optimizer::Momentum:
+                statpack::kernels::momentumUpdate(values, deltas, layer.state(0), learnRate, momentum, count);
+                break;
+            case Optimizer::RmsProp:
+                statpack::kernels::rmsPropUpdate(values, deltas, layer.state(0), learnRate, rmsDecay, epsilon, count);
+                break;
+            case Optimizer::Adam:
+                statpack::kernels::adamUpdate(values, deltas, layer.state(0), layer.state(1), adamRate, beta1, beta2, adamEpsilon, count);
+                break;
+            default:
+                statpack::kernels::scaledUpdate(values, deltas, learnRate, count);
+                break;
+        }
     }
 }
 
+void NeuralNet::gemmAccumulate(const statpack::MatrixView<float> &C, const statpack::MatrixView<const float> &A, const statpack::MatrixView<const float> &B) {
+    // Rows of C only depend on the same rows of A
+    parallelFor(C.rows, [&](size_t begin, size_t end) {
+        const statpack::MatrixView<float> cRows(C.row(begin), end - begin, C.cols, C.stride);
+        const statpack::MatrixView<const float> aRows(A.row(begin), end - begin, A.cols, A.stride);
+        statpack::gemmAccumulate<float>(cRows, aRows, B);
+    }, statpack::GEMM_TILE_ROWS);
+}
+
+void NeuralNet::setThreadCount(size_t threads) {
+    if (threads <= 1) {
+        ownedPool.reset();
+        pool = nullptr;
+        return;
+    }
+    ownedPool = std::make_unique<ThreadPool>(threads);
+    pool = ownedPool.get();
+}
+
+void NeuralNet::setThreadPool(ThreadPool *threadPool) {
+    ownedPool.reset();
+    pool = threadPool;
+}
+
+statpack::MatrixView<float> NeuralNet::workspaceMatrix(size_t rows, size_t cols) {
+    workspace.reset();
+    return workspace.matrix(rows, cols);
+}
+
 void NeuralNet::setActivationFunction(std::string name) {
     if (name == "sigmoid") {
-        activationFunction = ActivationFunctions::sigmoid;
-        dActivationFunction = ActivationFunctions::dSigmoid;
+        activation = Activation::Sigmoid;
         activationMin = 0.0f;
         activationMax = 1.0f;
     } else if (name == "relu") {
-        activationFunction = ActivationFunctions::relu;
-        dActivationFunction = ActivationFunctions::dRelu;
+        activation = Activation::Relu;
         activationMin = 0.0f;
         activationMax = 1.0f;
     }
 }
 
-float NeuralNet::costFunction(const std::vector<float> &predicted, const std::vector<float> &observed, const bool realData) {
-    return costFunctionPointer(predicted, observed, realData);
+const char* NeuralNet::activationFunctionName() const {
+    switch (activation) {
+        case Activation::Relu:
+            return "relu";
+        default:
+            return "sigmoid";
+    }
+}
+
+void NeuralNet::setOptimizer(std::string name) {
+    if (name == "sgd") {
+        optimizer = Optimizer::Sgd;
+    } else if (name == "momentum") {
+        optimizer = Optimizer::Momentum;
+    } else if (name == "rmsprop") {
+        optimizer = Optimizer::RmsProp;
+    } else if (name == "adam") {
+        optimizer = Optimizer::Adam;
+    } else {
+        return;
+    }
+    for (size_t i = 0; i + 1 < layers.size(); ++i) {
+        if (!layers[i].params.empty()) {
+            layers[i].reserveState(optimizerSlots());
+        }
+    }
+    optimizerSteps = 0;
+}
+
+const char* NeuralNet::optimizerName() const {
+    switch (optimizer) {
+        case Optimizer::Momentum:
+            return "momentum";
+        case Optimizer::RmsProp:
+            return "rmsprop";
+        case Optimizer::Adam:
+            return "adam";
+        default:
+            return "sgd";
+    }
+}
+
+uint64_t NeuralNet::forwardFlops(size_t i) const {
+    return 2 * static_cast<uint64_t>(layers[i].sizeIn) * layers[i].sizeOut;
+}
+
+uint64_t NeuralNet::forwardBytes(size_t i) const {
+    return (static_cast<uint64_t>(layers[i].sizeOut) * (layers[i].sizeIn + 1) + layers[i].sizeIn) * sizeof(float);
 }
 
-float NeuralNet::dCostFunction(float predicted,  float observed, const bool realData) {
-    return dCostFunctionPointer(predicted, observed, realData);
-}
\ No newline at end of file
+size_t NeuralNet::optimizerSlots() const {
+    switch (optimizer) {
+        case Optimizer::Momentum:
+        case Optimizer::RmsProp:
+            return 1;
+        case Optimizer::Adam:
+            return 2;
+        default:
+            return 0;
+    }
+}
+
+void NeuralNet::activate(Activation function, const float *wSum, float *nodes, size_t size) {
+    // No default, so a new Activation warns here until it has a kernel
+    switch (function) {
+        case Activation::Sigmoid:
+            statpack::kernels::sigmoid(wSum, nodes, size);
+            break;
+        case Activation::Relu:
+            statpack::kernels::relu(wSum, nodes, size);
+            break;
+    }
+}
+
+void NeuralNet::activate(const float *wSum, float *nodes, size_t size) const {
+    activate(activation, wSum, nodes, size);
+}
+
+void NeuralNet::dActivate(const float *wSum, float *out, size_t size) const {
+    switch (activation) {
+        case Activation::Relu:
+            statpack::kernels::dRelu(wSum, out, size);
+            break;
+        default:
+            statpack::kernels::dSigmoid(wSum, out, size);
+            break;
+    }
+}
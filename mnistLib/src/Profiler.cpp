@@ -0,0 +1,244 @@
+#include "Profiler.h"
+
+#ifdef MNIST_PROFILE
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <cstring>
+
+namespace profiler {
+    namespace {
+        struct Stats {
+            uint64_t calls = 0;
+            int64_t totalNs = 0;
+            int64_t minNs = INT64_MAX;
+            int64_t maxNs = 0;
+            uint64_t flops = 0;
+            uint64_t bytes = 0;
+            uint64_t samples = 0;
+        };
+
+        struct Event {
+            uint32_t zone;
+            uint32_t layer;
+            int64_t start;
+            int64_t duration;
+        };
+
+        struct ThreadLog {
+            uint32_t thread = 0;
+            // [zone][layer]
+            std::vector<std::vector<Stats>> stats;
+            std::vector<Event> events;
+            uint64_t droppedEvents = 0;
+
+            Stats& at(size_t zone, size_t layer) {
+                if (zone >= stats.size()) {
+                    stats.resize(zone + 1);
+                }
+                std::vector<Stats> &layers = stats[zone];
+                if (layer >= layers.size()) {
+                    layers.resize(layer + 1);
+                }
+                return layers[layer];
+            }
+        };
+
+        struct Registry {
+            std::mutex mutex;
+            std::vector<const char*> zones;
+            // Logs outlive their threads so exited workers still show up
+            std::vector<std::unique_ptr<ThreadLog>> logs;
+            size_t eventLimit = DEFAULT_EVENT_LIMIT;
+            const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+        };
+
+        Registry& registry() {
+            static Registry r;
+            return r;
+        }
+
+        int64_t now() {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - registry().epoch).count();
+        }
+
+        ThreadLog& threadLog() {
+            thread_local ThreadLog *log = nullptr;
+            if (log == nullptr) {
+                Registry &r = registry();
+                std::lock_guard<std::mutex> lock(r.mutex);
+                r.logs.push_back(std::make_unique<ThreadLog>());
+                log = r.logs.back().get();
+                log->thread = static_cast<uint32_t>(r.logs.size());
+                log->events.reserve(std::min<size_t>(r.eventLimit, 4096));
+            }
+            return *log;
+        }
+
+        // Writes s as the body of a JSON string
+        void writeEscaped(std::ostream &out, const char *s) {
+            for (; *s; ++s) {
+                if (*s == '"' || *s == '\\') {
+                    out << '\\';
+                }
+                out << *s;
+            }
+        }
+
+        std::string zoneLabel(const std::vector<const char*> &zones, size_t zone, size_t layer, size_t layerCount) {
+            std::string label = zones[zone];
+            if (layerCount > 1 || layer > 0) {
+                label += '[';
+                label += std::to_string(layer);
+                label += ']';
+            }
+            return label;
+        }
+    }
+
+    size_t zone(const char *name) {
+        Registry &r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        for (size_t i = 0; i < r.zones.size(); ++i) {
+            if (std::strcmp(r.zones[i], name) == 0) {
+                return i;
+            }
+        }
+        r.zones.push_back(name);
+        return r.zones.size() - 1;
+    }
+
+    Scope::Scope(size_t zone, size_t layer) : zoneId(zone), layer(layer), start(now()) {}
+
+    Scope::~Scope() {
+        const int64_t duration = now() - start;
+        ThreadLog &log = threadLog();
+        Stats &s = log.at(zoneId, layer);
+        ++s.calls;
+        s.totalNs += duration;
+        s.minNs = std::min(s.minNs, duration);
+        s.maxNs = std::max(s.maxNs, duration);
+        if (log.events.size() < registry().eventLimit) {
+            log.events.push_back({ static_cast<uint32_t>(zoneId), static_cast<uint32_t>(layer), start, duration });
+        } else {
+            ++log.droppedEvents;
+        }
+    }
+
+    void addWork(size_t zone, size_t layer, uint64_t flops, uint64_t bytes, uint64_t samples) {
+        Stats &s = threadLog().at(zone, layer);
+        s.flops += flops;
+        s.bytes += bytes;
+        s.samples += samples;
+    }
+
+    void writeSummary(std::ostream &out) {
+        Registry &r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        std::vector<std::vector<Stats>> total(r.zones.size());
+        uint64_t dropped = 0;
+        for (const auto &log : r.logs) {
+            dropped += log->droppedEvents;
+            for (size_t z = 0; z < log->stats.size(); ++z) {
+                if (total[z].size() < log->stats[z].size()) {
+                    total[z].resize(log->stats[z].size());
+                }
+                for (size_t l = 0; l < log->stats[z].size(); ++l) {
+                    const Stats &s = log->stats[z][l];
+                    Stats &t = total[z][l];
+                    t.calls += s.calls;
+                    t.totalNs += s.totalNs;
+                    t.minNs = std::min(t.minNs, s.minNs);
+                    t.maxNs = std::max(t.maxNs, s.maxNs);
+                    t.flops += s.flops;
+                    t.bytes += s.bytes;
+                    t.samples += s.samples;
+                }
+            }
+        }
+
+        const std::ios::fmtflags flags = out.flags();
+        out << std::left << std::setw(28) << "zone" << std::right
+            << std::setw(10) << "calls" << std::setw(12) << "total ms" << std::setw(12) << "mean us"
+            << std::setw(12) << "min us" << std::setw(12) << "max us" << std::setw(12) << "ns/sample"
+            << std::setw(10) << "GFLOP/s" << std::setw(10) << "GB/s" << "\n";
+        out << std::fixed;
+        for (size_t z = 0; z < total.size(); ++z) {
+            for (size_t l = 0; l < total[z].size(); ++l) {
+                const Stats &t = total[z][l];
+                if (t.calls == 0 && t.samples == 0) {
+                    continue;
+                }
+                const double ns = static_cast<double>(t.totalNs);
+                out << std::left << std::setw(28) << zoneLabel(r.zones, z, l, total[z].size()) << std::right
+                    << std::setw(10) << t.calls
+                    << std::setw(12) << std::setprecision(3) << ns * 1e-6
+                    << std::setw(12) << std::setprecision(2) << (t.calls ? ns * 1e-3 / static_cast<double>(t.calls) : 0.0)
+                    << std::setw(12) << (t.calls ? static_cast<double>(t.minNs) * 1e-3 : 0.0)
+                    << std::setw(12) << static_cast<double>(t.maxNs) * 1e-3
+                    << std::setw(12) << std::setprecision(1) << (t.samples ? ns / static_cast<double>(t.samples) : 0.0)
+                    << std::setw(10) << std::setprecision(2) << (t.totalNs > 0 ? static_cast<double>(t.flops) / ns : 0.0)
+                    << std::setw(10) << (t.totalNs > 0 ? static_cast<double>(t.bytes) / ns : 0.0) << "\n";
+            }
+        }
+        if (dropped > 0) {
+            out << dropped << " trace events over the limit were not kept\n";
+        }
+        out.flags(flags);
+    }
+
+    bool writeChromeTrace(const std::string &path) {
+        std::ofstream out(path);
+        if (!out) {
+            std::cout << "Could not create " << path << "\n";
+            return false;
+        }
+        Registry &r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+        out << std::fixed << std::setprecision(3);
+        bool first = true;
+        for (const auto &log : r.logs) {
+            for (const Event &e : log->events) {
+                const size_t layers = (e.zone < log->stats.size() ? log->stats[e.zone].size() : 1);
+                out << (first ? "\n" : ",\n") << "{\"name\":\"";
+                writeEscaped(out, zoneLabel(r.zones, e.zone, e.layer, layers).c_str());
+                out << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << log->thread
+                    << ",\"ts\":" << static_cast<double>(e.start) * 1e-3
+                    << ",\"dur\":" << static_cast<double>(e.duration) * 1e-3 << "}";
+                first = false;
+            }
+        }
+        out << "\n]}\n";
+        out.close();
+        if (!out) {
+            std::cout << "Could not write " << path << "\n";
+            return false;
+        }
+        return true;
+    }
+
+    void setEventLimit(size_t eventsPerThread) {
+        Registry &r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        r.eventLimit = eventsPerThread;
+    }
+
+    void reset() {
+        Registry &r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        for (const auto &log : r.logs) {
+            log->stats.clear();
+            log->events.clear();
+            log->droppedEvents = 0;
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,173 @@
+#include "QuantizedNet.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "kernels.h"
+
+namespace {
+    uint16_t toBf16(const float value) {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        // Round to nearest, ties to even
+        bits += 0x7FFFu + ((bits >> 16) & 1u);
+        return static_cast<uint16_t>(bits >> 16);
+    }
+
+    // Symmetric int8 with the scale that maps max |value| to 127
+    float quantizeRow(const float *values, int8_t *out, const size_t size) {
+        float maxAbs = 0;
+        for (size_t i = 0; i < size; ++i) {
+            maxAbs = std::max(maxAbs, std::abs(values[i]));
+        }
+        if (maxAbs == 0) {
+            std::fill(out, out + size, static_cast<int8_t>(0));
+            return 0;
+        }
+        const float inverse = 127.0f / maxAbs;
+        // Rounds half away from zero; unlike nearbyint this vectorizes
+        for (size_t i = 0; i < size; ++i) {
+            const float q = std::min(std::max(values[i] * inverse, -127.0f), 127.0f);
+            out[i] = static_cast<int8_t>(q + (q < 0 ? -0.5f : 0.5f));
+        }
+        return maxAbs / 127.0f;
+    }
+}
+
+bool QuantizedNet::quantize(const NeuralNet &net, const Precision precision) {
+    if (net.layers.size() < 2 || net.layers[0].weights.data == nullptr) {
+        std::cout << "QuantizedNet: the network has not been built.\n";
+        return false;
+    }
+    mode = precision;
+    activation = net.activation;
+    activationMin = net.activationMin;
+    activationMax = net.activationMax;
+    targetMin = net.targetMin;
+    targetMax = net.targetMax;
+
+    layers.clear();
+    layers.resize(net.layers.size() - 1);
+    size_t widest = 0;
+    for (size_t i = 0; i < layers.size(); ++i) {
+        const NeuralNet::Layer &source = net.layers[i];
+        Layer &layer = layers[i];
+        layer.sizeIn = source.sizeIn;
+        layer.sizeOut = source.sizeOut;
+        layer.biases.assign(source.biases.begin(), source.biases.end());
+        widest = std::max(widest, std::max(layer.sizeIn, layer.sizeOut));
+
+        if (mode == Precision::Int8) {
+            layer.stride = statpack::alignedStride<int8_t>(layer.sizeIn);
+            layer.weightsI8.assign(layer.sizeOut * layer.stride, 0);
+            layer.scales.resize(layer.sizeOut);
+            for (size_t k = 0; k < layer.sizeOut; ++k) {
+                layer.scales[k] = quantizeRow(source.weights.row(k), layer.weightsI8.data() + k * layer.stride, layer.sizeIn);
+            }
+        } else {
+            layer.stride = statpack::alignedStride<uint16_t>(layer.sizeIn);
+            layer.weightsBf16.assign(layer.sizeOut * layer.stride, 0);
+            for (size_t k = 0; k < layer.sizeOut; ++k) {
+                const float *row = source.weights.row(k);
+                uint16_t *out = layer.weightsBf16.data() + k * layer.stride;
+                for (size_t j = 0; j < layer.sizeIn; ++j) {
+                    out[j] = toBf16(row[j]);
+                }
+            }
+        }
+    }
+    nodes.assign(widest, 0);
+    nextNodes.assign(widest, 0);
+    quantizedNodes.assign(widest, 0);
+    return true;
+}
+
+void QuantizedNet::forward(const Layer &layer) {
+    if (mode == Precision::Int8) {
+        const float inputScale = quantizeRow(nodes.data(), quantizedNodes.data(), layer.sizeIn);
+        for (size_t k = 0; k < layer.sizeOut; ++k) {
+            const int32_t sum = statpack::kernels::dotI8(layer.weightsI8.data() + k * layer.stride, quantizedNodes.data(), layer.sizeIn);
+            nextNodes[k] = static_cast<float>(sum) * (layer.scales[k] * inputScale) + layer.biases[k];
+        }
+    } else {
+        for (size_t k = 0; k < layer.sizeOut; ++k) {
+            nextNodes[k] = statpack::kernels::dotBf16(layer.weightsBf16.data() + k * layer.stride, nodes.data(), layer.sizeIn) + layer.biases[k];
+        }
+    }
+    switch (activation) {
+        case NeuralNet::Activation::Relu:
+            statpack::kernels::relu(nextNodes.data(), nextNodes.data(), layer.sizeOut);
+            break;
+        default:
+            statpack::kernels::sigmoid(nextNodes.data(), nextNodes.data(), layer.sizeOut);
+            break;
+    }
+    nodes.swap(nextNodes);
+}
+
+void QuantizedNet::generate(statpack::Span<const float> inputs, statpack::Span<float> outputs) {
+#ifdef CUSTOM_DEBUG
+    assert(!layers.empty() && "QuantizedNet::quantize has not been called.");
+    assert(inputs.size() == inputSize() && "Input vector has an incorrect size.");
+    assert(outputs.size() >= outputSize() && "Output span is too small.");
+#endif
+    std::copy(inputs.begin(), inputs.end(), nodes.begin());
+    for (const Layer &layer : layers) {
+        forward(layer);
+    }
+    for (size_t i = 0; i < outputSize(); ++i) {
+        outputs[i] = statpack::normalize(nodes[i], activationMin, activationMax, targetMin, targetMax);
+    }
+}
+
+QuantizedNet::Drift QuantizedNet::drift(const NeuralNet &reference, statpack::MatrixView<const float> inputs) {
+    Drift result;
+    NeuralNet::Context context;
+    std::vector<float> expected(outputSize());
+    std::vector<float> actual(outputSize());
+    double sumAbs = 0;
+    double sumSquares = 0;
+    for (size_t r = 0; r < inputs.rows; ++r) {
+        reference.generate(context, inputs[r], statpack::Span<float>(expected.data(), expected.size()));
+        generate(inputs[r], statpack::Span<float>(actual.data(), actual.size()));
+        for (size_t i = 0; i < actual.size(); ++i) {
+            const float diff = std::abs(actual[i] - expected[i]);
+            result.maxAbs = std::max(result.maxAbs, diff);
+            sumAbs += diff;
+            sumSquares += static_cast<double>(diff) * diff;
+        }
+    }
+    const double count = static_cast<double>(inputs.rows * outputSize());
+    result.samples = inputs.rows;
+    if (count > 0) {
+        result.meanAbs = static_cast<float>(sumAbs / count);
+        result.rms = static_cast<float>(std::sqrt(sumSquares / count));
+    }
+    return result;
+}
+
+size_t QuantizedNet::inputSize() const {
+    return (layers.empty() ? 0 : layers.front().sizeIn);
+}
+
+size_t QuantizedNet::outputSize() const {
+    return (layers.empty() ? 0 : layers.back().sizeOut);
+}
+
+size_t QuantizedNet::parameterBytes() const {
+    size_t bytes = 0;
+    for (const Layer &layer : layers) {
+        bytes += layer.weightsI8.size() * sizeof(int8_t) + layer.weightsBf16.size() * sizeof(uint16_t)
+               + (layer.scales.size() + layer.biases.size()) * sizeof(float);
+    }
+    return bytes;
+}
+
+size_t QuantizedNet::floatParameterBytes() const {
+    size_t bytes = 0;
+    for (const Layer &layer : layers) {
+        bytes += (layer.sizeOut * statpack::alignedStride<float>(layer.sizeIn) + layer.sizeOut) * sizeof(float);
+    }
+    return bytes;
+}
@@ -0,0 +1,136 @@
+#include "Rng.h"
+
+#include <cmath>
+#include <algorithm>
+
+namespace statpack {
+    namespace {
+        uint64_t splitMix64(uint64_t &x) {
+            uint64_t z = (x += 0x9E3779B97F4A7C15ull);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+            return z ^ (z >> 31);
+        }
+    }
+
+    Rng::Rng(uint64_t seed, uint64_t stream) {
+        this->seed(seed, stream);
+    }
+
+    void Rng::seed(uint64_t seed, uint64_t stream) {
+        // Every lane of every stream gets its own SplitMix64 expansion
+        uint64_t mixer = seed;
+        uint64_t streamMixer = stream;
+        mixer ^= splitMix64(streamMixer);
+        for (size_t lane = 0; lane < LANES; ++lane) {
+            uint32_t words[4];
+            for (size_t w = 0; w < 4; w += 2) {
+                const uint64_t value = splitMix64(mixer);
+                words[w] = static_cast<uint32_t>(value);
+                words[w + 1] = static_cast<uint32_t>(value >> 32);
+            }
+            // xoshiro must not start from all zeros
+            if ((words[0] | words[1] | words[2] | words[3]) == 0) {
+                words[0] = 1;
+            }
+            for (size_t w = 0; w < 4; ++w) {
+                state[w * LANES + lane] = words[w];
+            }
+        }
+        nextBits = LANES;
+        nextNormal = 2 * LANES;
+    }
+
+    int32_t Rng::uniformInt(int32_t min, int32_t max) {
+        const uint64_t range = static_cast<uint64_t>(static_cast<int64_t>(max) - static_cast<int64_t>(min)) + 1;
+        if (range > UINT32_MAX) {
+            return static_cast<int32_t>(static_cast<int64_t>(min) + (*this)());
+        }
+        // Lemire's multiply and reject
+        uint64_t product = static_cast<uint64_t>((*this)()) * range;
+        if (static_cast<uint32_t>(product) < range) {
+            const uint32_t threshold = static_cast<uint32_t>((UINT32_MAX - range + 1) % range);
+            while (static_cast<uint32_t>(product) < threshold) {
+                product = static_cast<uint64_t>((*this)()) * range;
+            }
+        }
+        return static_cast<int32_t>(static_cast<int64_t>(min) + static_cast<int64_t>(product >> 32));
+    }
+
+    double Rng::uniformDouble(double min, double max) {
+        const uint64_t high = (*this)();
+        const uint64_t word = (high << 32) | (*this)();
+        const double unit = static_cast<double>(word >> 11) * 1.1102230246251565e-16;
+        return min + (max - min) * unit;
+    }
+
+    float Rng::normal(float mean, float stddev) {
+        if (nextNormal == 2 * LANES) {
+            kernels::randomNormal(state, normals, 1, 0.0f, 1.0f);
+            nextNormal = 0;
+        }
+        return mean + stddev * normals[nextNormal++];
+    }
+
+    void Rng::fillUniform(Span<float> out, float min, float max) {
+        const size_t blocks = out.size() / LANES;
+        kernels::randomUniform(state, out.data(), blocks, max - min, min);
+        const size_t done = blocks * LANES;
+        if (done < out.size()) {
+            float tail[LANES];
+            kernels::randomUniform(state, tail, 1, max - min, min);
+            std::copy(tail, tail + (out.size() - done), out.data() + done);
+        }
+    }
+
+    void Rng::fillNormal(Span<float> out, float mean, float stddev) {
+        constexpr size_t BLOCK = 2 * LANES;
+        const size_t blocks = out.size() / BLOCK;
+        kernels::randomNormal(state, out.data(), blocks, mean, stddev);
+        const size_t done = blocks * BLOCK;
+        if (done < out.size()) {
+            float tail[BLOCK];
+            kernels::randomNormal(state, tail, 1, mean, stddev);
+            std::copy(tail, tail + (out.size() - done), out.data() + done);
+        }
+    }
+
+    void Rng::fillUniform(const MatrixView<float> &out, float min, float max) {
+        // Padding-free matrices are one contiguous fill
+        if (out.stride == out.cols) {
+            fillUniform(Span<float>(out.data, out.rows * out.cols), min, max);
+            return;
+        }
+        for (size_t r = 0; r < out.rows; ++r) {
+            fillUniform(out[r], min, max);
+        }
+    }
+
+    void Rng::fillNormal(const MatrixView<float> &out, float mean, float stddev) {
+        if (out.stride == out.cols) {
+            fillNormal(Span<float>(out.data, out.rows * out.cols), mean, stddev);
+            return;
+        }
+        for (size_t r = 0; r < out.rows; ++r) {
+            fillNormal(out[r], mean, stddev);
+        }
+    }
+
+    void xavierUniform(Rng &rng, const MatrixView<float> &weights) {
+        const float limit = std::sqrt(6.0f / static_cast<float>(weights.rows + weights.cols));
+        rng.fillUniform(weights, -limit, limit);
+    }
+
+    void xavierNormal(Rng &rng, const MatrixView<float> &weights) {
+        rng.fillNormal(weights, 0.0f, std::sqrt(2.0f / static_cast<float>(weights.rows + weights.cols)));
+    }
+
+    void heUniform(Rng &rng, const MatrixView<float> &weights) {
+        const float limit = std::sqrt(6.0f / static_cast<float>(weights.cols));
+        rng.fillUniform(weights, -limit, limit);
+    }
+
+    void heNormal(Rng &rng, const MatrixView<float> &weights) {
+        rng.fillNormal(weights, 0.0f, std::sqrt(2.0f / static_cast<float>(weights.cols)));
+    }
+}
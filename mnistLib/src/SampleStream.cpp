@@ -0,0 +1,408 @@
+#include "SampleStream.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace mnistParser {
+    namespace {
+        // Consumed file bytes are dropped from the page cache in steps of this size
+        constexpr const uint64_t DROP_CHUNK = 64ull << 20;
+    }
+
+    StreamReader::~StreamReader() {
+        close();
+    }
+
+    bool StreamReader::open(const std::string &path) {
+        close();
+        if (path == "-") {
+            fd = STDIN_FILENO;
+            ownsFd = false;
+        } else {
+            fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            ownsFd = true;
+            if (fd < 0) {
+                std::cout << "Could not open " << path << "\n";
+                return false;
+            }
+        }
+        streamPath = path;
+        struct stat info;
+        if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode)) {
+            regular = true;
+            size = static_cast<uint64_t>(info.st_size);
+            posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        }
+        if (!buffer) {
+            buffer = std::make_unique<uint8_t[]>(BUFFER_SIZE);
+        }
+        return true;
+    }
+
+    void StreamReader::close() {
+        if (fd >= 0 && ownsFd) {
+            ::close(fd);
+        }
+        fd = -1;
+        ownsFd = false;
+        regular = false;
+        eof = false;
+        error = false;
+        size = 0;
+        consumed = 0;
+        dropped = 0;
+        streamPath.clear();
+        head = 0;
+        tail = 0;
+    }
+
+    size_t StreamReader::read(void *out, size_t bytes) {
+        uint8_t *dst = static_cast<uint8_t*>(out);
+        size_t done = 0;
+        while (done < bytes) {
+            if (head == tail) {
+                if (eof || error || fd < 0) {
+                    break;
+                }
+                // Large reads skip the buffer
+                if (bytes - done >= BUFFER_SIZE) {
+                    const size_t n = fetch(dst + done, bytes - done);
+                    if (n == 0) {
+                        break;
+                    }
+                    done += n;
+                    continue;
+                }
+                head = 0;
+                tail = fetch(buffer.get(), BUFFER_SIZE);
+                continue;
+            }
+            const size_t n = std::min(tail - head, bytes - done);
+            std::memcpy(dst + done, buffer.get() + head, n);
+            head += n;
+            done += n;
+        }
+        consumed += done;
+        dropConsumed();
+        return done;
+    }
+
+    size_t StreamReader::fetch(void *out, size_t bytes) {
+        while (true) {
+            const ssize_t n = ::read(fd, out, bytes);
+            if (n > 0) {
+                return static_cast<size_t>(n);
+            }
+            if (n == 0) {
+                eof = true;
+                return 0;
+            }
+            if (errno != EINTR) {
+                std::cout << "Could not read " << streamPath << ": " << std::strerror(errno) << "\n";
+                error = true;
+                return 0;
+            }
+        }
+    }
+
+    void StreamReader::dropConsumed() {
+        if (!regular || consumed - dropped < DROP_CHUNK) {
+            return;
+        }
+        const uint64_t end = consumed / DROP_CHUNK * DROP_CHUNK;
+        posix_fadvise(fd, static_cast<off_t>(dropped), static_cast<off_t>(end - dropped), POSIX_FADV_DONTNEED);
+        dropped = end;
+    }
+
+    bool IdxStream::open(const std::string &imagePath, const std::string &labelPath, const Config &config) {
+        MNIST_PROFILE_SCOPE("IdxStream::open");
+        close();
+        settings = config;
+        int32_t dims[3] = {};
+        if (!images.open(imagePath) || !readHeader(images, IMAGE_MAGIC, dims, 3)) {
+            close();
+            return false;
+        }
+        declared = dims[0];
+        imageRows = dims[1];
+        imageCols = dims[2];
+        pixels = static_cast<size_t>(imageRows) * static_cast<size_t>(imageCols);
+        if (pixels == 0) {
+            std::cout << imagePath << " declares empty images!\n";
+            close();
+            return false;
+        }
+        if (images.isFile() && images.fileSize() < images.position() + pixels * static_cast<uint64_t>(declared)) {
+            std::cout << imagePath << " is shorter than its header declares!\n";
+            close();
+            return false;
+        }
+        if (!labelPath.empty()) {
+            int32_t labelCount = 0;
+            if (!labels.open(labelPath) || !readHeader(labels, LABEL_MAGIC, &labelCount, 1)) {
+                close();
+                return false;
+            }
+            if (labelCount != declared) {
+                std::cout << labelPath << " has " << labelCount << " labels for " << declared << " images!\n";
+                close();
+                return false;
+            }
+            if (labels.isFile() && labels.fileSize() < labels.position() + static_cast<uint64_t>(declared)) {
+                std::cout << labelPath << " is shorter than its header declares!\n";
+                close();
+                return false;
+            }
+            if (settings.classes == 0) {
+                std::cout << "One-hot targets need at least one class!\n";
+                close();
+                return false;
+            }
+        }
+        rowBytes.resize(pixels);
+        return true;
+    }
+
+    bool IdxStream::open(const std::string &imagePath, const std::string &labelPath) {
+        return open(imagePath, labelPath, Config());
+    }
+
+    void IdxStream::close() {
+        images.close();
+        labels.close();
+        declared = 0;
+        imageRows = 0;
+        imageCols = 0;
+        pixels = 0;
+        error = false;
+        samplesRead = 0;
+    }
+
+    bool IdxStream::readHeader(StreamReader &reader, int32_t expectedMagic, int32_t *dims, size_t dimCount) {
+        int32_t raw[4];
+        const size_t headerBytes = 4 * (dimCount + 1);
+        if (reader.read(raw, headerBytes) != headerBytes) {
+            std::cout << reader.path() << " is too small to be an IDX file!\n";
+            return false;
+        }
+        const int32_t magic = flipInt32(raw[0]);
+        if (magic != expectedMagic) {
+            std::cout << reader.path() << " has magic number " << magic << ", expected " << expectedMagic << "\n";
+            return false;
+        }
+        for (size_t i = 0; i < dimCount; ++i) {
+            dims[i] = flipInt32(raw[i + 1]);
+            if (dims[i] < 0) {
+                std::cout << reader.path() << " has a negative dimension!\n";
+                return false;
+            }
+        }
+        return true;
+    }
+
+    size_t IdxStream::read(const statpack::MatrixView<float> &inputs, const statpack::MatrixView<float> &targets) {
+        if (!isOpen() || error) {
+            return 0;
+        }
+#ifdef CUSTOM_DEBUG
+        assert(inputs.cols >= pixels && "Input matrix too narrow.");
+        assert((!hasLabels() || (targets.rows >= inputs.rows && targets.cols >= settings.classes)) && "Target matrix too small.");
+#endif
+        const size_t wanted = static_cast<size_t>(std::min<uint64_t>(inputs.rows, static_cast<uint64_t>(declared) - samplesRead));
+        MNIST_PROFILE_SCOPE("IdxStream::read");
+        MNIST_PROFILE_WORK("IdxStream::read", 0, 2 * wanted * pixels, 5 * wanted * pixels, wanted);
+        size_t n = 0;
+        for (; n < wanted; ++n) {
+            if (images.read(rowBytes.data(), pixels) != pixels) {
+                std::cout << images.path() << " ends after " << samplesRead + n << " of " << declared << " images!\n";
+                error = true;
+                break;
+            }
+            decodePixels(rowBytes.data(), inputs.row(n), pixels, settings.normMin, settings.normMax);
+            if (hasLabels()) {
+                uint8_t label = 0;
+                if (labels.read(&label, 1) != 1) {
+                    std::cout << labels.path() << " ends after " << samplesRead + n << " of " << declared << " labels!\n";
+                    error = true;
+                    break;
+                }
+                if (label >= settings.classes) {
+                    std::cout << labels.path() << " has label " << static_cast<int>(label) << " at " << samplesRead + n
+                              << ", more than " << settings.classes << " classes!\n";
+                    error = true;
+                    break;
+                }
+                float *target = targets.row(n);
+                std::fill(target, target + settings.classes, settings.targetMin);
+                target[label] = settings.targetMax;
+            }
+        }
+        samplesRead += n;
+        return n;
+    }
+
+    bool FloatStream::open(const std::string &path) {
+        close();
+        if (!reader.open(path)) {
+            return false;
+        }
+        if (reader.read(&fileHeader, sizeof(fileHeader)) != sizeof(fileHeader)) {
+            std::cout << path << " is too small to hold a sample stream header!\n";
+            close();
+            return false;
+        }
+        if (fileHeader.magic != MAGIC || fileHeader.version != VERSION) {
+            std::cout << path << " is not a version " << VERSION << " sample stream!\n";
+            close();
+            return false;
+        }
+        if (fileHeader.inputSize == 0 || fileHeader.inputSize > MAX_RECORD_FLOATS || fileHeader.targetSize > MAX_RECORD_FLOATS) {
+            std::cout << path << " declares records of " << fileHeader.inputSize << " inputs and "
+                      << fileHeader.targetSize << " targets!\n";
+            close();
+            return false;
+        }
+        if (reader.isFile()) {
+            const uint64_t recordBytes = (static_cast<uint64_t>(fileHeader.inputSize) + fileHeader.targetSize) * sizeof(float);
+            const uint64_t payload = reader.fileSize() - sizeof(fileHeader);
+            if (fileHeader.count != 0 ? payload / recordBytes < fileHeader.count : payload % recordBytes != 0) {
+                std::cout << path << " does not hold the records its header declares!\n";
+                close();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void FloatStream::close() {
+        reader.close();
+        fileHeader = Header();
+        error = false;
+        samplesRead = 0;
+    }
+
+    size_t FloatStream::read(const statpack::MatrixView<float> &inputs, const statpack::MatrixView<float> &targets) {
+        if (!isOpen() || error) {
+            return 0;
+        }
+        const size_t inputBytes = fileHeader.inputSize * sizeof(float);
+        const size_t targetBytes = fileHeader.targetSize * sizeof(float);
+#ifdef CUSTOM_DEBUG
+        assert(inputs.cols >= fileHeader.inputSize && "Input matrix too narrow.");
+        assert((targetBytes == 0 || (targets.rows >= inputs.rows && targets.cols >= fileHeader.targetSize)) && "Target matrix too small.");
+#endif
+        size_t wanted = inputs.rows;
+        if (fileHeader.count != 0) {
+            wanted = static_cast<size_t>(std::min<uint64_t>(wanted, fileHeader.count - samplesRead));
+        }
+        MNIST_PROFILE_SCOPE("FloatStream::read");
+        size_t n = 0;
+        for (; n < wanted; ++n) {
+            const size_t got = reader.read(inputs.row(n), inputBytes);
+            // An unbounded stream ends cleanly between records
+            if (got == 0 && fileHeader.count == 0 && !reader.failed()) {
+                break;
+            }
+            if (got != inputBytes || (targetBytes != 0 && reader.read(targets.row(n), targetBytes) != targetBytes)) {
+                if (fileHeader.count != 0) {
+                    std::cout << reader.path() << " ends after " << samplesRead + n << " of " << fileHeader.count << " records!\n";
+                } else {
+                    std::cout << reader.path() << " ends inside record " << samplesRead + n << "!\n";
+                }
+                error = true;
+                break;
+            }
+        }
+        samplesRead += n;
+        return n;
+    }
+
+    StreamBatcher::StreamBatcher(SampleSource &source, size_t batchSize, uint64_t limit) :
+        source(source),
+        batchSize(std::max<size_t>(batchSize, 1)),
+        limit(limit),
+        inputStride(statpack::alignedStride<float>(source.inputSize())),
+        targetStride(statpack::alignedStride<float>(source.targetSize()))
+    {
+        for (Slot &slot : slots) {
+            slot.inputs.assign(this->batchSize * inputStride, 0.0f);
+            slot.targets.assign(this->batchSize * targetStride, 0.0f);
+        }
+        reader = std::thread(&StreamBatcher::readLoop, this);
+    }
+
+    StreamBatcher::~StreamBatcher() {
+        stop();
+    }
+
+    bool StreamBatcher::next(statpack::MatrixView<const float> &inputs, statpack::MatrixView<const float> &targets) {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (holding) {
+            slots[consumed % 2].ready = false;
+            ++consumed;
+            holding = false;
+            changed.notify_all();
+        }
+        Slot &slot = slots[consumed % 2];
+        changed.wait(lock, [&] { return slot.ready || finished || stopping; });
+        if (!slot.ready || stopping) {
+            return false;
+        }
+        holding = true;
+        inputs = statpack::MatrixView<const float>(slot.inputs.data(), slot.rows, source.inputSize(), inputStride);
+        targets = statpack::MatrixView<const float>(slot.targets.data(), slot.rows, source.targetSize(), targetStride);
+        return true;
+    }
+
+    void StreamBatcher::stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        changed.notify_all();
+        // Waits for a read in progress, which on a pipe lasts until the writer sends or closes
+        if (reader.joinable()) {
+            reader.join();
+        }
+    }
+
+    void StreamBatcher::readLoop() {
+        uint64_t total = 0;
+        for (uint64_t sequence = 0; ; ++sequence) {
+            Slot &slot = slots[sequence % 2];
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&] { return !slot.ready || stopping; });
+                if (stopping) {
+                    return;
+                }
+            }
+            // The consumer is done with this slot and does not touch it until it is ready again
+            const size_t wanted = (limit != 0 ? static_cast<size_t>(std::min<uint64_t>(batchSize, limit - total)) : batchSize);
+            const size_t rows = source.read(statpack::MatrixView<float>(slot.inputs.data(), wanted, source.inputSize(), inputStride),
+                                            statpack::MatrixView<float>(slot.targets.data(), wanted, source.targetSize(), targetStride));
+            total += rows;
+            const bool last = (rows < wanted || (limit != 0 && total == limit));
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (rows > 0) {
+                    slot.rows = rows;
+                    slot.ready = true;
+                }
+                finished = last;
+            }
+            changed.notify_all();
+            if (last) {
+                return;
+            }
+        }
+    }
+}
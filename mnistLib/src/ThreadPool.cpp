@@ -0,0 +1,80 @@
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(size_t threads) {
+    const size_t participants = (threads == 0 ? 1 : threads);
+    workers.reserve(participants - 1);
+    for (size_t i = 1; i < participants; ++i) {
+        workers.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto &worker : workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::run(size_t total, size_t grain, Task job, void *jobContext) {
+    if (grain == 0) {
+        grain = 1;
+    }
+    size_t chunkSize = (total + size() - 1) / size();
+    chunkSize = (chunkSize + grain - 1) / grain * grain;
+    if (workers.empty() || chunkSize >= total) {
+        job(jobContext, 0, total);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        task = job;
+        context = jobContext;
+        count = total;
+        chunk = chunkSize;
+        pending = workers.size();
+        ++generation;
+    }
+    wake.notify_all();
+
+    job(jobContext, 0, chunkSize);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [this] { return pending == 0; });
+}
+
+void ThreadPool::workerLoop(size_t index) {
+    uint64_t seen = 0;
+    while (true) {
+        Task job;
+        void *jobContext;
+        size_t begin;
+        size_t end;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) {
+                return;
+            }
+            seen = generation;
+            job = task;
+            jobContext = context;
+            begin = index * chunk;
+            end = (begin + chunk < count ? begin + chunk : count);
+        }
+        if (begin < end) {
+            job(jobContext, begin, end);
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            --pending;
+            if (pending == 0) {
+                finished.notify_one();
+            }
+        }
+    }
+}
@@ -0,0 +1,200 @@
+#include "kernels.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+
+namespace statpack::kernels {
+    namespace scalar {
+        struct V {
+            using Reg = float;
+            static constexpr size_t WIDTH = 1;
+            static constexpr size_t GEMM_VECTORS = 4;
+
+            static Reg zero() { return 0.0f; }
+            static Reg set1(float x) { return x; }
+            static Reg loadu(const float *p) { return *p; }
+            static Reg loadBytes(const uint8_t *p) { return static_cast<float>(*p); }
+            static void storeu(float *p, Reg r) { *p = r; }
+            static Reg add(Reg a, Reg b) { return a + b; }
+            static Reg sub(Reg a, Reg b) { return a - b; }
+            static Reg mul(Reg a, Reg b) { return a * b; }
+            static Reg div(Reg a, Reg b) { return a / b; }
+            static Reg sqrt(Reg a) { return std::sqrt(a); }
+            static Reg min(Reg a, Reg b) { return (b < a ? b : a); }
+            static Reg max(Reg a, Reg b) { return (a < b ? b : a); }
+            static Reg round(Reg a) { return std::nearbyint(a); }
+            static Reg pow2(Reg n) {
+                const uint32_t bits = static_cast<uint32_t>(static_cast<int32_t>(n) + 127) << 23;
+                float out;
+                std::memcpy(&out, &bits, sizeof(out));
+                return out;
+            }
+            static Reg step(Reg a) { return (a > 0.0f ? 1.0f : 0.0f); }
+            static Reg fmadd(Reg a, Reg b, Reg c) { return a * b + c; }
+            static float fmaScalar(float a, float b, float c) { return a * b + c; }
+            static float hsum(Reg r) { return r; }
+            static Reg loadBf16(const uint16_t *p) {
+                const uint32_t bits = static_cast<uint32_t>(*p) << 16;
+                float out;
+                std::memcpy(&out, &bits, sizeof(out));
+                return out;
+            }
+
+            using IReg = int32_t;
+            static constexpr size_t BYTE_WIDTH = 1;
+            static IReg izero() { return 0; }
+            static int32_t ihsum(IReg r) { return r; }
+            static IReg dotBytes(const int8_t *a, const int8_t *b, IReg acc) {
+                return acc + static_cast<int32_t>(*a) * static_cast<int32_t>(*b);
+            }
+
+            using UReg = uint32_t;
+            static UReg uset1(uint32_t x) { return x; }
+            static UReg uloadu(const uint32_t *p) { return *p; }
+            static void ustoreu(uint32_t *p, UReg r) { *p = r; }
+            static UReg uadd(UReg a, UReg b) { return a + b; }
+            static UReg uand(UReg a, UReg b) { return a & b; }
+            static UReg uor(UReg a, UReg b) { return a | b; }
+            static UReg uxor(UReg a, UReg b) { return a ^ b; }
+            template <int K> static UReg ushl(UReg a) { return a << K; }
+            template <int K> static UReg ushr(UReg a) { return a >> K; }
+            static Reg toFloat(UReg a) { return static_cast<float>(static_cast<int32_t>(a)); }
+            static UReg asBits(Reg a) {
+                uint32_t bits;
+                std::memcpy(&bits, &a, sizeof(bits));
+                return bits;
+            }
+            static Reg asFloat(UReg a) {
+                float out;
+                std::memcpy(&out, &a, sizeof(out));
+                return out;
+            }
+        };
+
+#include "kernelsImpl.h"
+
+        const KernelTable TABLE = {
+            dotImpl<V>,
+            axpyImpl<V>,
+            scaledUpdateImpl<V>,
+            gemmAccumulateImpl<V>,
+            sigmoidImpl<V>,
+            dSigmoidImpl<V>,
+            reluImpl<V>,
+            dReluImpl<V>,
+            decodeBytesImpl<V>,
+            dotBf16Impl<V>,
+            dotI8Impl<V>,
+            momentumUpdateImpl<V>,
+            rmsPropUpdateImpl<V>,
+            adamUpdateImpl<V>,
+            randomBitsImpl<V>,
+            randomUniformImpl<V>,
+            randomNormalImpl<V>,
+        };
+    }
+
+#ifdef MNIST_KERNELS_X86
+    // Defined in kernelsSse2.cpp, kernelsAvx2.cpp and kernelsAvx512.cpp
+    const KernelTable& sse2Table();
+    const KernelTable& avx2Table();
+    const KernelTable& avx512Table();
+#endif
+
+    namespace {
+        const KernelTable& tableFor(Isa isa) {
+            switch (isa) {
+#ifdef MNIST_KERNELS_X86
+                case Isa::AVX512:
+                    return avx512Table();
+                case Isa::AVX2:
+                    return avx2Table();
+                case Isa::SSE2:
+                    return sse2Table();
+#endif
+                default:
+                    return scalar::TABLE;
+            }
+        }
+
+        Isa detectIsa() {
+#ifdef MNIST_KERNELS_X86
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx512f")) {
+                return Isa::AVX512;
+            }
+            if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+                return Isa::AVX2;
+            }
+            if (__builtin_cpu_supports("sse2")) {
+                return Isa::SSE2;
+            }
+#endif
+            return Isa::Scalar;
+        }
+
+        // MNIST_KERNELS=scalar|sse2|avx2|avx512 narrows the detected set
+        Isa initialIsa() {
+            const Isa supported = detectIsa();
+            const char *env = std::getenv("MNIST_KERNELS");
+            if (env == nullptr) {
+                return supported;
+            }
+            for (Isa isa : { Isa::Scalar, Isa::SSE2, Isa::AVX2, Isa::AVX512 }) {
+                if (std::strcmp(env, isaName(isa)) == 0) {
+                    return (isa < supported ? isa : supported);
+                }
+            }
+            return supported;
+        }
+
+        struct State {
+            Isa supported;
+            Isa active;
+            const KernelTable *table;
+        };
+
+        State& state() {
+            static State s = [] {
+                const Isa active = initialIsa();
+                return State{ detectIsa(), active, &tableFor(active) };
+            }();
+            return s;
+        }
+    }
+
+    const KernelTable& table() {
+        return *state().table;
+    }
+
+    Isa activeIsa() {
+        return state().active;
+    }
+
+    Isa supportedIsa() {
+        return state().supported;
+    }
+
+    Isa setIsa(Isa isa) {
+        State &s = state();
+        s.active = (isa < s.supported ? isa : s.supported);
+        s.table = &tableFor(s.active);
+        return s.active;
+    }
+
+    const char* isaName(Isa isa) {
+        switch (isa) {
+            case Isa::SSE2:
+                return "sse2";
+            case Isa::AVX2:
+                return "avx2";
+            case Isa::AVX512:
+                return "avx512";
+            default:
+                return "scalar";
+        }
+    }
+}
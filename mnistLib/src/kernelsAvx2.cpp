@@ -0,0 +1,109 @@
+#include "kernels.h"
+
+#include <immintrin.h>
+#include <cstdint>
+#include <cstring>
+
+// Compiled with -mavx2 -mfma, only reached after a CPUID check
+namespace statpack::kernels {
+    namespace avx2 {
+        struct V {
+            using Reg = __m256;
+            static constexpr size_t WIDTH = 8;
+            static constexpr size_t GEMM_VECTORS = 2;
+
+            static Reg zero() { return _mm256_setzero_ps(); }
+            static Reg set1(float x) { return _mm256_set1_ps(x); }
+            static Reg loadu(const float *p) { return _mm256_loadu_ps(p); }
+            static Reg loadBytes(const uint8_t *p) {
+                return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p))));
+            }
+            static void storeu(float *p, Reg r) { _mm256_storeu_ps(p, r); }
+            static Reg add(Reg a, Reg b) { return _mm256_add_ps(a, b); }
+            static Reg sub(Reg a, Reg b) { return _mm256_sub_ps(a, b); }
+            static Reg mul(Reg a, Reg b) { return _mm256_mul_ps(a, b); }
+            static Reg div(Reg a, Reg b) { return _mm256_div_ps(a, b); }
+            static Reg sqrt(Reg a) { return _mm256_sqrt_ps(a); }
+            static Reg min(Reg a, Reg b) { return _mm256_min_ps(a, b); }
+            static Reg max(Reg a, Reg b) { return _mm256_max_ps(a, b); }
+            static Reg round(Reg a) { return _mm256_round_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+            static Reg pow2(Reg n) {
+                return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23));
+            }
+            static Reg step(Reg a) { return _mm256_and_ps(_mm256_cmp_ps(a, _mm256_setzero_ps(), _CMP_GT_OQ), _mm256_set1_ps(1.0f)); }
+            static Reg fmadd(Reg a, Reg b, Reg c) { return _mm256_fmadd_ps(a, b, c); }
+            static float fmaScalar(float a, float b, float c) { return __builtin_fmaf(a, b, c); }
+            static float hsum(Reg r) {
+                __m128 low = _mm256_castps256_ps128(r);
+                const __m128 high = _mm256_extractf128_ps(r, 1);
+                low = _mm_add_ps(low, high);
+                low = _mm_add_ps(low, _mm_movehl_ps(low, low));
+                return _mm_cvtss_f32(_mm_add_ss(low, _mm_shuffle_ps(low, low, 1)));
+            }
+            static Reg loadBf16(const uint16_t *p) {
+                const __m256i words = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+                return _mm256_castsi256_ps(_mm256_slli_epi32(words, 16));
+            }
+
+            using IReg = __m256i;
+            static constexpr size_t BYTE_WIDTH = 32;
+            static IReg izero() { return _mm256_setzero_si256(); }
+            static int32_t ihsum(IReg r) {
+                __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(r), _mm256_extracti128_si256(r, 1));
+                sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+                sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+                return _mm_cvtsi128_si32(sum);
+            }
+            /**
+             *  maddubs multiplies unsigned by signed bytes, so b's signs move
+             *  onto a first. With both in [-127, 127] the pair sums stay below
+             *  the int16 saturation limit, which -128 would break.
+             */
+            static IReg dotBytes(const int8_t *a, const int8_t *b, IReg acc) {
+                const __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a));
+                const __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b));
+                const __m256i pairs = _mm256_maddubs_epi16(_mm256_abs_epi8(y), _mm256_sign_epi8(x, y));
+                return _mm256_add_epi32(acc, _mm256_madd_epi16(pairs, _mm256_set1_epi16(1)));
+            }
+
+            using UReg = __m256i;
+            static UReg uset1(uint32_t x) { return _mm256_set1_epi32(static_cast<int32_t>(x)); }
+            static UReg uloadu(const uint32_t *p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+            static void ustoreu(uint32_t *p, UReg r) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), r); }
+            static UReg uadd(UReg a, UReg b) { return _mm256_add_epi32(a, b); }
+            static UReg uand(UReg a, UReg b) { return _mm256_and_si256(a, b); }
+            static UReg uor(UReg a, UReg b) { return _mm256_or_si256(a, b); }
+            static UReg uxor(UReg a, UReg b) { return _mm256_xor_si256(a, b); }
+            template <int K> static UReg ushl(UReg a) { return _mm256_slli_epi32(a, K); }
+            template <int K> static UReg ushr(UReg a) { return _mm256_srli_epi32(a, K); }
+            static Reg toFloat(UReg a) { return _mm256_cvtepi32_ps(a); }
+            static UReg asBits(Reg a) { return _mm256_castps_si256(a); }
+            static Reg asFloat(UReg a) { return _mm256_castsi256_ps(a); }
+        };
+
+#include "kernelsImpl.h"
+    }
+
+    const KernelTable& avx2Table() {
+        static const KernelTable table = {
+            avx2::dotImpl<avx2::V>,
+            avx2::axpyImpl<avx2::V>,
+            avx2::scaledUpdateImpl<avx2::V>,
+            avx2::gemmAccumulateImpl<avx2::V>,
+            avx2::sigmoidImpl<avx2::V>,
+            avx2::dSigmoidImpl<avx2::V>,
+            avx2::reluImpl<avx2::V>,
+            avx2::dReluImpl<avx2::V>,
+            avx2::decodeBytesImpl<avx2::V>,
+            avx2::dotBf16Impl<avx2::V>,
+            avx2::dotI8Impl<avx2::V>,
+            avx2::momentumUpdateImpl<avx2::V>,
+            avx2::rmsPropUpdateImpl<avx2::V>,
+            avx2::adamUpdateImpl<avx2::V>,
+            avx2::randomBitsImpl<avx2::V>,
+            avx2::randomUniformImpl<avx2::V>,
+            avx2::randomNormalImpl<avx2::V>,
+        };
+        return table;
+    }
+}
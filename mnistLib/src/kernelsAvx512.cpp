@@ -0,0 +1,103 @@
+#include "kernels.h"
+
+#include <immintrin.h>
+#include <cstdint>
+#include <cstring>
+
+// Compiled with -mavx512f, only reached after a CPUID check
+namespace statpack::kernels {
+    namespace avx512 {
+        struct V {
+            using Reg = __m512;
+            static constexpr size_t WIDTH = 16;
+            static constexpr size_t GEMM_VECTORS = 2;
+
+            static Reg zero() { return _mm512_setzero_ps(); }
+            static Reg set1(float x) { return _mm512_set1_ps(x); }
+            static Reg loadu(const float *p) { return _mm512_loadu_ps(p); }
+            static Reg loadBytes(const uint8_t *p) {
+                return _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))));
+            }
+            static void storeu(float *p, Reg r) { _mm512_storeu_ps(p, r); }
+            static Reg add(Reg a, Reg b) { return _mm512_add_ps(a, b); }
+            static Reg sub(Reg a, Reg b) { return _mm512_sub_ps(a, b); }
+            static Reg mul(Reg a, Reg b) { return _mm512_mul_ps(a, b); }
+            static Reg div(Reg a, Reg b) { return _mm512_div_ps(a, b); }
+            static Reg sqrt(Reg a) { return _mm512_sqrt_ps(a); }
+            static Reg min(Reg a, Reg b) { return _mm512_min_ps(a, b); }
+            static Reg max(Reg a, Reg b) { return _mm512_max_ps(a, b); }
+            static Reg round(Reg a) { return _mm512_roundscale_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+            static Reg pow2(Reg n) {
+                return _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_add_epi32(_mm512_cvtps_epi32(n), _mm512_set1_epi32(127)), 23));
+            }
+            static Reg step(Reg a) {
+                return _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(a, _mm512_setzero_ps(), _CMP_GT_OQ), _mm512_set1_ps(1.0f));
+            }
+            static Reg fmadd(Reg a, Reg b, Reg c) { return _mm512_fmadd_ps(a, b, c); }
+            static float fmaScalar(float a, float b, float c) { return __builtin_fmaf(a, b, c); }
+            static float hsum(Reg r) { return _mm512_reduce_add_ps(r); }
+            static Reg loadBf16(const uint16_t *p) {
+                const __m512i words = _mm512_cvtepu16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)));
+                return _mm512_castsi512_ps(_mm512_slli_epi32(words, 16));
+            }
+
+            // Byte multiply-adds need AVX-512BW, which is not required here,
+            // so these use the AVX2 forms that -mavx512f also enables
+            using IReg = __m256i;
+            static constexpr size_t BYTE_WIDTH = 32;
+            static IReg izero() { return _mm256_setzero_si256(); }
+            static int32_t ihsum(IReg r) {
+                __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(r), _mm256_extracti128_si256(r, 1));
+                sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+                sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+                return _mm_cvtsi128_si32(sum);
+            }
+            // Same sign transfer as the AVX2 version, see kernelsAvx2.cpp
+            static IReg dotBytes(const int8_t *a, const int8_t *b, IReg acc) {
+                const __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a));
+                const __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b));
+                const __m256i pairs = _mm256_maddubs_epi16(_mm256_abs_epi8(y), _mm256_sign_epi8(x, y));
+                return _mm256_add_epi32(acc, _mm256_madd_epi16(pairs, _mm256_set1_epi16(1)));
+            }
+
+            using UReg = __m512i;
+            static UReg uset1(uint32_t x) { return _mm512_set1_epi32(static_cast<int32_t>(x)); }
+            static UReg uloadu(const uint32_t *p) { return _mm512_loadu_si512(p); }
+            static void ustoreu(uint32_t *p, UReg r) { _mm512_storeu_si512(p, r); }
+            static UReg uadd(UReg a, UReg b) { return _mm512_add_epi32(a, b); }
+            static UReg uand(UReg a, UReg b) { return _mm512_and_si512(a, b); }
+            static UReg uor(UReg a, UReg b) { return _mm512_or_si512(a, b); }
+            static UReg uxor(UReg a, UReg b) { return _mm512_xor_si512(a, b); }
+            template <int K> static UReg ushl(UReg a) { return _mm512_slli_epi32(a, K); }
+            template <int K> static UReg ushr(UReg a) { return _mm512_srli_epi32(a, K); }
+            static Reg toFloat(UReg a) { return _mm512_cvtepi32_ps(a); }
+            static UReg asBits(Reg a) { return _mm512_castps_si512(a); }
+            static Reg asFloat(UReg a) { return _mm512_castsi512_ps(a); }
+        };
+
+#include "kernelsImpl.h"
+    }
+
+    const KernelTable& avx512Table() {
+        static const KernelTable table = {
+            avx512::dotImpl<avx512::V>,
+            avx512::axpyImpl<avx512::V>,
+            avx512::scaledUpdateImpl<avx512::V>,
+            avx512::gemmAccumulateImpl<avx512::V>,
+            avx512::sigmoidImpl<avx512::V>,
+            avx512::dSigmoidImpl<avx512::V>,
+            avx512::reluImpl<avx512::V>,
+            avx512::dReluImpl<avx512::V>,
+            avx512::decodeBytesImpl<avx512::V>,
+            avx512::dotBf16Impl<avx512::V>,
+            avx512::dotI8Impl<avx512::V>,
+            avx512::momentumUpdateImpl<avx512::V>,
+            avx512::rmsPropUpdateImpl<avx512::V>,
+            avx512::adamUpdateImpl<avx512::V>,
+            avx512::randomBitsImpl<avx512::V>,
+            avx512::randomUniformImpl<avx512::V>,
+            avx512::randomNormalImpl<avx512::V>,
+        };
+        return table;
+    }
+}
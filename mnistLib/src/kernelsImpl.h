@@ -0,0 +1,548 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ *  Kernel bodies shared by every instruction set. Each kernels*.cpp defines
+ *  a register traits struct V and includes this file inside its own
+ *  namespace, so the templates below are compiled once per ISA with that
+ *  translation unit's flags and never mix across them.
+ *
+ *  V provides:
+ *      Reg                 vector register type
+ *      WIDTH               floats per register
+ *      GEMM_VECTORS        registers per row of a gemm tile
+ *      zero, set1, loadu, storeu, add, sub, mul, div, sqrt, min, max
+ *      loadBytes(p)        WIDTH unsigned bytes widened to float
+ *      fmadd(a, b, c)      a * b + c
+ *      fmaScalar(a, b, c)  a * b + c rounded the same way as fmadd
+ *      hsum(r)             sum of the lanes of r
+ *      round(r)            lanes rounded to the nearest integer
+ *      pow2(r)             2^r for integer valued lanes in [-126, 127]
+ *      step(r)             1 where a lane is > 0, otherwise 0
+ *      loadBf16(p)         WIDTH bfloat16 values widened to float
+ *      IReg                integer accumulator register type
+ *      BYTE_WIDTH          int8 pairs consumed by one dotBytes
+ *      izero, ihsum        zero and lane sum of an IReg
+ *      dotBytes(a, b, acc) acc plus the products of BYTE_WIDTH int8 pairs
+ *      UReg                WIDTH uint32 lanes, for the random generators
+ *      uset1, uloadu, ustoreu, uadd, uand, uor, uxor
+ *      ushl<K>, ushr<K>    logical shifts by a constant
+ *      toFloat(u)          int32 lanes converted to float
+ *      asBits, asFloat     reinterpret between Reg and UReg
+ */
+
+template <typename V>
+float dotImpl(const float *a, const float *b, size_t size) {
+    constexpr size_t W = V::WIDTH;
+    typename V::Reg acc0 = V::zero();
+    typename V::Reg acc1 = V::zero();
+    typename V::Reg acc2 = V::zero();
+    typename V::Reg acc3 = V::zero();
+    size_t i = 0;
+    for (; i + 4 * W <= size; i += 4 * W) {
+        acc0 = V::fmadd(V::loadu(a + i), V::loadu(b + i), acc0);
+        acc1 = V::fmadd(V::loadu(a + i + W), V::loadu(b + i + W), acc1);
+        acc2 = V::fmadd(V::loadu(a + i + 2 * W), V::loadu(b + i + 2 * W), acc2);
+        acc3 = V::fmadd(V::loadu(a + i + 3 * W), V::loadu(b + i + 3 * W), acc3);
+    }
+    for (; i + W <= size; i += W) {
+        acc0 = V::fmadd(V::loadu(a + i), V::loadu(b + i), acc0);
+    }
+    float sum = V::hsum(V::add(V::add(acc0, acc1), V::add(acc2, acc3)));
+    for (; i < size; ++i) {
+        sum = V::fmaScalar(a[i], b[i], sum);
+    }
+    return sum;
+}
+
+template <typename V>
+void axpyImpl(float *y, const float *x, const float alpha, const size_t size) {
+    constexpr size_t W = V::WIDTH;
+    const typename V::Reg a = V::set1(alpha);
+    size_t i = 0;
+    for (; i + 2 * W <= size; i += 2 * W) {
+        V::storeu(y + i, V::fmadd(V::loadu(x + i), a, V::loadu(y + i)));
+        V::storeu(y + i + W, V::fmadd(V::loadu(x + i + W), a, V::loadu(y + i + W)));
+    }
+    for (; i + W <= size; i += W) {
+        V::storeu(y + i, V::fmadd(V::loadu(x + i), a, V::loadu(y + i)));
+    }
+    for (; i < size; ++i) {
+        y[i] = V::fmaScalar(x[i], alpha, y[i]);
+    }
+}
+
+template <typename V>
+void scaledUpdateImpl(float *values, float *deltas, const float scale, const size_t size) {
+    constexpr size_t W = V::WIDTH;
+    const typename V::Reg s = V::set1(-scale);
+    const typename V::Reg z = V::zero();
+    size_t i = 0;
+    for (; i + W <= size; i += W) {
+        V::storeu(values + i, V::fmadd(V::loadu(deltas + i), s, V::loadu(values + i)));
+        V::storeu(deltas + i, z);
+    }
+    for (; i < size; ++i) {
+        values[i] = V::fmaScalar(deltas[i], -scale, values[i]);
+        deltas[i] = 0;
+    }
+}
+
+template <typename V>
+void gemmAccumulateImpl(float *C, const size_t ldc, const float *A, const size_t lda, const float *B, const size_t ldb,
+                        const size_t rows, const size_t cols, const size_t depth) {
+    constexpr size_t W = V::WIDTH;
+    constexpr size_t NV = V::GEMM_VECTORS;
+    constexpr size_t MR = 4;
+    constexpr size_t NR = NV * W;
+    constexpr size_t DEPTH_BLOCK = 256;
+    const size_t mFull = rows - rows % MR;
+    const size_t nFull = cols - cols % NR;
+
+    for (size_t pb = 0; pb < depth; pb += DEPTH_BLOCK) {
+        const size_t pEnd = (pb + DEPTH_BLOCK < depth ? pb + DEPTH_BLOCK : depth);
+        for (size_t m = 0; m < mFull; m += MR) {
+            const float *a0 = A + (m + 0) * lda;
+            const float *a1 = A + (m + 1) * lda;
+            const float *a2 = A + (m + 2) * lda;
+            const float *a3 = A + (m + 3) * lda;
+            for (size_t n = 0; n < nFull; n += NR) {
+                typename V::Reg acc[MR][NV];
+                for (size_t r = 0; r < MR; ++r) {
+                    for (size_t v = 0; v < NV; ++v) {
+                        acc[r][v] = V::loadu(C + (m + r) * ldc + n + v * W);
+                    }
+                }
+                for (size_t p = pb; p < pEnd; ++p) {
+                    const float *bRow = B + p * ldb + n;
+                    const typename V::Reg b0 = V::set1(a0[p]);
+                    const typename V::Reg b1 = V::set1(a1[p]);
+                    const typename V::Reg b2 = V::set1(a2[p]);
+                    const typename V::Reg b3 = V::set1(a3[p]);
+                    for (size_t v = 0; v < NV; ++v) {
+                        const typename V::Reg x = V::loadu(bRow + v * W);
+                        acc[0][v] = V::fmadd(x, b0, acc[0][v]);
+                        acc[1][v] = V::fmadd(x, b1, acc[1][v]);
+                        acc[2][v] = V::fmadd(x, b2, acc[2][v]);
+                        acc[3][v] = V::fmadd(x, b3, acc[3][v]);
+                    }
+                }
+                for (size_t r = 0; r < MR; ++r) {
+                    for (size_t v = 0; v < NV; ++v) {
+                        V::storeu(C + (m + r) * ldc + n + v * W, acc[r][v]);
+                    }
+                }
+            }
+            // Leftover columns
+            if (nFull < cols) {
+                for (size_t r = m; r < m + MR; ++r) {
+                    for (size_t p = pb; p < pEnd; ++p) {
+                        axpyImpl<V>(C + r * ldc + nFull, B + p * ldb + nFull, A[r * lda + p], cols - nFull);
+                    }
+                }
+            }
+        }
+        // Leftover rows
+        for (size_t r = mFull; r < rows; ++r) {
+            for (size_t p = pb; p < pEnd; ++p) {
+                axpyImpl<V>(C + r * ldc, B + p * ldb, A[r * lda + p], cols);
+            }
+        }
+    }
+}
+
+/**
+ *  Applies f to every register of in. The tail is padded into a full
+ *  register so every element goes through the same vector code.
+ */
+template <typename V, typename F>
+void mapImpl(const float *in, float *out, const size_t size, F f) {
+    constexpr size_t W = V::WIDTH;
+    size_t i = 0;
+    for (; i + W <= size; i += W) {
+        V::storeu(out + i, f(V::loadu(in + i)));
+    }
+    if (i < size) {
+        float buffer[W] = {};
+        for (size_t k = 0; i + k < size; ++k) {
+            buffer[k] = in[i + k];
+        }
+        V::storeu(buffer, f(V::loadu(buffer)));
+        for (size_t k = 0; i + k < size; ++k) {
+            out[i + k] = buffer[k];
+        }
+    }
+}
+
+/**
+ *  e^x with the Cephes expf range reduction and polynomial, accurate to a
+ *  couple of ulp over the clamped range.
+ */
+template <typename V>
+typename V::Reg expImpl(typename V::Reg x) {
+    x = V::min(V::max(x, V::set1(-87.3f)), V::set1(88.3f));
+    const typename V::Reg n = V::round(V::mul(x, V::set1(1.44269504088896341f)));
+    x = V::sub(x, V::mul(n, V::set1(0.693359375f)));
+    x = V::sub(x, V::mul(n, V::set1(-2.12194440e-4f)));
+    typename V::Reg y = V::set1(1.9875691500e-4f);
+    y = V::add(V::mul(y, x), V::set1(1.3981999507e-3f));
+    y = V::add(V::mul(y, x), V::set1(8.3334519073e-3f));
+    y = V::add(V::mul(y, x), V::set1(4.1665795894e-2f));
+    y = V::add(V::mul(y, x), V::set1(1.6666665459e-1f));
+    y = V::add(V::mul(y, x), V::set1(5.0000001201e-1f));
+    y = V::add(V::add(V::mul(V::mul(y, x), x), x), V::set1(1.0f));
+    return V::mul(y, V::pow2(n));
+}
+
+template <typename V>
+typename V::Reg sigmoidReg(const typename V::Reg x) {
+    const typename V::Reg one = V::set1(1.0f);
+    return V::div(one, V::add(one, expImpl<V>(V::sub(V::zero(), x))));
+}
+
+template <typename V>
+void sigmoidImpl(const float *in, float *out, const size_t size) {
+    mapImpl<V>(in, out, size, [](typename V::Reg x) { return sigmoidReg<V>(x); });
+}
+
+template <typename V>
+void dSigmoidImpl(const float *in, float *out, const size_t size) {
+    mapImpl<V>(in, out, size, [](typename V::Reg x) {
+        const typename V::Reg s = sigmoidReg<V>(x);
+        return V::mul(s, V::sub(V::set1(1.0f), s));
+    });
+}
+
+template <typename V>
+void reluImpl(const float *in, float *out, const size_t size) {
+    mapImpl<V>(in, out, size, [](typename V::Reg x) { return V::max(x, V::zero()); });
+}
+
+template <typename V>
+void dReluImpl(const float *in, float *out, const size_t size) {
+    mapImpl<V>(in, out, size, [](typename V::Reg x) { return V::step(x); });
+}
+
+/**
+ *  Multiplies and adds in separate steps, in the tail as well, so every
+ *  instruction set produces the same bits.
+ */
+template <typename V>
+void decodeBytesImpl(const uint8_t *in, float *out, const float scale, const float offset, const size_t size) {
+    constexpr size_t W = V::WIDTH;
+    const typename V::Reg s = V::set1(scale);
+    const typename V::Reg o = V::set1(offset);
+    size_t i = 0;
+    for (; i + 2 * W <= size; i += 2 * W) {
+        V::storeu(out + i, V::add(V::mul(V::loadBytes(in + i), s), o));
+        V::storeu(out + i + W, V::add(V::mul(V::loadBytes(in + i + W), s), o));
+    }
+    for (; i + W <= size; i += W) {
+        V::storeu(out + i, V::add(V::mul(V::loadBytes(in + i), s), o));
+    }
+    for (; i < size; ++i) {
+        out[i] = static_cast<float>(in[i]) * scale + offset;
+    }
+}
+
+template <typename V>
+float dotBf16Impl(const uint16_t *a, const float *b, size_t size) {
+    constexpr size_t W = V::WIDTH;
+    typename V::Reg acc0 = V::zero();
+    typename V::Reg acc1 = V::zero();
+    typename V::Reg acc2 = V::zero();
+    typename V::Reg acc3 = V::zero();
+    size_t i = 0;
+    for (; i + 4 * W <= size; i += 4 * W) {
+        acc0 = V::fmadd(V::loadBf16(a + i), V::loadu(b + i), acc0);
+        acc1 = V::fmadd(V::loadBf16(a + i + W), V::loadu(b + i + W), acc1);
+        acc2 = V::fmadd(V::loadBf16(a + i + 2 * W), V::loadu(b + i + 2 * W), acc2);
+        acc3 = V::fmadd(V::loadBf16(a + i + 3 * W), V::loadu(b + i + 3 * W), acc3);
+    }
+    for (; i + W <= size; i += W) {
+        acc0 = V::fmadd(V::loadBf16(a + i), V::loadu(b + i), acc0);
+    }
+    float sum = V::hsum(V::add(V::add(acc0, acc1), V::add(acc2, acc3)));
+    for (; i < size; ++i) {
+        const uint32_t bits = static_cast<uint32_t>(a[i]) << 16;
+        float widened;
+        std::memcpy(&widened, &bits, sizeof(widened));
+        sum = V::fmaScalar(widened, b[i], sum);
+    }
+    return sum;
+}
+
+template <typename V>
+int32_t dotI8Impl(const int8_t *a, const int8_t *b, size_t size) {
+    constexpr size_t W = V::BYTE_WIDTH;
+    typename V::IReg acc0 = V::izero();
+    typename V::IReg acc1 = V::izero();
+    size_t i = 0;
+    for (; i + 2 * W <= size; i += 2 * W) {
+        acc0 = V::dotBytes(a + i, b + i, acc0);
+        acc1 = V::dotBytes(a + i + W, b + i + W, acc1);
+    }
+    for (; i + W <= size; i += W) {
+        acc0 = V::dotBytes(a + i, b + i, acc0);
+    }
+    int32_t sum = V::ihsum(acc0) + V::ihsum(acc1);
+    for (; i < size; ++i) {
+        sum += static_cast<int32_t>(a[i]) * static_cast<int32_t>(b[i]);
+    }
+    return sum;
+}
+
+/**
+ *  Runs f over N arrays of the same length in place, one register of each
+ *  at a time. The tail is padded into full registers like mapImpl, so
+ *  every element goes through the same vector code.
+ */
+template <typename V, size_t N, typename F>
+void zipImpl(float *const (&arrays)[N], const size_t size, F f) {
+    constexpr size_t W = V::WIDTH;
+    typename V::Reg regs[N];
+    size_t i = 0;
+    for (; i + W <= size; i += W) {
+        for (size_t a = 0; a < N; ++a) {
+            regs[a] = V::loadu(arrays[a] + i);
+        }
+        f(regs);
+        for (size_t a = 0; a < N; ++a) {
+            V::storeu(arrays[a] + i, regs[a]);
+        }
+    }
+    if (i < size) {
+        float buffer[N][W] = {};
+        for (size_t a = 0; a < N; ++a) {
+            for (size_t k = 0; i + k < size; ++k) {
+                buffer[a][k] = arrays[a][i + k];
+            }
+            regs[a] = V::loadu(buffer[a]);
+        }
+        f(regs);
+        for (size_t a = 0; a < N; ++a) {
+            V::storeu(buffer[a], regs[a]);
+            for (size_t k = 0; i + k < size; ++k) {
+                arrays[a][i + k] = buffer[a][k];
+            }
+        }
+    }
+}
+
+template <typename V>
+void momentumUpdateImpl(float *values, float *deltas, float *velocity, const float rate, const float momentum, const size_t size) {
+    float *const arrays[3] = { values, deltas, velocity };
+    const typename V::Reg r = V::set1(-rate);
+    const typename V::Reg mu = V::set1(momentum);
+    zipImpl<V>(arrays, size, [&](typename V::Reg (&x)[3]) {
+        x[2] = V::fmadd(x[2], mu, x[1]);
+        x[0] = V::fmadd(x[2], r, x[0]);
+        x[1] = V::zero();
+    });
+}
+
+template <typename V>
+void rmsPropUpdateImpl(float *values, float *deltas, float *meanSquare, const float rate, const float decay, const float epsilon, const size_t size) {
+    float *const arrays[3] = { values, deltas, meanSquare };
+    const typename V::Reg r = V::set1(rate);
+    const typename V::Reg d = V::set1(decay);
+    const typename V::Reg keep = V::set1(1.0f - decay);
+    const typename V::Reg eps = V::set1(epsilon);
+    zipImpl<V>(arrays, size, [&](typename V::Reg (&x)[3]) {
+        x[2] = V::fmadd(x[2], d, V::mul(V::mul(x[1], x[1]), keep));
+        x[0] = V::sub(x[0], V::div(V::mul(x[1], r), V::add(V::sqrt(x[2]), eps)));
+        x[1] = V::zero();
+    });
+}
+
+template <typename V>
+void adamUpdateImpl(float *values, float *deltas, float *moment1, float *moment2, const float rate,
+                    const float beta1, const float beta2, const float epsilon, const size_t size) {
+    float *const arrays[4] = { values, deltas, moment1, moment2 };
+    const typename V::Reg r = V::set1(rate);
+    const typename V::Reg b1 = V::set1(beta1);
+    const typename V::Reg b2 = V::set1(beta2);
+    const typename V::Reg keep1 = V::set1(1.0f - beta1);
+    const typename V::Reg keep2 = V::set1(1.0f - beta2);
+    const typename V::Reg eps = V::set1(epsilon);
+    zipImpl<V>(arrays, size, [&](typename V::Reg (&x)[4]) {
+        x[2] = V::fmadd(x[2], b1, V::mul(x[1], keep1));
+        x[3] = V::fmadd(x[3], b2, V::mul(V::mul(x[1], x[1]), keep2));
+        x[0] = V::sub(x[0], V::div(V::mul(x[2], r), V::add(V::sqrt(x[3]), eps)));
+        x[1] = V::zero();
+    });
+}
+
+/**
+ *  xoshiro128++ (Blackman and Vigna) in RANDOM_LANES independent lanes,
+ *  state word w of lane i at state[w * RANDOM_LANES + i]. A block is one
+ *  step of every lane, lane i landing at position i, so each instruction
+ *  set produces the same sequence whatever its register width.
+ */
+template <typename V>
+struct XoshiroLanes {
+    using UReg = typename V::UReg;
+    static constexpr size_t N = RANDOM_LANES / V::WIDTH;
+
+    UReg s[4][N];
+
+    explicit XoshiroLanes(const uint32_t *state) {
+        for (size_t w = 0; w < 4; ++w) {
+            for (size_t k = 0; k < N; ++k) {
+                s[w][k] = V::uloadu(state + w * RANDOM_LANES + k * V::WIDTH);
+            }
+        }
+    }
+
+    void store(uint32_t *state) const {
+        for (size_t w = 0; w < 4; ++w) {
+            for (size_t k = 0; k < N; ++k) {
+                V::ustoreu(state + w * RANDOM_LANES + k * V::WIDTH, s[w][k]);
+            }
+        }
+    }
+
+    template <int K>
+    static UReg rotl(UReg x) {
+        return V::uor(V::template ushl<K>(x), V::template ushr<32 - K>(x));
+    }
+
+    // Next word of register k of the lanes
+    UReg next(size_t k) {
+        const UReg result = V::uadd(rotl<7>(V::uadd(s[0][k], s[3][k])), s[0][k]);
+        const UReg t = V::template ushl<9>(s[1][k]);
+        s[2][k] = V::uxor(s[2][k], s[0][k]);
+        s[3][k] = V::uxor(s[3][k], s[1][k]);
+        s[1][k] = V::uxor(s[1][k], s[2][k]);
+        s[0][k] = V::uxor(s[0][k], s[3][k]);
+        s[2][k] = V::uxor(s[2][k], t);
+        s[3][k] = rotl<11>(s[3][k]);
+        return result;
+    }
+};
+
+// The top 24 bits of each lane as a float in [0, 1)
+template <typename V>
+typename V::Reg unitFloat(const typename V::UReg bits) {
+    return V::mul(V::toFloat(V::template ushr<8>(bits)), V::set1(5.9604644775390625e-08f));
+}
+
+template <typename V>
+void randomBitsImpl(uint32_t *state, uint32_t *out, const size_t blocks) {
+    XoshiroLanes<V> lanes(state);
+    for (size_t b = 0; b < blocks; ++b) {
+        for (size_t k = 0; k < XoshiroLanes<V>::N; ++k) {
+            V::ustoreu(out + b * RANDOM_LANES + k * V::WIDTH, lanes.next(k));
+        }
+    }
+    lanes.store(state);
+}
+
+template <typename V>
+void randomUniformImpl(uint32_t *state, float *out, const size_t blocks, const float scale, const float offset) {
+    XoshiroLanes<V> lanes(state);
+    const typename V::Reg s = V::set1(scale);
+    const typename V::Reg o = V::set1(offset);
+    for (size_t b = 0; b < blocks; ++b) {
+        for (size_t k = 0; k < XoshiroLanes<V>::N; ++k) {
+            V::storeu(out + b * RANDOM_LANES + k * V::WIDTH, V::add(V::mul(unitFloat<V>(lanes.next(k)), s), o));
+        }
+    }
+    lanes.store(state);
+}
+
+/**
+ *  Natural log of positive normal x with the Cephes logf reduction and
+ *  polynomial. The mantissa is moved into [sqrt(1/2), sqrt(2)) with 0/1
+ *  factors from step instead of a compare and blend.
+ */
+template <typename V>
+typename V::Reg logImpl(const typename V::Reg x) {
+    using Reg = typename V::Reg;
+    const typename V::UReg bits = V::asBits(x);
+    // x = m * 2^e with m in [0.5, 1)
+    Reg e = V::sub(V::toFloat(V::template ushr<23>(bits)), V::set1(126.0f));
+    Reg m = V::asFloat(V::uor(V::uand(bits, V::uset1(0x007FFFFFu)), V::uset1(0x3F000000u)));
+    const Reg low = V::step(V::sub(V::set1(0.707106781186547524f), m));
+    e = V::sub(e, low);
+    m = V::sub(V::add(m, V::mul(low, m)), V::set1(1.0f));
+    const Reg z = V::mul(m, m);
+    Reg y = V::set1(7.0376836292e-2f);
+    y = V::add(V::mul(y, m), V::set1(-1.1514610310e-1f));
+    y = V::add(V::mul(y, m), V::set1(1.1676998740e-1f));
+    y = V::add(V::mul(y, m), V::set1(-1.2420140846e-1f));
+    y = V::add(V::mul(y, m), V::set1(1.4249322787e-1f));
+    y = V::add(V::mul(y, m), V::set1(-1.6668057665e-1f));
+    y = V::add(V::mul(y, m), V::set1(2.0000714765e-1f));
+    y = V::add(V::mul(y, m), V::set1(-2.4999993993e-1f));
+    y = V::add(V::mul(y, m), V::set1(3.3333331174e-1f));
+    y = V::mul(V::mul(y, m), z);
+    y = V::add(y, V::mul(e, V::set1(-2.12194440e-4f)));
+    y = V::sub(y, V::mul(z, V::set1(0.5f)));
+    return V::add(V::add(m, y), V::mul(e, V::set1(0.693359375f)));
+}
+
+/**
+ *  cos(2 pi t) and sin(2 pi t) for t in [0, 1). t splits into whole
+ *  quarter turns and a remainder within an eighth of a turn, which the
+ *  Cephes sinf/cosf polynomials cover. The quarter turns then swap and
+ *  negate the results through 0/1 factors.
+ */
+template <typename V>
+void sinCosTurnsImpl(const typename V::Reg t, typename V::Reg &cosOut, typename V::Reg &sinOut) {
+    using Reg = typename V::Reg;
+    const Reg one = V::set1(1.0f);
+    const Reg q = V::round(V::mul(t, V::set1(4.0f)));
+    const Reg a = V::mul(V::sub(t, V::mul(q, V::set1(0.25f))), V::set1(6.28318530717958648f));
+    const Reg z = V::mul(a, a);
+    Reg sinA = V::set1(-1.9515295891e-4f);
+    sinA = V::add(V::mul(sinA, z), V::set1(8.3321608736e-3f));
+    sinA = V::add(V::mul(sinA, z), V::set1(-1.6666654611e-1f));
+    sinA = V::add(V::mul(V::mul(sinA, z), a), a);
+    Reg cosA = V::set1(2.443315711809948e-5f);
+    cosA = V::add(V::mul(cosA, z), V::set1(-1.388731625493765e-3f));
+    cosA = V::add(V::mul(cosA, z), V::set1(4.166664568298827e-2f));
+    cosA = V::add(V::sub(V::mul(V::mul(cosA, z), z), V::mul(z, V::set1(0.5f))), one);
+    // atLeastK is 1 once q >= K; q is one of 0..4 and 4 turns back to 0
+    const Reg atLeast1 = V::step(V::sub(q, V::set1(0.5f)));
+    const Reg atLeast2 = V::step(V::sub(q, V::set1(1.5f)));
+    const Reg atLeast3 = V::step(V::sub(q, V::set1(2.5f)));
+    const Reg atLeast4 = V::step(V::sub(q, V::set1(3.5f)));
+    const Reg odd = V::add(V::sub(atLeast1, atLeast2), V::sub(atLeast3, atLeast4));
+    const Reg even = V::sub(one, odd);
+    const Reg cosSign = V::sub(one, V::mul(V::set1(2.0f), V::sub(atLeast1, atLeast3)));
+    const Reg sinSign = V::sub(one, V::mul(V::set1(2.0f), V::sub(atLeast2, atLeast4)));
+    cosOut = V::mul(V::add(V::mul(odd, sinA), V::mul(even, cosA)), cosSign);
+    sinOut = V::mul(V::add(V::mul(odd, cosA), V::mul(even, sinA)), sinSign);
+}
+
+/**
+ *  Box-Muller on two consecutive words of every lane. Block b fills
+ *  2 * RANDOM_LANES values: the cosine halves of the pairs, then the sines.
+ */
+template <typename V>
+void randomNormalImpl(uint32_t *state, float *out, const size_t blocks, const float mean, const float stddev) {
+    using Reg = typename V::Reg;
+    XoshiroLanes<V> lanes(state);
+    const Reg m = V::set1(mean);
+    const Reg sd = V::set1(stddev);
+    const Reg one = V::set1(1.0f);
+    for (size_t b = 0; b < blocks; ++b) {
+        float *cosines = out + 2 * b * RANDOM_LANES;
+        float *sines = cosines + RANDOM_LANES;
+        for (size_t k = 0; k < XoshiroLanes<V>::N; ++k) {
+            // (0, 1], so the log stays finite
+            const Reg u = V::sub(one, unitFloat<V>(lanes.next(k)));
+            const Reg t = unitFloat<V>(lanes.next(k));
+            const Reg radius = V::mul(V::sqrt(V::max(V::mul(V::set1(-2.0f), logImpl<V>(u)), V::zero())), sd);
+            Reg c;
+            Reg s;
+            sinCosTurnsImpl<V>(t, c, s);
+            V::storeu(cosines + k * V::WIDTH, V::add(V::mul(radius, c), m));
+            V::storeu(sines + k * V::WIDTH, V::add(V::mul(radius, s), m));
+        }
+    }
+    lanes.store(state);
+}
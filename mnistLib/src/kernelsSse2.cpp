@@ -0,0 +1,107 @@
+#include "kernels.h"
+
+#include <immintrin.h>
+#include <cstdint>
+#include <cstring>
+
+namespace statpack::kernels {
+    namespace sse2 {
+        struct V {
+            using Reg = __m128;
+            static constexpr size_t WIDTH = 4;
+            static constexpr size_t GEMM_VECTORS = 2;
+
+            static Reg zero() { return _mm_setzero_ps(); }
+            static Reg set1(float x) { return _mm_set1_ps(x); }
+            static Reg loadu(const float *p) { return _mm_loadu_ps(p); }
+            static Reg loadBytes(const uint8_t *p) {
+                int32_t bytes;
+                std::memcpy(&bytes, p, sizeof(bytes));
+                const __m128i zero = _mm_setzero_si128();
+                const __m128i words = _mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero);
+                return _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero));
+            }
+            static void storeu(float *p, Reg r) { _mm_storeu_ps(p, r); }
+            static Reg add(Reg a, Reg b) { return _mm_add_ps(a, b); }
+            static Reg sub(Reg a, Reg b) { return _mm_sub_ps(a, b); }
+            static Reg mul(Reg a, Reg b) { return _mm_mul_ps(a, b); }
+            static Reg div(Reg a, Reg b) { return _mm_div_ps(a, b); }
+            static Reg sqrt(Reg a) { return _mm_sqrt_ps(a); }
+            static Reg min(Reg a, Reg b) { return _mm_min_ps(a, b); }
+            static Reg max(Reg a, Reg b) { return _mm_max_ps(a, b); }
+            static Reg round(Reg a) { return _mm_cvtepi32_ps(_mm_cvtps_epi32(a)); }
+            static Reg pow2(Reg n) {
+                return _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(_mm_cvtps_epi32(n), _mm_set1_epi32(127)), 23));
+            }
+            static Reg step(Reg a) { return _mm_and_ps(_mm_cmpgt_ps(a, _mm_setzero_ps()), _mm_set1_ps(1.0f)); }
+            // No FMA on plain SSE2, so the scalar fallback rounds twice as well
+            static Reg fmadd(Reg a, Reg b, Reg c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+            static float fmaScalar(float a, float b, float c) { return a * b + c; }
+            static float hsum(Reg r) {
+                const Reg high = _mm_movehl_ps(r, r);
+                const Reg pair = _mm_add_ps(r, high);
+                return _mm_cvtss_f32(_mm_add_ss(pair, _mm_shuffle_ps(pair, pair, 1)));
+            }
+            static Reg loadBf16(const uint16_t *p) {
+                const __m128i halves = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p));
+                return _mm_castsi128_ps(_mm_unpacklo_epi16(_mm_setzero_si128(), halves));
+            }
+
+            using IReg = __m128i;
+            static constexpr size_t BYTE_WIDTH = 8;
+            static IReg izero() { return _mm_setzero_si128(); }
+            static int32_t ihsum(IReg r) {
+                r = _mm_add_epi32(r, _mm_shuffle_epi32(r, _MM_SHUFFLE(1, 0, 3, 2)));
+                r = _mm_add_epi32(r, _mm_shuffle_epi32(r, _MM_SHUFFLE(2, 3, 0, 1)));
+                return _mm_cvtsi128_si32(r);
+            }
+            // No pmovsx on SSE2: duplicate every byte into a word and shift the sign down
+            static IReg dotBytes(const int8_t *a, const int8_t *b, IReg acc) {
+                const __m128i x = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(a));
+                const __m128i y = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(b));
+                const __m128i wx = _mm_srai_epi16(_mm_unpacklo_epi8(x, x), 8);
+                const __m128i wy = _mm_srai_epi16(_mm_unpacklo_epi8(y, y), 8);
+                return _mm_add_epi32(acc, _mm_madd_epi16(wx, wy));
+            }
+
+            using UReg = __m128i;
+            static UReg uset1(uint32_t x) { return _mm_set1_epi32(static_cast<int32_t>(x)); }
+            static UReg uloadu(const uint32_t *p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+            static void ustoreu(uint32_t *p, UReg r) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), r); }
+            static UReg uadd(UReg a, UReg b) { return _mm_add_epi32(a, b); }
+            static UReg uand(UReg a, UReg b) { return _mm_and_si128(a, b); }
+            static UReg uor(UReg a, UReg b) { return _mm_or_si128(a, b); }
+            static UReg uxor(UReg a, UReg b) { return _mm_xor_si128(a, b); }
+            template <int K> static UReg ushl(UReg a) { return _mm_slli_epi32(a, K); }
+            template <int K> static UReg ushr(UReg a) { return _mm_srli_epi32(a, K); }
+            static Reg toFloat(UReg a) { return _mm_cvtepi32_ps(a); }
+            static UReg asBits(Reg a) { return _mm_castps_si128(a); }
+            static Reg asFloat(UReg a) { return _mm_castsi128_ps(a); }
+        };
+
+#include "kernelsImpl.h"
+    }
+
+    const KernelTable& sse2Table() {
+        static const KernelTable table = {
+            sse2::dotImpl<sse2::V>,
+            sse2::axpyImpl<sse2::V>,
+            sse2::scaledUpdateImpl<sse2::V>,
+            sse2::gemmAccumulateImpl<sse2::V>,
+            sse2::sigmoidImpl<sse2::V>,
+            sse2::dSigmoidImpl<sse2::V>,
+            sse2::reluImpl<sse2::V>,
+            sse2::dReluImpl<sse2::V>,
+            sse2::decodeBytesImpl<sse2::V>,
+            sse2::dotBf16Impl<sse2::V>,
+            sse2::dotI8Impl<sse2::V>,
+            sse2::momentumUpdateImpl<sse2::V>,
+            sse2::rmsPropUpdateImpl<sse2::V>,
+            sse2::adamUpdateImpl<sse2::V>,
+            sse2::randomBitsImpl<sse2::V>,
+            sse2::randomUniformImpl<sse2::V>,
+            sse2::randomNormalImpl<sse2::V>,
+        };
+        return table;
+    }
+}
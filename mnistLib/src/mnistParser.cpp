@@ -1,6 +1,15 @@
 #include "mnistParser.h"
-#include <fstream>
+#include "kernels.h"
+#include "Profiler.h"
 #include <iostream>
+#include <cstring>
+#include <utility>
+#include <cstdint>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace mnistParser {
     int flipInt32(int32_t i) {
@@ -11,94 +20,217 @@ namespace mnistParser {
         d = static_cast<uint8_t>((i >> 24) & 255);
         return ((int32_t)a << 24) + ((int32_t)b << 16) + ((int32_t)c << 8) + ((int32_t)d);
     }
-    
-    namespace test {
-        std::array<int32_t, IMAGE_PIXELS> currentImageInt;
-        std::array<float, IMAGE_PIXELS> currentImageFloat;
-        
-        int32_t currentImageNr;
-        
-        std::ifstream testImgStrm;
-        std::ifstream testLabelStrm;
-        
-        std::ofstream outStream;
-
-        // TODO: Optimize some day if I care enough
-        // Returns float array for easier life afterwards
-        std::array<float, IMAGE_PIXELS> getImage(int32_t nr) {
-            int32_t pos = IMAGE_OFFSET + IMAGE_PIXELS * nr;
-            if (pos >= TEST_DATA_SIZE) {
-                return currentImageFloat;
-            }
-            if (testImgStrm.is_open()) {
-                testImgStrm.seekg(pos, std::ios_base::beg);
-                for (int i = 0; i < IMAGE_PIXELS; ++i) {
-                    testImgStrm.read(reinterpret_cast<char*>(&currentImageInt[i]), 1);
-                    currentImageFloat[i] = (float)currentImageInt[i];
-                }
-            } else {
-                std::cout << "Testing image stream is not open!\n";
-            }
-            return currentImageFloat;
+
+    void decodePixels(const uint8_t *pixels, float *out, size_t size, float min, float max) {
+        const float scale = (max - min) / 255.0f;
+        statpack::kernels::decodeBytes(pixels, out, scale, min, size);
+    }
+
+    IdxFile::~IdxFile() {
+        close();
+    }
+
+    IdxFile::IdxFile(IdxFile &&other) noexcept {
+        *this = std::move(other);
+    }
+
+    IdxFile& IdxFile::operator=(IdxFile &&other) noexcept {
+        if (this != &other) {
+            close();
+            mapping = std::exchange(other.mapping, nullptr);
+            mappedSize = std::exchange(other.mappedSize, 0);
+            payload = std::exchange(other.payload, nullptr);
+            std::memcpy(dims, other.dims, sizeof(dims));
+            nDims = std::exchange(other.nDims, 0);
+            itemBytes = std::exchange(other.itemBytes, 0);
         }
+        return *this;
+    }
 
-        int32_t getImageNr(int32_t nr) {
-            int32_t pos = LABEL_OFFSET + nr;
-            if (pos >= TEST_LABEL_SIZE) {
-                return currentImageNr;
-            }
-            if (testLabelStrm.is_open()) {
-                testLabelStrm.seekg(pos, std::ios_base::beg);
-                testLabelStrm.read(reinterpret_cast<char*>(&currentImageNr), 1);
-            } else {
-                std::cout << "Testing label stream is not open!\n";
-            }
-            return currentImageNr;
-        }
-    }
-
-    namespace training {
-        std::array<int32_t, IMAGE_PIXELS> currentImageInt;
-        std::array<float, IMAGE_PIXELS> currentImageFloat;
-        
-        int32_t currentImageNr;
-        
-        std::ifstream trainImgStrm;
-        std::ifstream trainLabelStrm;
-        
-        std::ofstream outStream;
-
-        // TODO: Optimize some day if I care enough
-        // Returns float array for easier life afterwards
-        std::array<float, IMAGE_PIXELS> getImage(int32_t nr) {
-            int32_t pos = IMAGE_OFFSET + IMAGE_PIXELS * nr;
-            if (pos >= TRAIN_DATA_SIZE) {
-                return currentImageFloat;
+    bool IdxFile::open(const std::string &path, int32_t expectedMagic) {
+        close();
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            std::cout << "Could not open " << path << "\n";
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size < 8) {
+            std::cout << path << " is too small to be an IDX file!\n";
+            ::close(fd);
+            return false;
+        }
+        const size_t fileSize = static_cast<size_t>(info.st_size);
+        void *mapped = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED) {
+            std::cout << "Could not map " << path << "\n";
+            return false;
+        }
+        mapping = mapped;
+        mappedSize = fileSize;
+        const uint8_t *bytes = static_cast<const uint8_t*>(mapping);
+
+        auto readInt32 = [&](size_t offset) {
+            int32_t raw;
+            std::memcpy(&raw, bytes + offset, sizeof(raw));
+            return flipInt32(raw);
+        };
+
+        const int32_t magic = readInt32(0);
+        if (magic != expectedMagic) {
+            std::cout << path << " has magic number " << magic << ", expected " << expectedMagic << "\n";
+            close();
+            return false;
+        }
+        nDims = static_cast<size_t>(magic & 0xFF);
+        const size_t headerSize = 4 + 4 * nDims;
+        if (nDims == 0 || nDims > MAX_DIMS || fileSize < headerSize) {
+            std::cout << path << " has an unsupported IDX header!\n";
+            close();
+            return false;
+        }
+        // Sizes are checked by division, so adversarial dimensions cannot
+        // wrap the products around
+        itemBytes = 1;
+        for (size_t i = 0; i < nDims; ++i) {
+            dims[i] = readInt32(4 + 4 * i);
+            if (dims[i] < 0) {
+                std::cout << path << " has a negative dimension!\n";
+                close();
+                return false;
             }
-            if (trainImgStrm.is_open()) {
-                trainImgStrm.seekg(pos, std::ios_base::beg);
-                for (int i = 0; i < IMAGE_PIXELS; ++i) {
-                    trainImgStrm.read(reinterpret_cast<char*>(&currentImageInt[i]), 1);
-                    currentImageFloat[i] = static_cast<float>(currentImageInt[i]);
+            if (i > 0) {
+                const size_t dim = static_cast<size_t>(dims[i]);
+                if (dim != 0 && itemBytes > SIZE_MAX / dim) {
+                    std::cout << path << " has an item size that does not fit in memory!\n";
+                    close();
+                    return false;
                 }
-            } else {
-                std::cout << "Training image stream is not open!\n";
+                itemBytes *= dim;
             }
-            return currentImageFloat;
         }
+        if (itemBytes != 0 && static_cast<size_t>(dims[0]) > (fileSize - headerSize) / itemBytes) {
+            std::cout << path << " is shorter than its header declares!\n";
+            close();
+            return false;
+        }
+        payload = bytes + headerSize;
+        madvise(mapping, mappedSize, MADV_WILLNEED);
+        return true;
+    }
 
-        int32_t getImageNr(int32_t nr) {
-            int32_t pos = LABEL_OFFSET + nr;
-            if (pos >= TRAIN_LABEL_SIZE) {
-                return currentImageNr;
-            }
-            if (trainLabelStrm.is_open()) {
-                trainLabelStrm.seekg(pos, std::ios_base::beg);
-                trainLabelStrm.read(reinterpret_cast<char*>(&currentImageNr), 1);
-            } else {
-                std::cout << "Training label stream is not open!\n";
-            }
-            return currentImageNr;
+    void IdxFile::close() {
+        if (mapping) {
+            munmap(mapping, mappedSize);
+        }
+        mapping = nullptr;
+        mappedSize = 0;
+        payload = nullptr;
+        nDims = 0;
+        itemBytes = 0;
+        std::memset(dims, 0, sizeof(dims));
+    }
+
+    bool Dataset::open(const std::string &imagePath, const std::string &labelPath) {
+        MNIST_PROFILE_SCOPE("Dataset::open");
+        close();
+        if (!imageFile.open(imagePath, IMAGE_MAGIC)) {
+            return false;
+        }
+        if (labelPath.empty()) {
+            return true;
+        }
+        if (!labelFile.open(labelPath, LABEL_MAGIC)) {
+            close();
+            return false;
+        }
+        if (labelFile.count() != imageFile.count()) {
+            std::cout << labelPath << " has " << labelFile.count() << " labels for " << imageFile.count() << " images!\n";
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void Dataset::close() {
+        imageFile.close();
+        labelFile.close();
+    }
+
+    statpack::Span<const uint8_t> Dataset::image(int32_t nr) const {
+        return images(nr, 1);
+    }
+
+    statpack::Span<const uint8_t> Dataset::images(int32_t first, int32_t count) const {
+#ifdef CUSTOM_DEBUG
+        assert(first >= 0 && count >= 0 && first + count <= size() && "Image range out of bounds.");
+#endif
+        const size_t pixels = imagePixels();
+        return statpack::Span<const uint8_t>(imageFile.data() + static_cast<size_t>(first) * pixels, static_cast<size_t>(count) * pixels);
+    }
+
+    uint8_t Dataset::label(int32_t nr) const {
+#ifdef CUSTOM_DEBUG
+        assert(hasLabels() && nr >= 0 && nr < size() && "Label out of bounds.");
+#endif
+        return labelFile.data()[nr];
+    }
+
+    statpack::Span<const uint8_t> Dataset::labels(int32_t first, int32_t count) const {
+#ifdef CUSTOM_DEBUG
+        assert(hasLabels() && first >= 0 && count >= 0 && first + count <= size() && "Label range out of bounds.");
+#endif
+        return statpack::Span<const uint8_t>(labelFile.data() + first, static_cast<size_t>(count));
+    }
+
+    bool Dataset::getImage(int32_t nr, statpack::Span<float> out) const {
+        if (nr < 0 || nr >= size()) {
+            std::cout << "Image " << nr << " is out of range!\n";
+            return false;
+        }
+#ifdef CUSTOM_DEBUG
+        assert(out.size() >= imagePixels() && "Output buffer too small.");
+#endif
+        MNIST_PROFILE_SCOPE("Dataset::decode");
+        MNIST_PROFILE_WORK("Dataset::decode", 0, 2 * imagePixels(), 5 * imagePixels(), 1);
+        decodePixels(image(nr).data(), out.data(), imagePixels());
+        return true;
+    }
+
+    bool Dataset::getImages(int32_t first, int32_t count, statpack::MatrixView<float> out) const {
+        return decodeImages(first, count, out, 0.0f, 255.0f);
+    }
+
+    bool Dataset::decodeImages(int32_t first, int32_t count, statpack::MatrixView<float> out, float min, float max) const {
+        if (first < 0 || count < 0 || first + count > size()) {
+            std::cout << "Images " << first << ".." << first + count << " are out of range!\n";
+            return false;
+        }
+#ifdef CUSTOM_DEBUG
+        assert(out.rows >= static_cast<size_t>(count) && out.cols >= imagePixels() && "Output matrix too small.");
+#endif
+        const size_t pixels = imagePixels();
+        const statpack::Span<const uint8_t> block = images(first, count);
+        MNIST_PROFILE_SCOPE("Dataset::decode");
+        // One multiply and add per pixel, a byte read and a float written
+        MNIST_PROFILE_WORK("Dataset::decode", 0, 2 * block.size(), 5 * block.size(), static_cast<uint64_t>(count));
+        // Unpadded rows line up with the file, so the whole block is one pass
+        if (out.stride == pixels) {
+            decodePixels(block.data(), out.data, block.size(), min, max);
+            return true;
+        }
+        for (size_t k = 0; k < static_cast<size_t>(count); ++k) {
+            decodePixels(block.data() + k * pixels, out.row(k), pixels, min, max);
+        }
+        return true;
+    }
+
+    int32_t Dataset::getImageNr(int32_t nr) const {
+        if (!hasLabels() || nr < 0 || nr >= size()) {
+            std::cout << "Label " << nr << " is not available!\n";
+            return -1;
         }
+        return label(nr);
     }
-}
\ No newline at end of file
+}
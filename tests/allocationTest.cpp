@@ -0,0 +1,82 @@
+/**
+ *  A steady NeuralNet::train(Span, Span) loop must not touch the heap.
+ *  Every global operator new is replaced with one that counts, the net is
+ *  warmed up once, and the loop after that must count no allocations.
+ */
+#include <new>
+#include <atomic>
+#include <cstdlib>
+#include <cstddef>
+#include <vector>
+#include <string>
+#include <iostream>
+
+#include "NeuralNet.h"
+#include "check.h"
+
+namespace {
+    std::atomic<size_t> allocations{0};
+
+    void* counted(std::size_t size, std::size_t alignment = 0) {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+        if (size == 0) {
+            size = 1;
+        }
+        void *p = (alignment > alignof(std::max_align_t)
+                   ? std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment)
+                   : std::malloc(size));
+        if (!p) {
+            throw std::bad_alloc();
+        }
+        return p;
+    }
+}
+
+void* operator new(std::size_t size) { return counted(size); }
+void* operator new[](std::size_t size) { return counted(size); }
+void* operator new(std::size_t size, std::align_val_t alignment) { return counted(size, static_cast<std::size_t>(alignment)); }
+void* operator new[](std::size_t size, std::align_val_t alignment) { return counted(size, static_cast<std::size_t>(alignment)); }
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+void operator delete(void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+
+int main() {
+    for (const char *optimizer : { "sgd", "momentum", "rmsprop", "adam" }) {
+        NeuralNet net;
+        net.addLayer(100);
+        net.addLayer(64);
+        net.addLayer(784);
+        net.setOptimizer(optimizer);
+        net.build();
+        net.initializeWeights("xavier", 1);
+
+        std::vector<float> inputs(100, 0.5f);
+        std::vector<float> targets(784, 0.25f);
+        const statpack::Span<const float> inputSpan(inputs.data(), inputs.size());
+        const statpack::Span<const float> targetSpan(targets.data(), targets.size());
+
+        // First use may size lazily, e.g. the kernel table
+        net.train(inputSpan, targetSpan, 4.0f);
+        net.applyDeltas();
+
+        const size_t before = allocations.load();
+        // Building the net allocated, so the counting operator new is in use
+        CHECK(before > 0);
+        float cost = 0;
+        for (int step = 0; step < 100; ++step) {
+            cost += net.train(inputSpan, targetSpan, 4.0f);
+            if (step % 4 == 3) {
+                net.applyDeltas();
+            }
+        }
+        const size_t steady = allocations.load() - before;
+        std::cout << optimizer << ": " << steady << " allocations in 100 steps, cost " << cost / 100 << "\n";
+        CHECK(steady == 0);
+    }
+    return check::result();
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <iostream>
+#include <cmath>
+#include <cstddef>
+
+/**
+ *  Minimal checks for the test executables. A failed CHECK prints where
+ *  and carries on, and main returns check::result() so CTest sees the
+ *  failure. Works the same with and without NDEBUG, unlike assert.
+ */
+namespace check {
+    inline int failures = 0;
+
+    inline int result() {
+        if (failures > 0) {
+            std::cout << failures << " check(s) failed\n";
+        }
+        return (failures > 0 ? 1 : 0);
+    }
+
+    // |a - b| <= absolute + relative * |b|
+    inline bool near(double a, double b, double absolute, double relative = 0) {
+        return std::abs(a - b) <= absolute + relative * std::abs(b);
+    }
+}
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            ++check::failures; \
+            std::cout << __FILE__ << ":" << __LINE__ << ": CHECK(" #condition ") failed\n"; \
+        } \
+    } while (0)
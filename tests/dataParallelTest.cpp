@@ -0,0 +1,117 @@
+/**
+ *  DataParallel against serial batch training of the same net. With one
+ *  replica the steps are the serial ones and must match bit for bit. With
+ *  more, each shard's deltas are summed in a tree, which only reorders
+ *  float additions, so the weights stay within rounding of the serial run.
+ */
+#include <vector>
+#include <random>
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+#include "NeuralNet.h"
+#include "DataParallel.h"
+#include "check.h"
+
+namespace {
+    constexpr size_t IN = 40;
+    constexpr size_t HIDDEN = 32;
+    constexpr size_t OUT = 10;
+    constexpr size_t ROWS = 24;
+    constexpr size_t STEPS = 50;
+    // A few ulps of the weights after STEPS steps
+    constexpr double TOLERANCE = 1e-6;
+
+    struct Samples {
+        size_t inputStride = statpack::alignedStride<float>(IN);
+        size_t targetStride = statpack::alignedStride<float>(OUT);
+        statpack::AlignedVector<float> inputs;
+        statpack::AlignedVector<float> targets;
+
+        explicit Samples(uint32_t seed) : inputs(ROWS * inputStride, 0.0f), targets(ROWS * targetStride, 0.0f) {
+            std::mt19937 generator(seed);
+            std::uniform_real_distribution<float> distribution(0.0f, 1.0f);
+            for (size_t s = 0; s < ROWS; ++s) {
+                for (size_t i = 0; i < IN; ++i) {
+                    inputs[s * inputStride + i] = distribution(generator);
+                }
+                for (size_t k = 0; k < OUT; ++k) {
+                    targets[s * targetStride + k] = distribution(generator);
+                }
+            }
+        }
+
+        statpack::MatrixView<const float> inputView() const {
+            return statpack::MatrixView<const float>(inputs.data(), ROWS, IN, inputStride);
+        }
+
+        statpack::MatrixView<const float> targetView() const {
+            return statpack::MatrixView<const float>(targets.data(), ROWS, OUT, targetStride);
+        }
+    };
+
+    void makeNet(NeuralNet &net, const char *optimizer, float learnRate) {
+        net.addLayer(IN);
+        net.addLayer(HIDDEN);
+        net.addLayer(OUT);
+        net.learnRate = learnRate;
+        net.setOptimizer(optimizer);
+        net.build();
+        net.initializeWeights("xavier", 9);
+    }
+
+    // Largest difference of the weights and biases of two nets of the same shape
+    double maxDifference(const NeuralNet &a, const NeuralNet &b) {
+        double most = 0;
+        for (size_t i = 0; i + 1 < a.layers.size(); ++i) {
+            const float *x = a.layers[i].params.data();
+            const float *y = b.layers[i].params.data();
+            for (size_t p = 0; p < a.layers[i].paramCount(); ++p) {
+                most = std::max(most, static_cast<double>(std::abs(x[p] - y[p])));
+            }
+        }
+        return most;
+    }
+}
+
+int main() {
+    const Samples samples(3);
+    // Adam at its usual rate. At SGD's, rounding alone flips the sign of
+    // steps on near-zero gradients, so the runs would drift apart.
+    const struct {
+        const char *optimizer;
+        float learnRate;
+    } cases[] = { { "sgd", 0.5f }, { "adam", 0.001f } };
+
+    for (const auto &c : cases) {
+        NeuralNet serial;
+        makeNet(serial, c.optimizer, c.learnRate);
+        for (size_t step = 0; step < STEPS; ++step) {
+            serial.forwardBatch(samples.inputView());
+            serial.backwardBatch(samples.targetView());
+            serial.applyDeltas();
+        }
+
+        for (size_t replicas = 1; replicas <= 5; ++replicas) {
+            NeuralNet net;
+            makeNet(net, c.optimizer, c.learnRate);
+            DataParallel parallel(net, replicas);
+            CHECK(parallel.replicas() == replicas);
+            for (size_t step = 0; step < STEPS; ++step) {
+                parallel.trainBatch(samples.inputView(), samples.targetView());
+            }
+            const double difference = maxDifference(net, serial);
+            std::cout << c.optimizer << ", " << replicas << " replicas: max difference " << difference << "\n";
+            if (replicas == 1) {
+                CHECK(difference == 0);
+            } else {
+                CHECK(difference <= TOLERANCE);
+            }
+            // Replicas hold the net's parameters after every step
+            CHECK(maxDifference(parallel.replica(replicas - 1), net) == 0);
+        }
+    }
+    return check::result();
+}
@@ -0,0 +1,177 @@
+/**
+ *  DatasetCache from build to map: cached images equal decoding the
+ *  dataset, Float16 caches round pixels to half precision and back, a
+ *  second open maps instead of rebuilding, and stale, truncated or
+ *  zeroed files are rebuilt rather than used. Two builds of the same cache
+ *  at once both succeed and leave no temporary files behind.
+ */
+#include <string>
+#include <vector>
+#include <thread>
+#include <fstream>
+#include <filesystem>
+#include <iostream>
+#include <algorithm>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+
+#include "DatasetCache.h"
+#include "mnistParser.h"
+#include "check.h"
+#include "testFiles.h"
+
+namespace {
+    constexpr int32_t COUNT = 50;
+    constexpr int32_t SIDE = 28;
+    constexpr size_t PIXELS = SIDE * SIDE;
+
+    using mnistParser::DatasetCache;
+
+    DatasetCache::Config makeConfig(DatasetCache::Format format, float normMin, float normMax) {
+        DatasetCache::Config config;
+        config.normMin = normMin;
+        config.normMax = normMax;
+        config.format = format;
+        return config;
+    }
+
+    // Cached images against the dataset decoded onto the same range
+    void checkImages(const mnistParser::Dataset &dataset, const DatasetCache &cache, const DatasetCache::Config &config) {
+        CHECK(cache.isOpen() && cache.size() == static_cast<size_t>(COUNT) && cache.imagePixels() == PIXELS);
+        CHECK(cache.format() == config.format);
+        const size_t stride = statpack::alignedStride<float>(PIXELS);
+        statpack::AlignedVector<float> expected(COUNT * stride, 0.0f);
+        statpack::AlignedVector<float> actual(COUNT * stride, 0.0f);
+        const statpack::MatrixView<float> expectedView(expected.data(), COUNT, PIXELS, stride);
+        const statpack::MatrixView<float> actualView(actual.data(), COUNT, PIXELS, stride);
+        CHECK(dataset.decodeImages(0, COUNT, expectedView, config.normMin, config.normMax));
+        CHECK(cache.getImages(0, COUNT, actualView));
+
+        // Half precision keeps 11 significant bits; rounding to nearest
+        // is off by at most half of the last, or of the subnormal step
+        const bool half = (config.format == DatasetCache::Format::Float16);
+        const double relative = (half ? 1.0 / 2048 : 0);
+        const double absolute = (half ? 1.0 / (1 << 25) : 0);
+        size_t mismatches = 0;
+        for (size_t r = 0; r < static_cast<size_t>(COUNT); ++r) {
+            for (size_t i = 0; i < PIXELS; ++i) {
+                mismatches += !check::near(actualView.row(r)[i], expectedView.row(r)[i], absolute, relative);
+            }
+        }
+        CHECK(mismatches == 0);
+        if (!half) {
+            const statpack::MatrixView<const float> mapped = cache.images();
+            CHECK(mapped.rows == static_cast<size_t>(COUNT) && std::equal(mapped.row(3), mapped.row(3) + PIXELS, expectedView.row(3)));
+        }
+
+        const statpack::Span<const int32_t> labels = cache.labels();
+        CHECK(labels.size() == static_cast<size_t>(COUNT));
+        for (int32_t i = 0; i < COUNT && i < static_cast<int32_t>(labels.size()); ++i) {
+            CHECK(labels[static_cast<size_t>(i)] == dataset.label(i));
+        }
+    }
+
+    // Reopening after damage must rebuild and still give the right images
+    template <typename Damage>
+    void checkRebuilt(const char *what, const mnistParser::Dataset &dataset, const DatasetCache::Config &config,
+                      const std::string &directory, Damage damage) {
+        DatasetCache cache;
+        CHECK(cache.open(dataset, config, directory));
+        const std::string path = cache.path();
+        cache.close();
+        damage(path);
+        CHECK(cache.open(dataset, config, directory));
+        if (!cache.rebuilt()) {
+            std::cout << "  a " << what << " cache was used\n";
+            CHECK(!"damaged cache not rebuilt");
+        }
+        checkImages(dataset, cache, config);
+    }
+
+    size_t leftoverFiles(const std::string &directory) {
+        size_t count = 0;
+        for (const auto &entry : std::filesystem::directory_iterator(directory)) {
+            count += (entry.path().extension() != ".cache");
+        }
+        return count;
+    }
+}
+
+int main() {
+    const std::string directory = testFiles::makeDirectory("datasetCacheTest");
+    std::vector<uint8_t> pixels(COUNT * PIXELS);
+    std::vector<uint8_t> labels(COUNT);
+    for (size_t i = 0; i < pixels.size(); ++i) {
+        pixels[i] = static_cast<uint8_t>((i * 37 + i / 29) % 256);
+    }
+    for (size_t i = 0; i < labels.size(); ++i) {
+        labels[i] = static_cast<uint8_t>(i % 10);
+    }
+    const std::string imagePath = directory + "/images.idx";
+    const std::string labelPath = directory + "/labels.idx";
+    CHECK(testFiles::writeIdx(imagePath, mnistParser::IMAGE_MAGIC, { COUNT, SIDE, SIDE }, pixels));
+    CHECK(testFiles::writeIdx(labelPath, mnistParser::LABEL_MAGIC, { COUNT }, labels));
+    mnistParser::Dataset dataset;
+    CHECK(dataset.open(imagePath, labelPath));
+    const std::string cacheDirectory = directory + "/cache";
+
+    // Build, then map the same file
+    const DatasetCache::Config plain = makeConfig(DatasetCache::Format::Float32, 0.0f, 1.0f);
+    DatasetCache cache;
+    CHECK(cache.open(dataset, plain, cacheDirectory));
+    CHECK(cache.rebuilt());
+    checkImages(dataset, cache, plain);
+    DatasetCache again;
+    CHECK(again.open(dataset, plain, cacheDirectory));
+    CHECK(!again.rebuilt() && again.path() == cache.path());
+    checkImages(dataset, again, plain);
+    again.close();
+    cache.close();
+
+    // Float16 across the sign, and down into half subnormals
+    for (const auto &range : { std::pair<float, float>(-1.0f, 1.0f), std::pair<float, float>(0.0f, 1e-5f) }) {
+        const DatasetCache::Config halves = makeConfig(DatasetCache::Format::Float16, range.first, range.second);
+        CHECK(cache.open(dataset, halves, cacheDirectory));
+        checkImages(dataset, cache, halves);
+        cache.close();
+    }
+
+    checkRebuilt("truncated", dataset, plain, cacheDirectory, [](const std::string &path) {
+        std::filesystem::resize_file(path, std::filesystem::file_size(path) - 4);
+    });
+    checkRebuilt("stale", dataset, plain, cacheDirectory, [](const std::string &path) {
+        // A different version in the header
+        std::fstream stream(path, std::ios::binary | std::ios::in | std::ios::out);
+        const uint32_t version = DatasetCache::VERSION + 1;
+        stream.seekp(4);
+        stream.write(reinterpret_cast<const char*>(&version), sizeof(version));
+    });
+    checkRebuilt("zeroed", dataset, plain, cacheDirectory, [](const std::string &path) {
+        const auto size = std::filesystem::file_size(path);
+        std::ofstream stream(path, std::ios::binary | std::ios::trunc);
+        const std::vector<char> zeros(size, 0);
+        stream.write(zeros.data(), static_cast<std::streamsize>(zeros.size()));
+    });
+
+    // Two builds of one key at once, like parallel runs of a sweep
+    const DatasetCache::Config shared = makeConfig(DatasetCache::Format::Float32, -0.5f, 0.5f);
+    DatasetCache first;
+    DatasetCache second;
+    bool firstOpened = false;
+    bool secondOpened = false;
+    std::thread other([&] { secondOpened = second.open(dataset, shared, cacheDirectory); });
+    firstOpened = first.open(dataset, shared, cacheDirectory);
+    other.join();
+    CHECK(firstOpened && secondOpened);
+    CHECK(first.path() == second.path());
+    checkImages(dataset, first, shared);
+    checkImages(dataset, second, shared);
+    CHECK(leftoverFiles(cacheDirectory) == 0);
+
+    first.close();
+    second.close();
+    dataset.close();
+    testFiles::removeDirectory(directory);
+    return check::result();
+}
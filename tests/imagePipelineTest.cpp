@@ -0,0 +1,171 @@
+/**
+ *  ImagePipeline against the per-image templates it batches. Crop,
+ *  rescale and downsample must match cropBlackBackground, rescaleImage and
+ *  rescaleMnistToHalf bit for bit, with and without a thread pool, and a
+ *  non-zero background must crop like 0 does. standardize is checked as
+ *  a z-score of its own, since it does not follow statpack::standardize.
+ */
+#include <array>
+#include <vector>
+#include <random>
+#include <iostream>
+#include <algorithm>
+#include <cstddef>
+
+#include "ImagePipeline.h"
+#include "ThreadPool.h"
+#include "statpack.h"
+#include "check.h"
+
+namespace {
+    constexpr int SIDE = 28;
+    constexpr size_t PIXELS = SIDE * SIDE;
+    constexpr size_t IMAGES = 200;
+
+    using Image = std::array<float, PIXELS>;
+
+    /**
+     *  A box of random grey values on a 0 background, its corners set so
+     *  the box is exactly the bounding box. Boxes may touch the border.
+     */
+    std::vector<Image> randomImages(uint32_t seed) {
+        std::mt19937 generator(seed);
+        std::uniform_int_distribution<int> size(2, SIDE);
+        std::uniform_int_distribution<int> grey(0, 255);
+        std::vector<Image> images(IMAGES);
+        for (Image &image : images) {
+            image.fill(0.0f);
+            const int width = size(generator);
+            const int height = size(generator);
+            const int x0 = std::uniform_int_distribution<int>(0, SIDE - width)(generator);
+            const int y0 = std::uniform_int_distribution<int>(0, SIDE - height)(generator);
+            for (int y = y0; y < y0 + height; ++y) {
+                for (int x = x0; x < x0 + width; ++x) {
+                    image[static_cast<size_t>(y * SIDE + x)] = static_cast<float>(grey(generator)) / 255.0f;
+                }
+            }
+            for (const int x : { x0, x0 + width - 1 }) {
+                for (const int y : { y0, y0 + height - 1 }) {
+                    image[static_cast<size_t>(y * SIDE + x)] = 1.0f;
+                }
+            }
+        }
+        return images;
+    }
+
+    // One image per row
+    struct Batch {
+        size_t stride;
+        statpack::AlignedVector<float> data;
+
+        Batch(size_t rows, size_t cols) : stride(statpack::alignedStride<float>(cols)), data(rows * stride, 0.0f) {}
+
+        statpack::MatrixView<float> view(size_t rows, size_t cols) {
+            return statpack::MatrixView<float>(data.data(), rows, cols, stride);
+        }
+    };
+
+    Batch runPipeline(const statpack::ImagePipeline &pipeline, const std::vector<Image> &images, ThreadPool *pool = nullptr) {
+        Batch in(images.size(), PIXELS);
+        for (size_t i = 0; i < images.size(); ++i) {
+            std::copy(images[i].begin(), images[i].end(), in.data.data() + i * in.stride);
+        }
+        Batch out(images.size(), pipeline.outputSize());
+        const statpack::MatrixView<float> inView = in.view(images.size(), PIXELS);
+        pipeline.run(statpack::MatrixView<const float>(inView.data, inView.rows, inView.cols, inView.stride),
+                     out.view(images.size(), pipeline.outputSize()), pool);
+        return out;
+    }
+
+    template <size_t N>
+    bool sameImage(const float *actual, const std::array<float, N> &expected) {
+        for (size_t i = 0; i < N; ++i) {
+            if (actual[i] != expected[i]) {
+                std::cout << "  pixel " << i << ": " << actual[i] << " vs " << expected[i] << "\n";
+                return false;
+            }
+        }
+        return true;
+    }
+
+    statpack::ImagePipeline::Config cropConfig(int side, bool downsample) {
+        statpack::ImagePipeline::Config config;
+        config.crop = true;
+        config.widthOut = side;
+        config.heightOut = side;
+        config.downsample = downsample;
+        return config;
+    }
+}
+
+int main() {
+    const std::vector<Image> images = randomImages(11);
+
+    // Crop and rescale back to 28 x 28, then halve
+    const statpack::ImagePipeline rescale(cropConfig(SIDE, false));
+    const statpack::ImagePipeline halve(cropConfig(SIDE, true));
+    // Crop and rescale to a size that is not the input's
+    const statpack::ImagePipeline shrink(cropConfig(20, false));
+    const Batch rescaled = runPipeline(rescale, images);
+    const Batch halved = runPipeline(halve, images);
+    const Batch shrunk = runPipeline(shrink, images);
+    for (size_t i = 0; i < images.size(); ++i) {
+        const statpack::ImageVector<float> cropped = statpack::cropBlackBackground<float, SIDE, SIDE>(images[i]);
+        const Image full = statpack::rescaleImage<float, SIDE, SIDE>(cropped.data, cropped.width, cropped.height);
+        CHECK(sameImage(rescaled.data.data() + i * rescaled.stride, full));
+        CHECK(sameImage(halved.data.data() + i * halved.stride, statpack::rescaleMnistToHalf<float, PIXELS, PIXELS / 4>(full)));
+        CHECK(sameImage(shrunk.data.data() + i * shrunk.stride, statpack::rescaleImage<float, 20, 20>(cropped.data, cropped.width, cropped.height)));
+    }
+
+    // Splitting the batch across threads changes nothing
+    ThreadPool pool(3);
+    const Batch pooled = runPipeline(halve, images, &pool);
+    CHECK(pooled.data == halved.data);
+
+    // The same images on [-1, 1] with background -1 crop to the same boxes
+    std::vector<Image> shifted = images;
+    for (Image &image : shifted) {
+        for (float &pixel : image) {
+            pixel = 2.0f * pixel - 1.0f;
+        }
+    }
+    statpack::ImagePipeline::Config shiftedConfig = cropConfig(SIDE, true);
+    shiftedConfig.background = -1.0f;
+    const Batch shiftedOut = runPipeline(statpack::ImagePipeline(shiftedConfig), shifted);
+    for (size_t i = 0; i < images.size(); ++i) {
+        for (size_t k = 0; k < halve.outputSize(); ++k) {
+            CHECK(check::near(shiftedOut.data[i * shiftedOut.stride + k], 2.0 * halved.data[i * halved.stride + k] - 1.0, 1e-6));
+        }
+    }
+
+    // standardize leaves zero mean and unit variance, and flat images at 0
+    std::vector<Image> withFlat = images;
+    withFlat[0].fill(0.0f);
+    statpack::ImagePipeline::Config standardConfig = cropConfig(SIDE, true);
+    standardConfig.standardize = true;
+    const statpack::ImagePipeline standardize(standardConfig);
+    const Batch standard = runPipeline(standardize, withFlat);
+    const Batch unstandard = runPipeline(halve, withFlat);
+    const size_t size = standardize.outputSize();
+    size_t flat = 0;
+    for (size_t i = 0; i < withFlat.size(); ++i) {
+        const float *row = standard.data.data() + i * standard.stride;
+        const float *before = unstandard.data.data() + i * unstandard.stride;
+        double mean = 0;
+        double square = 0;
+        for (size_t k = 0; k < size; ++k) {
+            mean += row[k];
+            square += static_cast<double>(row[k]) * row[k];
+        }
+        mean /= static_cast<double>(size);
+        if (std::all_of(before, before + size, [&](float pixel) { return pixel == before[0]; })) {
+            ++flat;
+            CHECK(square == 0);
+        } else {
+            CHECK(check::near(mean, 0.0, 1e-5));
+            CHECK(check::near(square / static_cast<double>(size) - mean * mean, 1.0, 1e-4));
+        }
+    }
+    CHECK(flat > 0);
+    return check::result();
+}
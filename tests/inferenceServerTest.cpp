@@ -0,0 +1,158 @@
+/**
+ *  InferenceServer under load from socket clients and in-process callers
+ *  at once, against NeuralNet::generate with a Context of its own. The
+ *  server runs each micro-batch as one matrix product, which sums in a
+ *  different order than generate's dot products, so outputs agree to
+ *  float rounding. stop() must also return with a client connected but
+ *  idle, and fail that client's next request.
+ */
+#include <string>
+#include <vector>
+#include <thread>
+#include <iostream>
+#include <cstddef>
+#include <unistd.h>
+
+#include "NeuralNet.h"
+#include "InferenceServer.h"
+#include "check.h"
+
+namespace {
+    constexpr size_t IN = 30;
+    constexpr size_t HIDDEN = 24;
+    constexpr size_t OUT = 12;
+    constexpr size_t SAMPLES = 96;
+    constexpr size_t CLIENTS = 4;
+    constexpr size_t CALLERS = 4;
+    // Passes each thread makes over its share of the samples
+    constexpr size_t ROUNDS = 5;
+
+    // Per thread, so threads never share a result
+    struct Outcome {
+        size_t requests = 0;
+        size_t failed = 0;
+        size_t mismatched = 0;
+    };
+
+    std::vector<float> sample(size_t index) {
+        std::vector<float> inputs(IN);
+        for (size_t i = 0; i < IN; ++i) {
+            inputs[i] = static_cast<float>((index * 7 + i * 13) % 17) / 17.0f;
+        }
+        return inputs;
+    }
+
+    bool sameOutputs(const float *actual, const std::vector<float> &expected) {
+        for (size_t k = 0; k < OUT; ++k) {
+            if (!check::near(actual[k], expected[k], 1e-5, 1e-5)) {
+                std::cout << "  output " << k << ": " << actual[k] << " vs " << expected[k] << "\n";
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Thread first of stride threads sends samples first, first + stride, ...
+    template <typename Generate>
+    Outcome drive(Generate generate, size_t first, size_t stride, const std::vector<std::vector<float>> &expected) {
+        Outcome outcome;
+        std::vector<float> outputs(OUT);
+        for (size_t round = 0; round < ROUNDS; ++round) {
+            for (size_t s = first; s < SAMPLES; s += stride) {
+                const std::vector<float> inputs = sample(s);
+                ++outcome.requests;
+                if (!generate(statpack::Span<const float>(inputs.data(), IN), statpack::Span<float>(outputs.data(), OUT))) {
+                    ++outcome.failed;
+                } else if (!sameOutputs(outputs.data(), expected[s])) {
+                    ++outcome.mismatched;
+                }
+            }
+        }
+        return outcome;
+    }
+}
+
+int main() {
+    NeuralNet net;
+    net.addLayer(IN);
+    net.addLayer(HIDDEN);
+    net.addLayer(OUT);
+    // Outputs are mapped back onto the target range like generate()
+    net.targetMin = -2.0f;
+    net.targetMax = 3.0f;
+    net.build();
+    net.initializeWeights("xavier", 5);
+
+    std::vector<std::vector<float>> expected(SAMPLES, std::vector<float>(OUT));
+    NeuralNet::Context context;
+    for (size_t s = 0; s < SAMPLES; ++s) {
+        const std::vector<float> inputs = sample(s);
+        net.generate(context, statpack::Span<const float>(inputs.data(), IN), statpack::Span<float>(expected[s].data(), OUT));
+    }
+
+    InferenceServer::Config config;
+    config.maxBatch = 8;
+    config.maxDelayUs = 500;
+    config.workers = 2;
+    InferenceServer server;
+    CHECK(server.start(net, config));
+    CHECK(!server.start(net, config));
+    CHECK(server.inputSize() == IN && server.outputSize() == OUT);
+
+    const std::string path = "/tmp/mnistInferenceTest" + std::to_string(::getpid()) + ".sock";
+    CHECK(server.listen(path));
+
+    const size_t threads = CLIENTS + CALLERS;
+    std::vector<Outcome> outcomes(threads);
+    std::vector<std::thread> pool;
+    for (size_t t = 0; t < CLIENTS; ++t) {
+        pool.emplace_back([&, t] {
+            InferenceClient client;
+            if (!client.connect(path) || client.inputSize() != IN || client.outputSize() != OUT) {
+                outcomes[t].failed = 1;
+                return;
+            }
+            outcomes[t] = drive([&](statpack::Span<const float> inputs, statpack::Span<float> outputs) {
+                return client.generate(inputs, outputs);
+            }, t, threads, expected);
+        });
+    }
+    for (size_t t = CLIENTS; t < threads; ++t) {
+        pool.emplace_back([&, t] {
+            outcomes[t] = drive([&](statpack::Span<const float> inputs, statpack::Span<float> outputs) {
+                return server.generate(inputs, outputs);
+            }, t, threads, expected);
+        });
+    }
+    for (std::thread &thread : pool) {
+        thread.join();
+    }
+
+    size_t requests = 0;
+    for (size_t t = 0; t < threads; ++t) {
+        CHECK(outcomes[t].requests > 0);
+        CHECK(outcomes[t].failed == 0);
+        CHECK(outcomes[t].mismatched == 0);
+        requests += outcomes[t].requests;
+    }
+    CHECK(requests == SAMPLES * ROUNDS);
+    const InferenceServer::Stats stats = server.stats();
+    std::cout << stats.requests << " requests in " << stats.batches << " batches, mean batch " << stats.meanBatch << "\n";
+    CHECK(stats.requests == requests);
+    CHECK(stats.batches > 0 && stats.batches <= stats.requests);
+
+    // An idle connection must not hold up stop()
+    InferenceClient idle;
+    CHECK(idle.connect(path));
+    server.stop();
+    CHECK(!server.isRunning());
+    CHECK(::access(path.c_str(), F_OK) != 0);
+
+    const std::vector<float> inputs = sample(0);
+    std::vector<float> outputs(OUT);
+    CHECK(!idle.generate(statpack::Span<const float>(inputs.data(), IN), statpack::Span<float>(outputs.data(), OUT)));
+    CHECK(!server.generate(statpack::Span<const float>(inputs.data(), IN), statpack::Span<float>(outputs.data(), OUT)));
+    InferenceClient late;
+    CHECK(!late.connect(path));
+    return check::result();
+}
@@ -0,0 +1,146 @@
+/**
+ *  Every instruction set the build and CPU support against the scalar
+ *  kernels. Vector lanes and FMA sum and round in a different order, so
+ *  results must agree within a tolerance, not bit for bit.
+ */
+#include <vector>
+#include <random>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+
+#include "kernels.h"
+#include "check.h"
+
+namespace kernels = statpack::kernels;
+
+namespace {
+    // Sizes around every vector width, to cover the tails
+    const size_t SIZES[] = { 0, 1, 3, 4, 7, 8, 15, 16, 17, 31, 33, 64, 100, 257, 1000 };
+
+    std::vector<float> randomFloats(size_t size, float min, float max, uint32_t seed) {
+        std::mt19937 generator(seed);
+        std::uniform_real_distribution<float> distribution(min, max);
+        std::vector<float> out(size);
+        for (float &value : out) {
+            value = distribution(generator);
+        }
+        return out;
+    }
+
+    struct Results {
+        std::vector<float> dot;
+        // Tolerance scale of each dot, sum |a[i] * b[i]|
+        std::vector<float> dotMagnitude;
+        std::vector<std::vector<float>> axpy;
+        std::vector<std::vector<float>> gemm;
+        std::vector<std::vector<float>> sigmoid;
+        std::vector<std::vector<float>> dSigmoid;
+        std::vector<std::vector<float>> relu;
+        std::vector<std::vector<float>> dRelu;
+        std::vector<std::vector<float>> decode;
+    };
+
+    // rows x depth times depth x cols, odd sizes so every tile has a tail
+    constexpr size_t GEMM_ROWS = 7;
+    constexpr size_t GEMM_COLS = 37;
+    constexpr size_t GEMM_DEPTH = 45;
+
+    Results run() {
+        Results out;
+        for (size_t size : SIZES) {
+            const std::vector<float> a = randomFloats(size, -1.0f, 1.0f, 1);
+            const std::vector<float> b = randomFloats(size, -1.0f, 1.0f, 2);
+            out.dot.push_back(kernels::dot(a.data(), b.data(), size));
+            float magnitude = 0;
+            for (size_t i = 0; i < size; ++i) {
+                magnitude += std::abs(a[i] * b[i]);
+            }
+            out.dotMagnitude.push_back(magnitude);
+
+            std::vector<float> y = b;
+            kernels::axpy(y.data(), a.data(), 0.37f, size);
+            out.axpy.push_back(y);
+
+            const std::vector<float> x = randomFloats(size, -20.0f, 20.0f, 3);
+            std::vector<float> activated(size);
+            kernels::sigmoid(x.data(), activated.data(), size);
+            out.sigmoid.push_back(activated);
+            kernels::dSigmoid(x.data(), activated.data(), size);
+            out.dSigmoid.push_back(activated);
+            kernels::relu(x.data(), activated.data(), size);
+            out.relu.push_back(activated);
+            kernels::dRelu(x.data(), activated.data(), size);
+            out.dRelu.push_back(activated);
+
+            std::vector<uint8_t> bytes(size);
+            for (size_t i = 0; i < size; ++i) {
+                bytes[i] = static_cast<uint8_t>(i * 37 + 11);
+            }
+            std::vector<float> decoded(size);
+            kernels::decodeBytes(bytes.data(), decoded.data(), 2.0f / 255.0f, -1.0f, size);
+            out.decode.push_back(decoded);
+        }
+
+        const std::vector<float> A = randomFloats(GEMM_ROWS * GEMM_DEPTH, -1.0f, 1.0f, 4);
+        const std::vector<float> B = randomFloats(GEMM_DEPTH * GEMM_COLS, -1.0f, 1.0f, 5);
+        std::vector<float> C = randomFloats(GEMM_ROWS * GEMM_COLS, -1.0f, 1.0f, 6);
+        kernels::gemmAccumulate(C.data(), GEMM_COLS, A.data(), GEMM_DEPTH, B.data(), GEMM_COLS, GEMM_ROWS, GEMM_COLS, GEMM_DEPTH);
+        out.gemm.push_back(C);
+        return out;
+    }
+
+    // Elementwise within absolute + relative * |expected|
+    void compare(const char *kernel, const std::vector<std::vector<float>> &actual, const std::vector<std::vector<float>> &expected,
+                 double absolute, double relative) {
+        for (size_t s = 0; s < expected.size(); ++s) {
+            for (size_t i = 0; i < expected[s].size(); ++i) {
+                if (!check::near(actual[s][i], expected[s][i], absolute, relative)) {
+                    std::cout << "  " << kernel << " size " << expected[s].size() << " index " << i << ": "
+                              << actual[s][i] << " vs " << expected[s][i] << "\n";
+                    CHECK(!"kernel outside tolerance");
+                    return;
+                }
+            }
+        }
+    }
+}
+
+int main() {
+    kernels::setIsa(kernels::Isa::Scalar);
+    const Results reference = run();
+
+    // The scalar sigmoid itself stays close to the exact function
+    for (size_t s = 0; s < reference.sigmoid.size(); ++s) {
+        const std::vector<float> x = randomFloats(SIZES[s], -20.0f, 20.0f, 3);
+        for (size_t i = 0; i < x.size(); ++i) {
+            CHECK(check::near(reference.sigmoid[s][i], 1.0 / (1.0 + std::exp(-static_cast<double>(x[i]))), 1e-7, 1e-6));
+        }
+    }
+
+    const kernels::Isa widest = kernels::supportedIsa();
+    for (int level = static_cast<int>(kernels::Isa::Scalar) + 1; level <= static_cast<int>(widest); ++level) {
+        const kernels::Isa isa = static_cast<kernels::Isa>(level);
+        CHECK(kernels::setIsa(isa) == isa);
+        std::cout << "Checking " << kernels::isaName(isa) << "\n";
+        const Results actual = run();
+
+        for (size_t s = 0; s < reference.dot.size(); ++s) {
+            // Reordered float sums stay well within n * epsilon of the magnitude
+            if (!check::near(actual.dot[s], reference.dot[s], 1e-6 * reference.dotMagnitude[s] + 1e-30)) {
+                std::cout << "  dot size " << SIZES[s] << ": " << actual.dot[s] << " vs " << reference.dot[s] << "\n";
+                CHECK(!"dot outside tolerance");
+            }
+        }
+        compare("axpy", actual.axpy, reference.axpy, 1e-6, 1e-6);
+        compare("gemmAccumulate", actual.gemm, reference.gemm, 1e-5, 1e-5);
+        compare("sigmoid", actual.sigmoid, reference.sigmoid, 1e-7, 1e-6);
+        compare("dSigmoid", actual.dSigmoid, reference.dSigmoid, 1e-7, 1e-6);
+        compare("relu", actual.relu, reference.relu, 0, 0);
+        compare("dRelu", actual.dRelu, reference.dRelu, 0, 0);
+        compare("decodeBytes", actual.decode, reference.decode, 1e-6, 1e-6);
+    }
+    kernels::setIsa(widest);
+    return check::result();
+}
@@ -0,0 +1,270 @@
+/**
+ *  IdxStream, FloatStream and StreamBatcher on small files and named
+ *  pipes: decoded samples and one-hot targets, a pipe that ends early or
+ *  inside a record setting failed(), a clean end of an unbounded stream,
+ *  labels past the class count, short last batches and sample limits.
+ *  NeuralNet::trainStream must map the stream's targets like train().
+ */
+#include <string>
+#include <vector>
+#include <thread>
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+
+#include "SampleStream.h"
+#include "NeuralNet.h"
+#include "mnistParser.h"
+#include "check.h"
+#include "testFiles.h"
+
+namespace {
+    constexpr int32_t ROWS = 4;
+    constexpr int32_t COLS = 3;
+    constexpr size_t PIXELS = ROWS * COLS;
+    constexpr size_t CLASSES = 5;
+
+    // Room for a whole stream in one read
+    struct Buffers {
+        size_t inputStride;
+        size_t targetStride;
+        statpack::AlignedVector<float> inputs;
+        statpack::AlignedVector<float> targets;
+
+        Buffers(size_t rows, size_t inputSize, size_t targetSize) :
+            inputStride(statpack::alignedStride<float>(inputSize)),
+            targetStride(statpack::alignedStride<float>(targetSize)),
+            inputs(rows * inputStride, 0.0f),
+            targets(rows * std::max<size_t>(targetStride, 1), 0.0f) {}
+
+        size_t read(mnistParser::SampleSource &source, size_t rows) {
+            return source.read(statpack::MatrixView<float>(inputs.data(), rows, source.inputSize(), inputStride),
+                               statpack::MatrixView<float>(targets.data(), rows, source.targetSize(), targetStride));
+        }
+    };
+
+    std::vector<uint8_t> imagePixels(size_t count) {
+        std::vector<uint8_t> pixels(count * PIXELS);
+        for (size_t i = 0; i < pixels.size(); ++i) {
+            pixels[i] = static_cast<uint8_t>(i * 23 % 256);
+        }
+        return pixels;
+    }
+
+    std::vector<uint8_t> imageLabels(size_t count) {
+        std::vector<uint8_t> labels(count);
+        for (size_t i = 0; i < count; ++i) {
+            labels[i] = static_cast<uint8_t>(i % CLASSES);
+        }
+        return labels;
+    }
+
+    // A FloatStream of records whose inputs and targets are functions of the record number
+    std::vector<char> floatStream(uint32_t inputSize, uint32_t targetSize, uint64_t declared, size_t records, size_t extraBytes = 0) {
+        mnistParser::FloatStream::Header header;
+        header.inputSize = inputSize;
+        header.targetSize = targetSize;
+        header.count = declared;
+        std::vector<char> bytes(sizeof(header));
+        std::memcpy(bytes.data(), &header, sizeof(header));
+        for (size_t r = 0; r < records; ++r) {
+            for (uint32_t i = 0; i < inputSize + targetSize; ++i) {
+                const float value = (i < inputSize ? static_cast<float>((r * 7 + i) % 11) / 11.0f
+                                                   : ((r + i) % targetSize == 0 ? 1.0f : -1.0f));
+                const char *raw = reinterpret_cast<const char*>(&value);
+                bytes.insert(bytes.end(), raw, raw + sizeof(value));
+            }
+        }
+        bytes.insert(bytes.end(), extraBytes, '\0');
+        return bytes;
+    }
+
+    void checkIdx(const std::string &directory) {
+        const size_t count = 7;
+        const std::vector<uint8_t> pixels = imagePixels(count);
+        const std::string images = directory + "/images.idx";
+        const std::string labels = directory + "/labels.idx";
+        CHECK(testFiles::writeIdx(images, mnistParser::IMAGE_MAGIC, { static_cast<int32_t>(count), ROWS, COLS }, pixels));
+        CHECK(testFiles::writeIdx(labels, mnistParser::LABEL_MAGIC, { static_cast<int32_t>(count) }, imageLabels(count)));
+
+        mnistParser::IdxStream::Config config;
+        config.normMin = -1.0f;
+        config.normMax = 1.0f;
+        config.classes = CLASSES;
+        config.targetMin = -0.5f;
+        config.targetMax = 2.0f;
+        mnistParser::IdxStream stream;
+        CHECK(stream.open(images, labels, config));
+        CHECK(stream.inputSize() == PIXELS && stream.targetSize() == CLASSES && stream.count() == static_cast<int32_t>(count));
+        Buffers buffers(count + 3, PIXELS, CLASSES);
+        // Asking for more than is left reads only what is left
+        CHECK(buffers.read(stream, count + 3) == count);
+        CHECK(!stream.failed() && stream.position() == count);
+        CHECK(buffers.read(stream, 1) == 0 && !stream.failed());
+        for (size_t s = 0; s < count; ++s) {
+            for (size_t i = 0; i < PIXELS; ++i) {
+                const double expected = -1.0 + 2.0 * pixels[s * PIXELS + i] / 255.0;
+                CHECK(check::near(buffers.inputs[s * buffers.inputStride + i], expected, 1e-6));
+            }
+            for (size_t k = 0; k < CLASSES; ++k) {
+                CHECK(buffers.targets[s * buffers.targetStride + k] == (k == s % CLASSES ? 2.0f : -0.5f));
+            }
+        }
+
+        // A regular file shorter than its header is refused up front
+        std::vector<char> shortFile = testFiles::idxBytes(mnistParser::IMAGE_MAGIC, { 10, ROWS, COLS }, imagePixels(6));
+        CHECK(testFiles::writeFile(directory + "/short.idx", shortFile));
+        CHECK(!stream.open(directory + "/short.idx"));
+
+        // Through a pipe the same file reads 6 images, then fails
+        const std::string pipe = directory + "/images.pipe";
+        std::thread writer = testFiles::feedPipe(pipe, shortFile);
+        CHECK(stream.open(pipe));
+        CHECK(buffers.read(stream, 10) == 6);
+        CHECK(stream.failed() && stream.position() == 6);
+        CHECK(buffers.read(stream, 10) == 0);
+        stream.close();
+        writer.join();
+
+        // A label past the class count stops the stream before that sample
+        std::vector<uint8_t> badLabels = imageLabels(count);
+        badLabels[4] = CLASSES;
+        CHECK(testFiles::writeIdx(labels, mnistParser::LABEL_MAGIC, { static_cast<int32_t>(count) }, badLabels));
+        CHECK(stream.open(images, labels, config));
+        CHECK(buffers.read(stream, count) == 4);
+        CHECK(stream.failed());
+    }
+
+    void checkFloat(const std::string &directory) {
+        const uint32_t inputSize = 6;
+        const uint32_t targetSize = 3;
+        Buffers buffers(16, inputSize, targetSize);
+        mnistParser::FloatStream stream;
+
+        // A declared count reads exactly that many
+        const std::string path = directory + "/samples.bin";
+        CHECK(testFiles::writeFile(path, floatStream(inputSize, targetSize, 5, 5)));
+        CHECK(stream.open(path));
+        CHECK(buffers.read(stream, 16) == 5 && !stream.failed());
+        CHECK(buffers.inputs[3 * buffers.inputStride + 2] == static_cast<float>((3 * 7 + 2) % 11) / 11.0f);
+        CHECK(buffers.targets[4 * buffers.targetStride + 2] == 1.0f);
+
+        // Count 0 reads to the end, which is clean between records
+        CHECK(testFiles::writeFile(path, floatStream(inputSize, targetSize, 0, 9)));
+        CHECK(stream.open(path));
+        CHECK(buffers.read(stream, 4) == 4);
+        CHECK(buffers.read(stream, 16) == 5 && !stream.failed());
+        CHECK(buffers.read(stream, 16) == 0 && !stream.failed());
+
+        // Files with a partial or missing record are refused up front
+        CHECK(testFiles::writeFile(path, floatStream(inputSize, targetSize, 0, 3, 8)));
+        CHECK(!stream.open(path));
+        CHECK(testFiles::writeFile(path, floatStream(inputSize, targetSize, 4, 3)));
+        CHECK(!stream.open(path));
+
+        // Pipes can only find out while reading
+        const std::string pipe = directory + "/samples.pipe";
+        std::thread partial = testFiles::feedPipe(pipe, floatStream(inputSize, targetSize, 0, 3, 8));
+        CHECK(stream.open(pipe));
+        CHECK(buffers.read(stream, 16) == 3 && stream.failed());
+        stream.close();
+        partial.join();
+        std::thread missing = testFiles::feedPipe(pipe, floatStream(inputSize, targetSize, 4, 3));
+        CHECK(stream.open(pipe));
+        CHECK(buffers.read(stream, 16) == 3 && stream.failed());
+        stream.close();
+        missing.join();
+        std::thread clean = testFiles::feedPipe(pipe, floatStream(inputSize, targetSize, 0, 3));
+        CHECK(stream.open(pipe));
+        CHECK(buffers.read(stream, 16) == 3 && !stream.failed());
+        stream.close();
+        clean.join();
+    }
+
+    // Batch sizes handed out by a StreamBatcher over 10 records
+    std::vector<size_t> batchSizes(const std::string &path, size_t batchSize, uint64_t limit) {
+        mnistParser::FloatStream stream;
+        std::vector<size_t> sizes;
+        if (!stream.open(path)) {
+            return sizes;
+        }
+        mnistParser::StreamBatcher batcher(stream, batchSize, limit);
+        statpack::MatrixView<const float> inputs;
+        statpack::MatrixView<const float> targets;
+        size_t first = 0;
+        while (batcher.next(inputs, targets)) {
+            // Rows arrive in stream order
+            CHECK(inputs.row(0)[0] == static_cast<float>((first * 7) % 11) / 11.0f);
+            CHECK(inputs.cols == stream.inputSize() && targets.cols == stream.targetSize() && targets.rows == inputs.rows);
+            first += inputs.rows;
+            sizes.push_back(inputs.rows);
+        }
+        CHECK(!batcher.next(inputs, targets));
+        return sizes;
+    }
+
+    void checkBatcher(const std::string &directory) {
+        const std::string path = directory + "/batches.bin";
+        CHECK(testFiles::writeFile(path, floatStream(4, 2, 0, 10)));
+        CHECK((batchSizes(path, 4, 0) == std::vector<size_t>{ 4, 4, 2 }));
+        CHECK((batchSizes(path, 5, 0) == std::vector<size_t>{ 5, 5 }));
+        CHECK((batchSizes(path, 4, 7) == std::vector<size_t>{ 4, 3 }));
+        CHECK((batchSizes(path, 20, 0) == std::vector<size_t>{ 10 }));
+    }
+
+    // trainStream against train() per sample, targets on [-1, 1] for a sigmoid net
+    void checkTrainStream(const std::string &directory) {
+        const uint32_t inputSize = 8;
+        const uint32_t targetSize = 4;
+        const size_t records = 30;
+        const std::string path = directory + "/train.bin";
+        const std::vector<char> bytes = floatStream(inputSize, targetSize, records, records);
+        CHECK(testFiles::writeFile(path, bytes));
+
+        const auto makeNet = [](NeuralNet &net) {
+            net.addLayer(inputSize);
+            net.addLayer(6);
+            net.addLayer(targetSize);
+            net.targetMin = -1.0f;
+            net.targetMax = 1.0f;
+            net.build();
+            net.initializeWeights("xavier", 4);
+        };
+        NeuralNet streamed;
+        NeuralNet stepped;
+        makeNet(streamed);
+        makeNet(stepped);
+
+        mnistParser::FloatStream stream;
+        CHECK(stream.open(path));
+        CHECK(streamed.trainStream(stream, 1) == records);
+        CHECK(!stream.failed());
+
+        const size_t recordFloats = inputSize + targetSize;
+        for (size_t r = 0; r < records; ++r) {
+            std::vector<float> values(recordFloats);
+            std::memcpy(values.data(), bytes.data() + sizeof(mnistParser::FloatStream::Header) + r * recordFloats * sizeof(float),
+                        recordFloats * sizeof(float));
+            stepped.train(std::vector<float>(values.begin(), values.begin() + inputSize), std::vector<float>(values.begin() + inputSize, values.end()));
+            stepped.applyDeltas();
+        }
+        // One sample per batch takes the same steps as train()
+        for (size_t i = 0; i + 1 < streamed.layers.size(); ++i) {
+            const float *a = streamed.layers[i].params.data();
+            const float *b = stepped.layers[i].params.data();
+            CHECK(std::equal(a, a + streamed.layers[i].paramCount(), b));
+        }
+    }
+}
+
+int main() {
+    const std::string directory = testFiles::makeDirectory("sampleStreamTest");
+    checkIdx(directory);
+    checkFloat(directory);
+    checkBatcher(directory);
+    checkTrainStream(directory);
+    testFiles::removeDirectory(directory);
+    return check::result();
+}
@@ -0,0 +1,104 @@
+/**
+ *  StaticNeuralNet against NeuralNet: the same seed draws the same
+ *  parameters, and nets given the same weights produce and learn the same
+ *  values. The two use different dot products, so values agree to float
+ *  rounding rather than bit for bit.
+ */
+#include <memory>
+#include <vector>
+#include <random>
+#include <iostream>
+
+#include "NeuralNet.h"
+#include "StaticNeuralNet.h"
+#include "check.h"
+
+namespace {
+    constexpr size_t IN = 20;
+    constexpr size_t HIDDEN = 33;
+    constexpr size_t OUT = 10;
+
+    template <typename L>
+    void copyLayer(const NeuralNet::Layer &from, L &to) {
+        for (size_t k = 0; k < from.sizeOut; ++k) {
+            std::copy(from.weights.row(k), from.weights.row(k) + from.sizeIn, to.weightRow(k));
+            to.biases[k] = from.biases[k];
+        }
+    }
+
+    template <typename L>
+    bool sameLayer(const NeuralNet::Layer &a, const L &b, double tolerance) {
+        for (size_t k = 0; k < a.sizeOut; ++k) {
+            for (size_t i = 0; i < a.sizeIn; ++i) {
+                if (!check::near(a.weights.row(k)[i], b.weightRow(k)[i], tolerance)) {
+                    return false;
+                }
+            }
+            if (!check::near(a.biases[k], b.biases[k], tolerance)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    template <Network::Activation A>
+    void compare(const char *name) {
+        std::cout << name << "\n";
+        using Static = StaticNeuralNet<A, IN, HIDDEN, OUT>;
+        NeuralNet net;
+        net.addLayer(IN);
+        net.addLayer(HIDDEN);
+        net.addLayer(OUT);
+        net.setActivationFunction(A == Network::Activation::Relu ? "relu" : "sigmoid");
+        net.build();
+        auto fixed = std::make_unique<Static>();
+
+        // Same draws from the same seed
+        net.randomizeWeightsAndBiases(7);
+        fixed->randomizeWeightsAndBiases(7);
+        CHECK(sameLayer(net.layers[0], fixed->template layer<0>(), 0));
+        CHECK(sameLayer(net.layers[1], fixed->template layer<1>(), 0));
+
+        // Weights in a range where the activations do not saturate
+        net.initializeWeights(A == Network::Activation::Relu ? "he" : "xavier", 3);
+        copyLayer(net.layers[0], fixed->template layer<0>());
+        copyLayer(net.layers[1], fixed->template layer<1>());
+
+        std::mt19937 generator(11);
+        std::uniform_real_distribution<float> distribution(0.0f, 1.0f);
+        std::vector<float> inputs(IN);
+        std::vector<float> targets(OUT);
+        std::vector<float> expected(OUT);
+        std::vector<float> actual(OUT);
+        for (int step = 0; step < 200; ++step) {
+            for (float &x : inputs) {
+                x = distribution(generator);
+            }
+            for (float &t : targets) {
+                t = distribution(generator);
+            }
+            const statpack::Span<const float> inputSpan(inputs.data(), IN);
+            const float netCost = net.train(inputSpan, statpack::Span<const float>(targets.data(), OUT), 4.0f);
+            const float fixedCost = fixed->train(inputSpan, statpack::Span<const float>(targets.data(), OUT), 4.0f);
+            CHECK(check::near(netCost, fixedCost, 1e-5, 1e-4));
+            if (step % 4 == 3) {
+                net.applyDeltas();
+                fixed->applyDeltas();
+            }
+        }
+        CHECK(sameLayer(net.layers[0], fixed->template layer<0>(), 1e-4));
+        CHECK(sameLayer(net.layers[1], fixed->template layer<1>(), 1e-4));
+
+        net.generate(statpack::Span<const float>(inputs.data(), IN), statpack::Span<float>(expected.data(), OUT));
+        fixed->generate(statpack::Span<const float>(inputs.data(), IN), statpack::Span<float>(actual.data(), OUT));
+        for (size_t k = 0; k < OUT; ++k) {
+            CHECK(check::near(actual[k], expected[k], 1e-5, 1e-4));
+        }
+    }
+}
+
+int main() {
+    compare<Network::Activation::Sigmoid>("sigmoid");
+    compare<Network::Activation::Relu>("relu");
+    return check::result();
+}
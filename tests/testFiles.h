@@ -0,0 +1,88 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <thread>
+#include <utility>
+#include <filesystem>
+#include <cstddef>
+#include <cstdint>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ *  Scratch files and pipes for the tests that read from disk. Every test
+ *  gets a directory of its own, named after it and the process, that it
+ *  removes when it is done.
+ */
+namespace testFiles {
+    // Creates an empty directory for test under the system's temp directory
+    inline std::string makeDirectory(const std::string &test) {
+        const std::filesystem::path directory = std::filesystem::temp_directory_path() / (test + "-" + std::to_string(::getpid()));
+        std::filesystem::remove_all(directory);
+        std::filesystem::create_directories(directory);
+        return directory.string();
+    }
+
+    inline void removeDirectory(const std::string &directory) {
+        std::error_code error;
+        std::filesystem::remove_all(directory, error);
+    }
+
+    // Big-endian, like every number in an IDX header
+    inline void putInt32(std::vector<char> &bytes, int32_t value) {
+        const uint32_t bits = static_cast<uint32_t>(value);
+        for (const int shift : { 24, 16, 8, 0 }) {
+            bytes.push_back(static_cast<char>(bits >> shift));
+        }
+    }
+
+    // An IDX file of unsigned bytes, magic e.g. mnistParser::IMAGE_MAGIC
+    inline std::vector<char> idxBytes(int32_t magic, const std::vector<int32_t> &dims, const std::vector<uint8_t> &data) {
+        std::vector<char> bytes;
+        putInt32(bytes, magic);
+        for (const int32_t dim : dims) {
+            putInt32(bytes, dim);
+        }
+        bytes.insert(bytes.end(), data.begin(), data.end());
+        return bytes;
+    }
+
+    inline bool writeFile(const std::string &path, const std::vector<char> &bytes) {
+        std::ofstream stream(path, std::ios::binary | std::ios::trunc);
+        stream.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+        return static_cast<bool>(stream);
+    }
+
+    inline bool writeIdx(const std::string &path, int32_t magic, const std::vector<int32_t> &dims, const std::vector<uint8_t> &data) {
+        return writeFile(path, idxBytes(magic, dims, data));
+    }
+
+    /**
+     *  Makes a named pipe at path and a thread that writes bytes into it
+     *  once a reader opens it, then closes the pipe. Join the thread after
+     *  reading. bytes must fit the pipe buffer, so the writer never waits
+     *  on a reader that stopped early.
+     */
+    inline std::thread feedPipe(const std::string &path, std::vector<char> bytes) {
+        ::mkfifo(path.c_str(), 0600);
+        return std::thread([path, bytes = std::move(bytes)] {
+            const int fd = ::open(path.c_str(), O_WRONLY);
+            if (fd < 0) {
+                return;
+            }
+            size_t done = 0;
+            while (done < bytes.size()) {
+                const ssize_t n = ::write(fd, bytes.data() + done, bytes.size() - done);
+                if (n <= 0) {
+                    break;
+                }
+                done += static_cast<size_t>(n);
+            }
+            ::close(fd);
+        });
+    }
+}
@@ -2,12 +2,14 @@
 # Takes in N number of command line arguments
 # Each argument must be a valid path of a text file
 # Each line in the text file must contain single value
+# or a binary metrics file written by MetricsSink
 # Plots line plots from the files
 #########################################################
 
 import sys, os.path, re
 import numpy as np
 import matplotlib.pyplot as plt
+from metrics import isMetricsFile, readMetrics
 
 class Options:
     color = "b"
@@ -28,6 +30,17 @@ def doesExist(path):
 
 def linePlot(fname, axs = None):
     splitted = re.split("\\\\|//|\\|/", fname)
+    if (isMetricsFile(fname)):
+        names, steps, values = readMetrics(fname)
+        target = plt if axs == None else axs
+        if (axs != None):
+            axs.set_title(splitted[len(splitted) - 1])
+        plots = None
+        for c in range(len(names)):
+            plots = target.plot(steps, values[c], linewidth = Options.linewidth, markersize = Options.markersize, label = names[c])
+        if (len(names) > 1):
+            target.legend()
+        return plots
     lines = np.loadtxt(fname, delimiter="  ", unpack=True)
     size = len(lines.shape)
     if (axs == None):
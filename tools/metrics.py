@@ -0,0 +1,57 @@
+#########################################################
+# Reader for the binary files written by MetricsSink
+# (mnistLib/headers/Metrics.h)
+#########################################################
+
+import struct
+import numpy as np
+
+MAGIC = 0x544D4E4D
+VERSION = 1
+
+# The writer's native byte order: "<" or ">", None if head is no metrics magic
+def byteOrder(head):
+    if (len(head) < 4):
+        return None
+    for order in ("<", ">"):
+        if (struct.unpack_from(order + "I", head, 0)[0] == MAGIC):
+            return order
+    return None
+
+def isMetricsFile(path):
+    with open(path, "rb") as f:
+        head = f.read(4)
+    return byteOrder(head) is not None
+
+# Returns (names, steps, values) where values has one row per column
+def readMetrics(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    order = byteOrder(data)
+    if (order is None):
+        raise ValueError(path + " is not a metrics file")
+    version, columns = struct.unpack_from(order + "II", data, 4)
+    if (version != VERSION):
+        raise ValueError(path + " is not a version " + str(VERSION) + " metrics file")
+    offset = 12
+    names = []
+    for _ in range(columns):
+        (length,) = struct.unpack_from(order + "I", data, offset)
+        offset += 4
+        names.append(data[offset:offset + length].decode())
+        offset += length
+
+    steps = []
+    values = [[] for _ in range(columns)]
+    while (offset + 4 <= len(data)):
+        (rows,) = struct.unpack_from(order + "I", data, offset)
+        offset += 4
+        steps.append(np.frombuffer(data, dtype=order + "u8", count=rows, offset=offset))
+        offset += 8 * rows
+        for c in range(columns):
+            values[c].append(np.frombuffer(data, dtype=order + "f4", count=rows, offset=offset))
+            offset += 4 * rows
+
+    steps = np.concatenate(steps) if steps else np.zeros(0, dtype=order + "u8")
+    values = np.array([np.concatenate(v) if v else np.zeros(0, dtype=order + "f4") for v in values])
+    return names, steps, values
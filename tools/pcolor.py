@@ -1,6 +1,7 @@
 import sys, os.path, re
 import numpy as np
 import matplotlib.pyplot as plt
+from metrics import isMetricsFile, readMetrics
 
 class Options:
     color = "b"
@@ -21,11 +22,17 @@ def doesExist(path):
 
 def pcolor(fname, axs = None):
     splitted = re.split("\\\\|//|\\|/", fname)
-    firstline = ""
-    with open(fname) as f:
-        firstline = f.readline().rstrip()
-    columns = len(re.split("\t|\s+", firstline))
-    data = np.transpose(np.loadtxt(fname, usecols=range(columns)))
+    if (isMetricsFile(fname)):
+        names, steps, data = readMetrics(fname)
+        columns = len(names)
+        if (columns == 1):
+            data = data[0]
+    else:
+        firstline = ""
+        with open(fname) as f:
+            firstline = f.readline().rstrip()
+        columns = len(re.split("\t|\s+", firstline))
+        data = np.transpose(np.loadtxt(fname, usecols=range(columns)))
     max = data.max()
     min = data.min()
     scaledDiff = (max - min) * .95